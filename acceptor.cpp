@@ -47,6 +47,8 @@ Acceptor::Acceptor(IOManager* io_manager, int port, AcceptCallback* cb)
   Callback<void>* readUpCall = makeCallableMany(&Acceptor::doAccept, this);
   Callback<void>* writeUpCall = makeCallableMany(&Acceptor::noOp, this);
   io_descr_ = io_manager_->newDescriptor(listen_fd_, readUpCall, writeUpCall);
+  io_descr_->setCompletions(makeCallableMany(&Acceptor::acceptComplete, this),
+                            NULL);
 }
 
 Acceptor::~Acceptor() {
@@ -76,7 +78,9 @@ void Acceptor::close() {
 }
 
 void Acceptor::startAccept() {
-  io_descr_->readWhenReady();
+  if (! io_descr_->submitAccept()) {
+    io_descr_->readWhenReady();
+  }
 }
 
 static int socketAccept(int fd, struct sockaddr* addr, socklen_t* len) {
@@ -93,14 +97,55 @@ void Acceptor::doAccept() {
     socklen_t len = sizeof(client);
     int fd = socketAccept(listen_fd_, (struct sockaddr*) &client, &len);
 
+    // close() may be running concurrently, so 'io_descr_' is read
+    // once. The descriptor itself is only reclaimed after the workers
+    // stop.
     if ((fd < 0) && (errno == EAGAIN)) {
-      io_descr_->readWhenReady();
+      Descriptor* descr = io_descr_;
+      if (descr != NULL) {
+        descr->readWhenReady();
+      }
       break;
     }
 
     if (accept_cb_ != NULL) {
       (*accept_cb_)(fd);
     }
+
+    // Any other error (e.g., the socket was closed) would just repeat
+    // itself; the callback was told about it.
+    if (fd < 0) {
+      break;
+    }
+  }
+}
+
+void Acceptor::acceptComplete(int res) {
+  // close() may be running concurrently, as in doAccept(). Once it
+  // ran, the pending request is cancelled and its completion dropped.
+  Descriptor* descr = io_descr_;
+  if ((res == -EINTR) || (res == -ECONNABORTED)) {
+    if (descr != NULL) {
+      descr->submitAccept();
+    }
+    return;
+  }
+
+  // Older kernels don't wait on a non-blocking socket.
+  if (res == -EAGAIN) {
+    if (descr != NULL) {
+      descr->readWhenReady();
+    }
+    return;
+  }
+
+  if (accept_cb_ != NULL) {
+    (*accept_cb_)(res < 0 ? -1 : res);
+  }
+
+  // As in doAccept(), an error would just repeat itself.
+  if ((res >= 0) && (descr != NULL)) {
+    descr->submitAccept();
   }
 }
 
@@ -17,7 +17,9 @@ typedef Callback<void, int> AcceptCallback;
 // The Acceptor handles a listening socket.  It uses an assigned
 // io_manager so to never block. Upon forming a connection, the
 // Acceptor issues a previously registered callback that takes the
-// client socket as an argument.
+// client socket as an argument. If the io_manager's poller carries
+// out I/O itself (io_uring), the Acceptor keeps an accept request
+// pending with it rather than waiting for the socket to be ready.
 //
 // Thread-safety:
 //
@@ -71,6 +73,10 @@ private:
   void doAccept();
   void noOp();
 
+  // Issues the accept callback with the result 'res' of an accept
+  // request and submits the next one.
+  void acceptComplete(int res);
+
   // Non-copyable, non-assignable.
   Acceptor(const Acceptor&);
   Acceptor& operator=(const Acceptor&);
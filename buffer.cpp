@@ -1,10 +1,14 @@
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <pthread.h>
 #include <stdlib.h> // exit
 #include <string.h> // strlen
 
 #include "buffer.hpp"
+#include "buffer_slice.hpp"
+#include "byte_scan.hpp"
+#include "chunk_pool.hpp"
 #include "logging.hpp"
 
 namespace base {
@@ -13,25 +17,61 @@ using std::cout;
 using std::endl;
 using std::min;
 
-Buffer::Buffer()
-  : wpos_(addChunk()), rpos_(wpos_) {}
+// Number of chunk descriptors a new Buffer has room for. Most
+// buffers never need more.
+static const size_t InitialRingSize = 8;
+
+Buffer::Buffer(size_t chunk_size)
+  : chunk_size_(chunk_size),
+    ring_(new Chunk[InitialRingSize]),
+    ring_mask_(InitialRingSize - 1),
+    head_(0),
+    num_chunks_(0),
+    bytes_(0),
+    wpos_(addChunk()),
+    rpos_(wpos_) {
+  if (chunk_size_ == 0) {
+    LOG(LogMessage::FATAL) << "Can't build a buffer of empty chunks";
+  }
+}
 
 Buffer::~Buffer() {
-  for (Chunks::iterator it = chunks_.begin(); it != chunks_.end(); ++it) {
-    delete [] *it;
+  for (size_t i = 0; i < num_chunks_; i++) {
+    releaseChunk(chunkAt(i).ptr);
   }
+  delete [] ring_;
+  unreserve();
 }
 
 bool Buffer::reserve(size_t bytes) {
-  if (bytes > BlockSize) {
+  if (bytes > chunk_size_) {
     return false;
   }
 
   // current write chunk has place enough
-  if (BlockSize - wpos_.off >= bytes ) {
+  if (writeSize() >= bytes) {
     return true;
   }
 
+  startChunk(chunk_size_);
+  return true;
+}
+
+void Buffer::reserveContiguous(size_t bytes) {
+  if (writeSize() < bytes) {
+    startChunk(bytes);
+  }
+}
+
+void Buffer::startChunk(size_t capacity) {
+  // an untouched chunk is simply replaced
+  Chunk& last = chunkAt(wpos_.idx);
+  if (last.size == 0) {
+    releaseChunk(last.ptr);
+    last = newChunk(capacity);
+    return;
+  }
+
   // if current chunk was fully consumed already, move reading pointer
   // to the chunk about to be allocated
   bool should_advance = false;
@@ -40,13 +80,12 @@ bool Buffer::reserve(size_t bytes) {
   }
 
   // allocate a new chunk and skip to it
-  wpos_ = addChunk();
+  pushChunk(newChunk(capacity));
+  wpos_ = Position(num_chunks_ - 1, 0);
   if (should_advance) {
     rpos_ = wpos_;
     dropChunks(1);
   }
-
-  return true;
 }
 
 bool Buffer::advance(size_t bytes) {
@@ -54,10 +93,67 @@ bool Buffer::advance(size_t bytes) {
 
   if (bytes <= writeSize()) {
     wpos_.off += bytes;
-    sizes_[wpos_.idx] += bytes;
+    chunkAt(wpos_.idx).size += bytes;
+    bytes_ += bytes;
     return true;
   }
-  return false;
+
+  if (bytes > writeSize() + spares_.size() * chunk_size_) {
+    return false;
+  }
+
+  // The data filled the current chunk and spilled over into the
+  // chunks set aside by writeVector().
+  bytes_ += bytes;
+  bytes -= writeSize();
+  chunkAt(wpos_.idx).size = chunkAt(wpos_.idx).capacity;
+  size_t used = 0;
+  size_t bytes_in_chunk = 0;
+  while (bytes > 0) {
+    bytes_in_chunk = min(bytes, chunk_size_);
+    Chunk chunk = { spares_[used++], bytes_in_chunk, chunk_size_ };
+    pushChunk(chunk);
+    bytes -= bytes_in_chunk;
+  }
+  spares_.erase(spares_.begin(), spares_.begin() + used);
+
+  wpos_.idx = num_chunks_ - 1;
+  wpos_.off = bytes_in_chunk;
+  return true;
+}
+
+int Buffer::writeVector(struct iovec* iov, int max_iov, size_t bytes) {
+  if (max_iov <= 0) {
+    return 0;
+  }
+
+  // make sure the first area isn't empty, so the read pointer never
+  // lags behind on a full chunk
+  if (writeSize() == 0) {
+    reserve(chunk_size_);
+  }
+
+  iov[0].iov_base = writePtr();
+  iov[0].iov_len = writeSize();
+  size_t total = writeSize();
+  int count = 1;
+  for (size_t i = 0; (total < bytes) && (count < max_iov); i++) {
+    if (i == spares_.size()) {
+      spares_.push_back(newChunk(chunk_size_).ptr);
+    }
+    iov[count].iov_base = spares_[i];
+    iov[count].iov_len = chunk_size_;
+    total += chunk_size_;
+    count++;
+  }
+  return count;
+}
+
+void Buffer::unreserve() {
+  for (size_t i = 0; i < spares_.size(); i++) {
+    releaseChunk(spares_[i]);
+  }
+  spares_.clear();
 }
 
 void Buffer::write(const MemPiece& data) {
@@ -70,32 +166,41 @@ void Buffer::write(const MemPiece& data) {
     bytes_left -= bytes_in_chunk;
 
     // write as much as possible in this chunk
-    for (size_t i = bytes_in_chunk ; i > 0; i--, dest++, src++) {
-      *dest = *src;
-    }
+    memcpy(dest, src, bytes_in_chunk);
+    src += bytes_in_chunk;
 
     // the write pointer should be on the next free byte in the chunk
-    sizes_[wpos_.idx] += bytes_in_chunk;
+    chunkAt(wpos_.idx).size += bytes_in_chunk;
     wpos_.off += bytes_in_chunk;
+    bytes_ += bytes_in_chunk;
 
     // allocate new chunk if necessary
-    if ((bytes_left > 0) || (wpos_.off == BlockSize)) {
+    if ((bytes_left > 0) || (writeSize() == 0)) {
       wpos_ = addChunk();
     }
   }
 }
 
-char* Buffer::maybeRemoveLastChunk() {
-  char* last_chunk = NULL;
-  if (sizes_[wpos_.idx] == 0) {
+Buffer::Chunk Buffer::maybeRemoveLastChunk() {
+  Chunk last_chunk = { NULL, 0, 0 };
+  if (chunkAt(wpos_.idx).size == 0) {
     // wpos_ will become invalid, caller should fix it
-    last_chunk = chunks_[wpos_.idx];
-    chunks_.pop_back();
-    sizes_.pop_back();
+    last_chunk = chunkAt(wpos_.idx);
+    num_chunks_--;
   }
   return last_chunk;
 }
 
+void Buffer::skipConsumedChunk() {
+  // If everything before the newly added chunks was consumed already,
+  // move the read pointer over and drop what it left behind.
+  if ((readSize() == 0) && (rpos_.idx < wpos_.idx)) {
+    rpos_.idx += 1;
+    rpos_.off = 0;
+    dropChunks(rpos_.idx);
+  }
+}
+
 void Buffer::appendFrom(Buffer* other) {
   if (other->isConsumed()) {
     LOG(LogMessage::FATAL) << "Can't append from consumed buffer";
@@ -108,46 +213,44 @@ void Buffer::appendFrom(Buffer* other) {
   }
 
   // avoid appending empty chunks or appending after one
-  char* last_chunk = this->maybeRemoveLastChunk();
-  char* other_last_chunk = other->maybeRemoveLastChunk();
+  const Chunk last_chunk = this->maybeRemoveLastChunk();
+  const Chunk other_last_chunk = other->maybeRemoveLastChunk();
 
   // append all ohter's chunks into 'this'
-  for (size_t i = 0; i < other->chunks_.size(); i++) {
-    chunks_.push_back(other->chunks_[i]);
-    sizes_.push_back(other->sizes_[i]);
+  for (size_t i = 0; i < other->num_chunks_; i++) {
+    pushChunk(other->chunkAt(i));
   }
+  bytes_ += other->bytes_;
 
-  // if the last appended chunk is full, add a new (or the saved)
-  // chunk
-  if (sizes_.back() == BlockSize ) {
-    if (last_chunk == NULL) {
+  // if the last appended chunk is full or shared, and so can't be
+  // written to, add a new (or the saved) chunk
+  const Chunk& appended = chunkAt(num_chunks_ - 1);
+  if (appended.size == appended.capacity || isShared(appended.ptr)) {
+    if (last_chunk.ptr == NULL) {
       addChunk();
     } else {
-      chunks_.push_back(last_chunk);
-      sizes_.push_back(0);
+      pushChunk(last_chunk);
     }
-  } else {
-    delete [] last_chunk;
-  }
-
-  // adjust pointer if it was on eob before
-  if (readSize() == 0) {
-    rpos_.idx +=1;
-    rpos_.off = 0;
+  } else if (last_chunk.ptr != NULL) {
+    releaseChunk(last_chunk.ptr);
   }
 
   // adjust write pointer to new ending chunk
-  wpos_.idx = chunks_.size() - 1;
-  wpos_.off = sizes_.back();
+  wpos_.idx = num_chunks_ - 1;
+  wpos_.off = chunkAt(wpos_.idx).size;
+
+  // adjust pointer if it was on eob before
+  skipConsumedChunk();
 
   // adjust other's state
-  other->chunks_.clear();
-  other->sizes_.clear();
-  if (other_last_chunk == NULL) {
+  other->head_ = 0;
+  other->num_chunks_ = 0;
+  other->bytes_ = 0;
+  if (other_last_chunk.ptr == NULL) {
     other->wpos_ = other->addChunk();
   } else {
-    other->chunks_.push_back(other_last_chunk);
-    other->sizes_.push_back(0);
+    other->pushChunk(other_last_chunk);
+    other->wpos_ = Position(0, 0);
   }
   other->rpos_ = other->wpos_;
 }
@@ -163,26 +266,74 @@ void Buffer::copyFrom(Buffer* other) {
     return;
   }
 
-  for (size_t i = 0; i < other->chunks_.size(); i++) {
-    // first chunk from 'other' fits in last chunk from 'this'?
-    const size_t len = other->sizes_[i];
-    if ((i != 0) || (len > writeSize())) {
-      wpos_ = addChunk();
+  // The chunks in 'other' may be of any size. Their contents are
+  // packed into chunks of this Buffer's size.
+  for (size_t i = 0; i < other->num_chunks_; i++) {
+    const Chunk& chunk = other->chunkAt(i);
+    write(MemPiece(chunk.ptr, chunk.size));
+  }
+
+  // don't let the read pointer lag behind on a consumed chunk
+  skipConsumedChunk();
+}
+
+void Buffer::shareFrom(Buffer* other) {
+  if (other->isConsumed()) {
+    LOG(LogMessage::FATAL) << "Can't share from consumed buffer";
+    return;
+  }
+
+  // is there anything to share at all?
+  if (other->readSize() == 0) {
+    return;
+  }
+
+  // avoid leaving an empty chunk in between the shared ones
+  const Chunk last_chunk = this->maybeRemoveLastChunk();
+
+  for (size_t i = 0; i < other->num_chunks_; i++) {
+    const Chunk& chunk = other->chunkAt(i);
+    if (chunk.size == 0) {
+      continue;
     }
+    acquireChunk(chunk.ptr);
+    pushChunk(chunk);
+  }
+  bytes_ += other->bytes_;
 
-    memcpy(writePtr(), other->chunks_[i], len);
-    sizes_[wpos_.idx] += len;
-    wpos_.off += len;
+  // Shared chunks are read-only. Writing resumes on a private chunk,
+  // the saved one if there was one.
+  if (last_chunk.ptr == NULL) {
+    addChunk();
+  } else {
+    pushChunk(last_chunk);
   }
 
-  // if last chunk is full, allocate a new one
-  if (wpos_.off == BlockSize) {
-    wpos_ = addChunk();
+  // adjust write pointer to new ending chunk
+  wpos_.idx = num_chunks_ - 1;
+  wpos_.off = 0;
+
+  skipConsumedChunk();
+}
+
+int Buffer::readVector(struct iovec* iov, int max_iov) const {
+  int count = 0;
+  size_t off = rpos_.off;
+  for (size_t i = rpos_.idx; (i < num_chunks_) && (count < max_iov); i++) {
+    const Chunk& chunk = chunkAt(i);
+    if (chunk.size > off) {
+      iov[count].iov_base = chunk.ptr + off;
+      iov[count].iov_len = chunk.size - off;
+      count++;
+    }
+    off = 0;
   }
+  return count;
 }
 
 void Buffer::consume(size_t bytes_to_consume) {
   size_t chunks_to_drop = 0;
+  bytes_ -= min(bytes_to_consume, bytes_);
 
   // consuming blocks before the last one
   while ((bytes_to_consume > 0) && (rpos_.idx < wpos_.idx)) {
@@ -209,23 +360,26 @@ void Buffer::consume(size_t bytes_to_consume) {
   dropChunks(chunks_to_drop);
 }
 
-size_t Buffer::byteCount() const {
-  // count bytes in current (reading) chunk
-  size_t count = 0;
-  count += readSize();
-
-  // count bytes on unread chunks
-  for (size_t i = 1; i < sizes_.size(); i++) {
-    count += sizes_[i];
+void Buffer::pushChunk(const Chunk& chunk) {
+  // double the ring if it is full, unwrapping it on the way
+  if (num_chunks_ == ring_mask_ + 1) {
+    const size_t capacity = 2 * num_chunks_;
+    Chunk* ring = new Chunk[capacity];
+    for (size_t i = 0; i < num_chunks_; i++) {
+      ring[i] = chunkAt(i);
+    }
+    delete [] ring_;
+    ring_ = ring;
+    ring_mask_ = capacity - 1;
+    head_ = 0;
   }
-  return count;
+
+  chunkAt(num_chunks_++) = chunk;
 }
 
 Buffer::Position Buffer::addChunk() {
-  char* chunk = new char[BlockSize];
-  chunks_.push_back(chunk);
-  sizes_.push_back(0);
-  return Position(chunks_.size()-1, 0);
+  pushChunk(newChunk(chunk_size_));
+  return Position(num_chunks_-1, 0);
 }
 
 void Buffer::dropChunks(size_t n) {
@@ -233,12 +387,81 @@ void Buffer::dropChunks(size_t n) {
   wpos_.idx -= n;
   rpos_.idx -= n;
   while (n-- > 0) {
-    delete [] chunks_.front();
-    chunks_.pop_front();
-    sizes_.pop_front();
+    releaseChunk(ring_[head_].ptr);
+    head_ = (head_ + 1) & ring_mask_;
+    num_chunks_--;
   }
 }
 
+// Each chunk is preceded by a header holding its reference count and
+// its size, which tells where to return it to. The header is padded so
+// the chunk itself keeps the alignment new[] gives.
+union ChunkHeader {
+  struct {
+    int    refs;
+    size_t capacity;
+  }      info;
+  double align;
+};
+
+static ChunkHeader* chunkHeader(char* chunk) {
+  return reinterpret_cast<ChunkHeader*>(chunk) - 1;
+}
+
+// Chunks are recycled through a ChunkPool. The depot is capped so
+// that a burst of traffic doesn't pin its peak memory forever.
+static const size_t MaxPooledBytes = 32 << 20;
+
+static pthread_once_t pool_init_control = PTHREAD_ONCE_INIT;
+static ChunkPool* chunk_pool = NULL;
+
+static void initChunkPool() {
+  chunk_pool = new ChunkPool(sizeof(ChunkHeader) + Buffer::BlockSize,
+                             MaxPooledBytes);
+}
+
+ChunkPool* Buffer::chunkPool() {
+  pthread_once(&pool_init_control, initChunkPool);
+  return chunk_pool;
+}
+
+Buffer::Chunk Buffer::newChunk(size_t capacity) {
+  // Only chunks of the default size are pooled.
+  char* mem;
+  if (capacity == BlockSize) {
+    mem = chunkPool()->alloc();
+  } else {
+    mem = new char[sizeof(ChunkHeader) + capacity];
+  }
+  ChunkHeader* header = reinterpret_cast<ChunkHeader*>(mem);
+  header->info.refs = 1;
+  header->info.capacity = capacity;
+
+  Chunk chunk = { mem + sizeof(ChunkHeader), 0, capacity };
+  return chunk;
+}
+
+void Buffer::acquireChunk(char* chunk) {
+  __sync_fetch_and_add(&chunkHeader(chunk)->info.refs, 1);
+}
+
+void Buffer::releaseChunk(char* chunk) {
+  ChunkHeader* header = chunkHeader(chunk);
+  if (__sync_sub_and_fetch(&header->info.refs, 1) == 0) {
+    if (header->info.capacity == BlockSize) {
+      chunkPool()->free(reinterpret_cast<char*>(header));
+    } else {
+      delete [] reinterpret_cast<char*>(header);
+    }
+  }
+}
+
+bool Buffer::isShared(char* chunk) {
+  // Only holders of a chunk can share it, so a count of one can't
+  // change under its sole holder.
+  return *(volatile int*)&chunkHeader(chunk)->info.refs > 1;
+}
+
 bool Buffer::isConsumed() const {
   if ((rpos_.idx != 0) || (rpos_.off != 0)) {
     return true;
@@ -257,7 +480,7 @@ Buffer::Iterator::Iterator(Buffer* buffer)
     bytes_read_(0),
     bytes_total_(buffer->byteCount()),
     budget_(getBudget()),
-    chunk_start_(buffer_->chunks_[pos_.idx]) {
+    chunk_start_(buffer_->chunkAt(pos_.idx).ptr) {
 }
 
 Buffer::Iterator Buffer::begin() {
@@ -274,27 +497,114 @@ Buffer::Iterator Buffer::end() {
 
 size_t Buffer::Iterator::getBudget() const {
   // can read as many positions as are there until the end of this chunk
-  return buffer_->sizes_[pos_.idx] - pos_.off;
+  return buffer_->chunkAt(pos_.idx).size - pos_.off;
 }
 
 void Buffer::Iterator::slowNext() {
   // try advancing in the current chunk first
-  if (pos_.off < buffer_->sizes_[pos_.idx]) {
+  if (pos_.off < buffer_->chunkAt(pos_.idx).size) {
     pos_.off++;
     bytes_read_++;
 
     // fell off chunk or remainder of the chunk is empty?
-    if ((pos_.off == buffer_->sizes_[pos_.idx]) &&
+    if ((pos_.off == buffer_->chunkAt(pos_.idx).size) &&
         (pos_.idx < buffer_->wpos_.idx)) {
       pos_.idx++;
       pos_.off = 0;
-      chunk_start_ = buffer_->chunks_[pos_.idx];
+      chunk_start_ = buffer_->chunkAt(pos_.idx).ptr;
     }
 
     budget_ = getBudget();
   }
 }
 
+bool Buffer::Iterator::findChar(char a, char b, std::string* skipped) {
+  while (true) {
+    // the budget may be stale if the buffer grew in the meantime
+    if (budget_ == 0) {
+      budget_ = getBudget();
+      if (budget_ == 0) {
+        return false;
+      }
+    }
+
+    // scan what is left of the current chunk
+    const char* start = chunk_start_ + pos_.off;
+    const char* found = ByteScan::find(start, budget_, a, b);
+    const size_t bytes = (found != NULL) ? found - start : budget_;
+    if (skipped != NULL) {
+      skipped->append(start, bytes);
+    }
+    skip(bytes);
+    if (found != NULL) {
+      return true;
+    }
+  }
+}
+
+bool Buffer::Iterator::sliceTo(char a, char b, BufferSlice* slice) {
+  // Most fields lie within a single chunk. Those are just pointed to.
+  if (budget_ == 0) {
+    budget_ = getBudget();
+  }
+  const char* start = chunk_start_ + pos_.off;
+  const char* found = ByteScan::find(start, budget_, a, b);
+  if (found != NULL) {
+    slice->set(start, found - start);
+    skip(found - start);
+    return true;
+  }
+
+  // This one spans chunks. Gather it in the slice's own storage.
+  string* storage = slice->storage();
+  storage->append(start, budget_);
+  skip(budget_);
+  const bool res = findChar(a, b, storage);
+  slice->set(storage->data(), storage->size());
+  return res;
+}
+
+bool Buffer::Iterator::findString(const MemPiece& delim) {
+  const char* want = delim.ptr();
+  const size_t len = delim.len();
+  if (len == 0) {
+    return true;
+  }
+
+  while (findChar(want[0], want[0], NULL)) {
+    // compare the remainder on a copy, which may cross into the
+    // next chunks
+    Iterator probe(*this);
+    probe.next();
+    size_t i = 1;
+    while ((i < len) && !probe.eob() && (probe.getChar() == want[i])) {
+      probe.next();
+      i++;
+    }
+    if (i == len) {
+      return true;
+    }
+    if (probe.eob()) {
+      return false;
+    }
+    next();
+  }
+  return false;
+}
+
+void Buffer::Iterator::skip(size_t n) {
+  if (n == 0) {
+    return;
+  }
+
+  // all but the last position are within the budget; the last one
+  // may cross over to the next chunk
+  budget_ -= n - 1;
+  pos_.off += n - 1;
+  bytes_read_ += n - 1;
+  next();
+}
+
 bool Buffer::Position::operator==(const Buffer::Position& other) {
   return (idx == other.idx) && (off == other.off);
 }
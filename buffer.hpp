@@ -1,14 +1,18 @@
 #ifndef MCP_BASE_BUFFER_HEADER
 #define MCP_BASE_BUFFER_HEADER
 
-#include <deque>
 #include <string>
+#include <sys/uio.h>  // iovec
+#include <vector>
 
 #include "mem_piece.hpp"
 
 namespace base {
 
-using std::deque;
+using std::vector;
+
+class BufferSlice;
+class ChunkPool;
 
 // This is a streaming buffer designed to be shared between a producer
 // and a consumer of its data. It has little thread-safety guarantees
@@ -49,13 +53,39 @@ using std::deque;
 //  synchronized way, a consumer can read from that area while a
 //  producer is writing new data. Note that the consumer would have to
 //  call consume() to signal when it finished reading that area -- and
-//  consume() is *not* thread safe.
+//  consume() is *not* thread safe. readVector() works the same way
+//  for all the data that can be read.
+//
+//
+//  Sharing:
+//
+//  Chunks are reference counted. shareFrom() links the chunks of
+//  another Buffer into this one without copying their contents, so
+//  the same data can be sent down several sockets at once (e.g., a
+//  FileCache entry). A shared chunk is read-only; writing always
+//  resumes on a private chunk. A chunk's memory is released when the
+//  last Buffer referring to it consumes or drops it.
+//
+//
+//  Chunk memory comes from a per-thread ChunkPool (see
+//  chunk_pool.hpp) rather than straight from the heap.
+//
+//
+//  Chunk sizes:
+//
+//  Each Buffer picks the size of the chunks it allocates when it is
+//  built. The default, BlockSize (4k), suits socket traffic and is
+//  the only size that is pooled. Buffers that hold large objects
+//  (e.g., cached files) can use much larger chunks, and
+//  reserveContiguous() adds a single chunk of any size. A Buffer may
+//  therefore hold chunks of mixed sizes, also because appendFrom()
+//  and shareFrom() take chunks from Buffers with other chunk sizes.
 //
 //
 //  Caveats:
 //
 //  The largest piece of data that can be written or read to/from the
-//  Buffer has at most the size of a chunk. We're using 4k chunks here.
+//  Buffer in one go has at most the size of a chunk.
 //
 //  Buffer is not the fastest buffer scheme on earth, but it is easy
 //  to debug, if need be. The iterator, in particular, can be
@@ -66,7 +96,8 @@ class Buffer {
 public:
   class Iterator;
 
-  Buffer();
+  // Builds a Buffer that allocates chunks of 'chunk_size' bytes.
+  explicit Buffer(size_t chunk_size = BlockSize);
   ~Buffer();
 
   //
@@ -78,23 +109,44 @@ public:
 
   // Returns true and makes sure that there is at least 'bytes'
   // available in the current chunk. If 'bytes' is bigger than the
-  // pre-defined chunk size, returns false. reserve() adds a new chunk
+  // Buffer's chunk size, returns false. reserve() adds a new chunk
   // if it needs to. Calling reserve() before writing is optional,
   // provided that the producer won't write more than writeSize()
   // bytes. (see below)
   bool reserve(size_t bytes);
 
+  // Same as reserve() but for any size. If need be, adds a chunk of
+  // exactly 'bytes' bytes (or replaces the current chunk, if nothing
+  // was written to it yet). This is the way to hold a large object in
+  // a single contiguous region.
+  void reserveContiguous(size_t bytes);
+
   // Returns the size of the available writing area.
-  size_t writeSize() const    { return BlockSize - wpos_.off; }
+  size_t writeSize() const {
+    return chunkAt(wpos_.idx).capacity - wpos_.off;
+  }
 
   // Returns a pointer to the available writing area.
-  char* writePtr() const      { return chunks_[wpos_.idx] + wpos_.off; }
+  char* writePtr() const      { return chunkAt(wpos_.idx).ptr + wpos_.off; }
 
   // Returns true and moves the write pointer 'bytes'
   // positions. advance() is called after a producer finished writing
-  // a piece of data.
+  // a piece of data. 'bytes' may go past writeSize() only if the
+  // areas came from writeVector() (see below).
   bool advance(size_t bytes);
 
+  // Scatter-read support. Fills 'iov' with up to 'max_iov' writing
+  // areas that add up to at least 'bytes' -- the current writing area
+  // followed by as many fresh chunks as needed -- and returns the
+  // number of entries used. The producer fills the areas in order and
+  // issues a single advance() for the total written. Fresh chunks
+  // that were not written to are kept for the next writeVector()
+  // until unreserve() is called.
+  int writeVector(struct iovec* iov, int max_iov, size_t bytes);
+
+  // Releases the chunks set aside by writeVector() and not used.
+  void unreserve();
+
   // If we don't know upfront how much data needs to be written (but
   // are sure they fit in chunks), the following methods can be used.
 
@@ -113,15 +165,29 @@ public:
   // REQUIRES: can only copy from a buffer that was not yet consumed
   void copyFrom(Buffer* other);  // allocates more chunks if needed
 
+  // Links all chunks from 'other' into 'this' without copying
+  // them. The chunks become shared between the two buffers (see
+  // above). 'other' is not changed at all. Runs in time proportional
+  // to the number of chunks, not to their contents.
+  // REQUIRES: can only share from a buffer that was not yet consumed
+  void shareFrom(Buffer* other);
+
   //
   // Reading Support
   //
 
   // Returns the size of the amount of data that can be read.
-  size_t readSize() const     { return sizes_[rpos_.idx] - rpos_.off; }
+  size_t readSize() const     { return chunkAt(rpos_.idx).size - rpos_.off; }
 
   // Returns the pointer to the initial data position.
-  const char* readPtr() const { return chunks_[rpos_.idx] + rpos_.off; }
+  const char* readPtr() const { return chunkAt(rpos_.idx).ptr + rpos_.off; }
+
+  // Fills 'iov' with up to 'max_iov' entries describing the data
+  // that can be read, in order, and returns the number of entries
+  // used. Together, the entries may cover more than one chunk. This
+  // is the scatter-gather counterpart of readPtr()/readSize(), with
+  // the same concurrency guarantees (see above).
+  int readVector(struct iovec* iov, int max_iov) const;
 
   // Signal that the consumer just ingested 'bytes' bytes.
   void consume(size_t bytes);
@@ -139,12 +205,23 @@ public:
 
   enum { BlockSize = 4096 };
 
-  size_t numChunks() const    { return chunks_.size(); }
-  size_t byteCount() const;
+  size_t chunkSize() const    { return chunk_size_; }
+  size_t numChunks() const    { return num_chunks_; }
+  size_t byteCount() const    { return bytes_; }
+
+  // Returns the pool all Buffers draw their chunks from. Its counters
+  // tell how much memory Buffers are holding process-wide.
+  static ChunkPool* chunkPool();
 
 private:
-  typedef deque<char *> Chunks;
-  typedef deque<size_t> Sizes;
+  // Describes one chunk. The chunk memory is preceded by a header
+  // with its reference count, which is shared by all the Buffers
+  // holding the chunk. Each descriptor holds one reference.
+  struct Chunk {
+    char*  ptr;       // chunk memory
+    size_t size;      // # of bytes filled in this Buffer's view
+    size_t capacity;  // # of bytes in the chunk
+  };
 
   struct Position {
     Position(size_t chunk, size_t offset) : idx(chunk), off(offset) {}
@@ -153,11 +230,24 @@ private:
     size_t off;
   };
 
-  // Deque of chunks of 'BlockSize' bytes. Memory is owned by this class.
-  Chunks chunks_;
+  // Size of the chunks this Buffer allocates.
+  const size_t chunk_size_;
+
+  // Ring of chunk descriptors. Chunk number 0 (the oldest one) sits
+  // at slot 'head_'. The ring's capacity is a power of two and
+  // doubles when needed.
+  Chunk* ring_;
+  size_t ring_mask_;
+  size_t head_;
+  size_t num_chunks_;
 
-  // Deque of # of bytes the corresponding chunk has filled.
-  Sizes sizes_;
+  // # of bytes that can be read, across all chunks.
+  size_t bytes_;
+
+  // Empty chunks handed out by writeVector() beyond the current
+  // writing area. They join the ring only when advance() reaches
+  // them.
+  vector<char*> spares_;
 
   // Writing and reading pointers. A pointer is a pair <chunk num,
   // offset>.
@@ -166,12 +256,22 @@ private:
 
   // Chunk manipulation
 
+  Chunk& chunkAt(size_t idx) const { return ring_[(head_+idx) & ring_mask_]; }
+  void pushChunk(const Chunk& chunk);
   Position addChunk();
+  void startChunk(size_t capacity);
   void dropChunks(size_t n);
-  char* maybeRemoveLastChunk(); // invalidates wpos_
+  Chunk maybeRemoveLastChunk(); // invalidates wpos_; ptr is NULL if none
+  void skipConsumedChunk();
 
   bool isConsumed() const;
 
+  // Chunk memory management. A new chunk starts with one reference.
+  static Chunk newChunk(size_t capacity);
+  static void acquireChunk(char* chunk);
+  static void releaseChunk(char* chunk);
+  static bool isShared(char* chunk);
+
   // Non-copyable, non-assignable
   Buffer(const Buffer&);
   Buffer& operator=(const Buffer&);
@@ -192,6 +292,23 @@ public:
   size_t bytesRead() const { return bytes_read_; }
   size_t bytesTotal() const { return bytes_total_; }
 
+  // Moves forward until the current byte is either 'a' or 'b' and
+  // returns true, or until the end of the buffer and returns
+  // false. If 'skipped' is not NULL, the bytes moved over are
+  // appended to it. Whole chunks are scanned at a time (see
+  // ByteScan), which is much faster than calling next() per byte.
+  bool findChar(char a, char b, std::string* skipped);
+
+  // Same as findChar() but makes 'slice' refer to the bytes moved
+  // over rather than copying them, unless they span chunks. 'slice'
+  // is valid until those bytes are consumed.
+  bool sliceTo(char a, char b, BufferSlice* slice);
+
+  // Moves forward until the iterator is on the first byte of 'delim'
+  // and returns true. Returns false if the buffer ends before a full
+  // match. Matches may straddle chunks.
+  bool findString(const MemPiece& delim);
+
   bool operator==(const Iterator& other);
   bool operator!=(const Iterator& other);
 
@@ -207,6 +324,7 @@ private:
   char*            chunk_start_;   // budget_ refers to this base
 
   explicit Iterator(Buffer* buffer);
+  void skip(size_t n);  // REQUIRES: n <= budget_
   void slowNext();
   size_t getBudget() const;
 };
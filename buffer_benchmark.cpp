@@ -1,12 +1,26 @@
 #include <iostream>
+#include <pthread.h>
+#include <string>
+#include <vector>
 
 #include "buffer.hpp"
+#include "byte_scan.hpp"
+#include "callback.hpp"
+#include "chunk_pool.hpp"
+#include "thread.hpp"
 #include "timer.hpp"
 
 namespace {
 
 using base::Timer;
 using base::Buffer;
+using base::ByteScan;
+using base::Callback;
+using base::ChunkPool;
+using base::makeCallableOnce;
+using base::makeThread;
+using std::string;
+using std::vector;
 
 struct FixtureBuffer {
   Buffer buf;
@@ -51,11 +65,173 @@ void MultipleChunk() {
   std::cout << "Multiple Chunk:\t" << timer.elapsed() << std::endl;
 }
 
+// Chunk churn: each thread repeatedly grabs a few chunks and gives
+// them back, which is what a connection's buffers do per request.
+
+const int ChurnRounds = 250000;
+const int ChurnChunks = 4;
+const size_t ChurnChunkSize = Buffer::BlockSize + 8;
+
+struct HeapChunks {
+  char* alloc()           { return new char[ChurnChunkSize]; }
+  void free(char* chunk)  { delete [] chunk; }
+};
+
+struct PooledChunks {
+  PooledChunks() : pool(ChurnChunkSize, 32 << 20) {}
+  char* alloc()           { return pool.alloc(); }
+  void free(char* chunk)  { pool.free(chunk); }
+
+  ChunkPool pool;
+};
+
+template<typename Allocator>
+class Churner {
+public:
+  explicit Churner(Allocator* allocator) : allocator_(allocator) {}
+
+  void run() {
+    char* chunks[ChurnChunks];
+    for (int i = 0; i < ChurnRounds; i++) {
+      for (int j = 0; j < ChurnChunks; j++) {
+        chunks[j] = allocator_->alloc();
+        chunks[j][0] = char(j);
+      }
+      for (int j = 0; j < ChurnChunks; j++) {
+        allocator_->free(chunks[j]);
+      }
+    }
+  }
+
+private:
+  Allocator* allocator_;
+};
+
+template<typename Allocator>
+void ChunkChurn(const char* name, int num_threads) {
+  Allocator allocator;
+  vector<Churner<Allocator>*> churners;
+  vector<pthread_t> tids;
+
+  Timer timer;
+  timer.start();
+
+  for (int i = 0; i < num_threads; i++) {
+    churners.push_back(new Churner<Allocator>(&allocator));
+    Callback<void>* body =
+      makeCallableOnce(&Churner<Allocator>::run, churners.back());
+    tids.push_back(makeThread(body));
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(tids[i], NULL);
+    delete churners[i];
+  }
+
+  timer.end();
+  std::cout << name << " (" << num_threads << " threads):\t"
+            << timer.elapsed() << std::endl;
+}
+
+// Buffer churn: write and consume 8k through a Buffer, as a
+// connection does. Buffer draws its chunks from its ChunkPool.
+void BufferChurn() {
+  const string data(Buffer::BlockSize * 2, 'x');
+
+  Timer timer;
+  timer.start();
+
+  for (int i = 0; i < ChurnRounds; i++) {
+    Buffer buf;
+    buf.write(data);
+    buf.consume(data.size());
+  }
+
+  timer.end();
+  std::cout << "Buffer churn:\t" << timer.elapsed() << std::endl;
+
+  ChunkPool::Stats stats;
+  Buffer::chunkPool()->getStats(&stats);
+  std::cout << "  pool hits/misses/resident bytes: "
+            << stats.hits << "/" << stats.misses << "/"
+            << stats.resident_bytes << std::endl;
+}
+
+// Header scan: find the empty line that ends a request's headers,
+// one byte at a time with the iterator or with findString().
+
+const int ScanRounds = 20000;
+
+void fillHeaders(size_t size, Buffer* buf) {
+  string headers("GET /index.html HTTP/1.1\r\n");
+  while (headers.size() + 4 < size) {
+    headers += "X-Header: ";
+    headers += string(40, 'v');
+    headers += "\r\n";
+  }
+  headers.resize(size - 2, 'v');
+  headers += "\r\n\r\n";
+  buf->write(headers);
+}
+
+bool byteSearch(Buffer::Iterator* it) {
+  int matched = 0;
+  while (!it->eob()) {
+    const char c = it->getChar();
+    it->next();
+    if ((c == '\r' && matched % 2 == 0) || (c == '\n' && matched % 2 == 1)) {
+      if (++matched == 4) return true;
+    } else {
+      matched = (c == '\r') ? 1 : 0;
+    }
+  }
+  return false;
+}
+
+bool scanSearch(Buffer::Iterator* it) {
+  return it->findString("\r\n\r\n");
+}
+
+void HeaderScan(const char* name,
+                bool (*search)(Buffer::Iterator*),
+                size_t size) {
+  Buffer buf;
+  fillHeaders(size, &buf);
+
+  Timer timer;
+  timer.start();
+
+  size_t found = 0;
+  for (int i = 0; i < ScanRounds; i++) {
+    Buffer::Iterator it = buf.begin();
+    found += search(&it);
+  }
+
+  timer.end();
+  std::cout << name << " " << size << "B:\t" << timer.elapsed();
+  if (found != ScanRounds) {
+    std::cout << " (missed terminator!)";
+  }
+  std::cout << std::endl;
+}
+
 }  // unnamed namespace
 
 int main(int argc, char* argv[]) {
   SingleChunk();
   MultipleChunk();
 
+  ChunkChurn<HeapChunks>("new/delete churn", 1);
+  ChunkChurn<PooledChunks>("ChunkPool churn", 1);
+  ChunkChurn<HeapChunks>("new/delete churn", 4);
+  ChunkChurn<PooledChunks>("ChunkPool churn", 4);
+  BufferChurn();
+
+  std::cout << "Header scan using " << ByteScan::isa() << std::endl;
+  const size_t header_sizes[] = { 200, 1 << 10, 8 << 10 };
+  for (int i = 0; i < 3; i++) {
+    HeaderScan("byte iterator", byteSearch, header_sizes[i]);
+    HeaderScan("findString", scanSearch, header_sizes[i]);
+  }
+
   return 0;
 }
@@ -0,0 +1,112 @@
+#ifndef MCP_BASE_BUFFER_SLICE_HEADER
+#define MCP_BASE_BUFFER_SLICE_HEADER
+
+#include <string.h>  // memcmp
+
+#include <ostream>
+#include <string>
+
+#include "mem_piece.hpp"
+
+namespace base {
+
+using std::string;
+
+// A BufferSlice refers to a run of bytes sitting in a Buffer without
+// copying them. Parsers use slices for the fields they extract, so
+// that handling a request needs no allocations.
+//
+// A slice is only a pointer and a length, and is valid for as long
+// as the bytes it refers to are not consumed from the Buffer. A field
+// that crosses a chunk boundary isn't contiguous, though. In that
+// (rare) case its bytes are gathered into storage the slice itself
+// owns, which is reused from one field to the next.
+//
+// A slice can also be assigned ordinary strings, which it then
+// copies into its own storage. This way the same type serves the
+// code that builds requests.
+//
+// Usage:
+//
+//   BufferSlice field;
+//   Buffer::Iterator it = buf.begin();
+//   if (it.sliceTo(' ', ' ', &field) && (field == "GET")) {
+//     ...
+//   }
+//   buf.consume(it.bytesRead());  // 'field' is invalid from now on
+//
+
+class BufferSlice {
+public:
+  BufferSlice() : ptr_(NULL), len_(0) {}
+
+  BufferSlice(const BufferSlice& other) : ptr_(NULL), len_(0) {
+    *this = other;
+  }
+
+  BufferSlice& operator=(const BufferSlice& other) {
+    if (other.ptr_ == other.storage_.data()) {
+      assign(MemPiece(other.ptr_, other.len_));
+    } else {
+      ptr_ = other.ptr_;
+      len_ = other.len_;
+    }
+    return *this;
+  }
+
+  BufferSlice& operator=(const MemPiece& data) {
+    assign(data);
+    return *this;
+  }
+
+  // Makes the slice refer to 'len' bytes starting at 'ptr'.
+  void set(const char* ptr, size_t len) {
+    ptr_ = ptr;
+    len_ = len;
+  }
+
+  // Makes the slice hold a copy of 'data'.
+  void assign(const MemPiece& data) {
+    storage_.assign(data.ptr(), data.len());
+    set(storage_.data(), storage_.size());
+  }
+
+  // Returns the slice's own storage, emptied, so that a field can be
+  // gathered into it. Call set() on the result when done.
+  string* storage() {
+    storage_.clear();
+    return &storage_;
+  }
+
+  void clear() { set(NULL, 0); }
+
+  bool operator==(const MemPiece& other) const {
+    return (len_ == other.len()) &&
+           ((len_ == 0) || (memcmp(ptr_, other.ptr(), len_) == 0));
+  }
+
+  bool operator!=(const MemPiece& other) const {
+    return !(*this == other);
+  }
+
+  string toString() const { return string(ptr_, len_); }
+
+  // accessors
+
+  const char* data() const  { return ptr_; }
+  size_t size() const       { return len_; }
+  bool empty() const        { return len_ == 0; }
+
+private:
+  const char* ptr_;
+  size_t      len_;
+  string      storage_;  // used for copies only
+};
+
+inline std::ostream& operator<<(std::ostream& os, const BufferSlice& slice) {
+  return os.write(slice.data(), slice.size());
+}
+
+}  // namespace base
+
+#endif  // MCP_BASE_BUFFER_SLICE_HEADER
@@ -1,3 +1,4 @@
+#include <string.h>  // memcpy, memset
 #include <string>
 
 #include "buffer.hpp"
@@ -193,6 +194,35 @@ TEST(MultiChunk, ReadWriteHoles) {
   EXPECT_EQ(buf.readSize(), 0);
 }
 
+TEST(MultiChunk, ManyChunksWrapAround) {
+  Buffer buf;
+  const string block(Buffer::BlockSize, 'X');
+
+  // keep a window of chunks sliding through the buffer, so that the
+  // chunks go around (and outgrow) the initial ring
+  size_t written = 0;
+  size_t read = 0;
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 10 * (round+1); i++) {
+      buf.write(block);
+      written += block.size();
+    }
+    for (int i = 0; i < 5; i++) {
+      buf.consume(buf.readSize());
+      read += Buffer::BlockSize;
+      EXPECT_EQ(buf.byteCount(), written - read);
+    }
+  }
+  EXPECT_EQ(buf.numChunks(), (written - read) / Buffer::BlockSize + 1);
+
+  while (buf.readSize() > 0) {
+    EXPECT_EQ(string(buf.readPtr(), buf.readSize()), block);
+    buf.consume(buf.readSize());
+  }
+  EXPECT_EQ(buf.byteCount(), 0);
+  EXPECT_EQ(buf.numChunks(), 1);
+}
+
 TEST(MultiChunk, IterateCompactChunks) {
   Buffer buf;
   size_t size = Buffer::BlockSize / 2 - 10 /* leave chunk tail empty */;
@@ -385,6 +415,323 @@ TEST(CopyChunk, FillChunkOnCopy) {
   EXPECT_EQ(buf2.byteCount(), 1);
 }
 
+TEST(ShareChunk, ToEmpty) {
+  Buffer buf1, buf2;
+
+  buf2.write("X");
+  buf1.shareFrom(&buf2);
+
+  string read_string(buf1.readPtr(), buf1.readSize());
+  EXPECT_EQ(read_string, "X");
+  EXPECT_TRUE(buf1.readPtr() == buf2.readPtr());  // same memory
+  EXPECT_EQ(buf1.numChunks(), 2);
+  EXPECT_EQ(buf2.numChunks(), 1);
+  EXPECT_EQ(buf1.byteCount(), 1);
+  EXPECT_EQ(buf2.byteCount(), 1);
+}
+
+TEST(ShareChunk, AfterWrite) {
+  Buffer buf1, buf2;
+
+  buf2.write(string(Buffer::BlockSize, 'Y').c_str());
+  buf2.write("Z");
+  buf1.write("X");
+  buf1.shareFrom(&buf2);
+  buf1.write("W");
+
+  string read_string;
+  for (Buffer::Iterator it = buf1.begin(); it != buf1.end(); it.next()) {
+    read_string.push_back(it.getChar());
+  }
+  EXPECT_EQ(read_string, "X" + string(Buffer::BlockSize, 'Y') + "ZW");
+  EXPECT_EQ(buf1.numChunks(), 4);
+  EXPECT_EQ(buf2.byteCount(), Buffer::BlockSize + 1);
+
+  // writing to 'buf1' did not touch the shared chunks
+  string other_string(buf2.readPtr(), buf2.readSize());
+  EXPECT_EQ(other_string, string(Buffer::BlockSize, 'Y'));
+}
+
+TEST(ShareChunk, ToReadBuffer) {
+  Buffer buf1, buf2;
+
+  buf1.write("X");
+  buf1.consume(1);
+
+  buf2.write("Y");
+  buf1.shareFrom(&buf2);
+  string read_string(buf1.readPtr(), buf1.readSize());
+  EXPECT_EQ(read_string, "Y");
+  EXPECT_EQ(buf1.numChunks(), 2);
+  EXPECT_EQ(buf1.byteCount(), 1);
+}
+
+TEST(ShareChunk, OutlivesSource) {
+  Buffer buf1;
+  Buffer* buf2 = new Buffer;
+
+  buf2->write("Y");
+  buf1.shareFrom(buf2);
+  buf1.shareFrom(buf2);
+  delete buf2;
+
+  string read_string(buf1.readPtr(), buf1.readSize());
+  EXPECT_EQ(read_string, "Y");
+  buf1.consume(1);
+  EXPECT_EQ(buf1.byteCount(), 1);
+  buf1.consume(1);
+  EXPECT_EQ(buf1.byteCount(), 0);
+  EXPECT_EQ(buf1.numChunks(), 1);
+}
+
+TEST(ShareChunk, AppendShared) {
+  Buffer cache, buf1, buf2, dest1, dest2;
+
+  cache.write("0123456789");
+  buf1.shareFrom(&cache);
+  buf2.shareFrom(&cache);
+  dest1.appendFrom(&buf1);
+  dest2.appendFrom(&buf2);
+  dest1.write("XXXX");
+  dest2.write("YYYY");
+
+  string read_string;
+  for (Buffer::Iterator it = dest1.begin(); it != dest1.end(); it.next()) {
+    read_string.push_back(it.getChar());
+  }
+  EXPECT_EQ(read_string, "0123456789XXXX");
+  read_string.clear();
+  for (Buffer::Iterator it = dest2.begin(); it != dest2.end(); it.next()) {
+    read_string.push_back(it.getChar());
+  }
+  EXPECT_EQ(read_string, "0123456789YYYY");
+
+  // the source's chunk was not written to
+  EXPECT_EQ(string(cache.readPtr(), cache.readSize()), "0123456789");
+  EXPECT_EQ(cache.byteCount(), 10);
+}
+
+TEST(ReadVector, SpansChunks) {
+  Buffer buf;
+  struct iovec iov[4];
+
+  EXPECT_EQ(buf.readVector(iov, 4), 0);
+
+  buf.write(string(Buffer::BlockSize, 'X').c_str());
+  buf.write("YZ");
+  buf.consume(10);
+  EXPECT_EQ(buf.readVector(iov, 4), 2);
+  EXPECT_TRUE(iov[0].iov_base == buf.readPtr());
+  EXPECT_EQ(iov[0].iov_len, Buffer::BlockSize - 10);
+  EXPECT_EQ(string(static_cast<char*>(iov[1].iov_base), iov[1].iov_len), "YZ");
+
+  // asking for fewer entries than there are chunks
+  EXPECT_EQ(buf.readVector(iov, 1), 1);
+  EXPECT_EQ(iov[0].iov_len, Buffer::BlockSize - 10);
+
+  // consuming across the chunk boundary
+  buf.consume(Buffer::BlockSize - 9);
+  EXPECT_EQ(buf.readVector(iov, 4), 1);
+  EXPECT_EQ(string(static_cast<char*>(iov[0].iov_base), iov[0].iov_len), "Z");
+}
+
+TEST(ReadVector, SkipsHoles) {
+  Buffer buf;
+  struct iovec iov[4];
+
+  buf.write("X");
+  EXPECT_TRUE(buf.reserve(Buffer::BlockSize)); // overallocated
+  buf.write("Y");
+  EXPECT_EQ(buf.readVector(iov, 4), 2);
+  EXPECT_EQ(iov[0].iov_len, 1);
+  EXPECT_EQ(iov[1].iov_len, 1);
+}
+
+TEST(WriteVector, SpillsIntoSpares) {
+  Buffer buf;
+  struct iovec iov[4];
+
+  buf.write("X");
+  EXPECT_EQ(buf.writeVector(iov, 4, 2*Buffer::BlockSize), 3);
+  EXPECT_TRUE(iov[0].iov_base == buf.writePtr());
+  EXPECT_EQ(iov[0].iov_len, Buffer::BlockSize - 1);
+  EXPECT_EQ(iov[1].iov_len, Buffer::BlockSize);
+  EXPECT_EQ(buf.numChunks(), 1);
+
+  // write across the first two areas only
+  memset(iov[0].iov_base, 'Y', iov[0].iov_len);
+  memset(iov[1].iov_base, 'Z', 10);
+  EXPECT_TRUE(buf.advance(Buffer::BlockSize + 9));
+  EXPECT_EQ(buf.numChunks(), 2);
+  EXPECT_EQ(buf.byteCount(), Buffer::BlockSize + 10);
+  EXPECT_EQ(buf.writeSize(), Buffer::BlockSize - 10);
+
+  string read_string;
+  for (Buffer::Iterator it = buf.begin(); it != buf.end(); it.next()) {
+    read_string.push_back(it.getChar());
+  }
+  EXPECT_EQ(read_string, "X" + string(Buffer::BlockSize-1, 'Y') +
+                         string(10, 'Z'));
+
+  // can't advance past what was set aside
+  EXPECT_EQ(buf.writeVector(iov, 4, 1), 1);
+  buf.unreserve();
+  EXPECT_FALSE(buf.advance(Buffer::BlockSize));
+}
+
+TEST(WriteVector, AfterConsumingFullChunk) {
+  Buffer buf;
+  struct iovec iov[4];
+
+  buf.write(string(Buffer::BlockSize - 1, 'X').c_str());
+  buf.reserve(1);
+  buf.advance(1);
+  buf.consume(Buffer::BlockSize);
+  EXPECT_EQ(buf.writeSize(), 0);
+
+  // the full chunk is dropped; reading starts on the new one
+  EXPECT_EQ(buf.writeVector(iov, 4, 10), 1);
+  memcpy(iov[0].iov_base, "Y", 1);
+  EXPECT_TRUE(buf.advance(1));
+  EXPECT_EQ(buf.numChunks(), 1);
+  EXPECT_EQ(string(buf.readPtr(), buf.readSize()), "Y");
+}
+
+TEST(LargeChunks, CustomSize) {
+  const size_t chunk_size = 64 << 10;
+  Buffer buf(chunk_size);
+  EXPECT_EQ(buf.chunkSize(), chunk_size);
+  EXPECT_EQ(buf.writeSize(), chunk_size);
+  EXPECT_TRUE(buf.reserve(chunk_size));
+  EXPECT_FALSE(buf.reserve(chunk_size + 1));
+
+  buf.write(string(chunk_size + 10, 'X'));
+  EXPECT_EQ(buf.numChunks(), 2);
+  EXPECT_EQ(buf.readSize(), chunk_size);
+  buf.consume(chunk_size);
+  EXPECT_EQ(buf.readSize(), 10);
+}
+
+TEST(LargeChunks, ReserveContiguous) {
+  const size_t region = 1 << 20;
+
+  // an untouched chunk is replaced by the large one
+  Buffer buf;
+  buf.reserveContiguous(region);
+  EXPECT_EQ(buf.numChunks(), 1);
+  EXPECT_EQ(buf.writeSize(), region);
+
+  memset(buf.writePtr(), 'L', region);
+  EXPECT_TRUE(buf.advance(region));
+  EXPECT_EQ(buf.readSize(), region);
+
+  // writing goes on in chunks of the Buffer's size
+  buf.write("abc");
+  EXPECT_EQ(buf.numChunks(), 2);
+  EXPECT_EQ(buf.writeSize(), Buffer::BlockSize - 3);
+  EXPECT_EQ(buf.byteCount(), region + 3);
+}
+
+TEST(LargeChunks, MixedSizes) {
+  const size_t big_size = 3 * Buffer::BlockSize + 100;
+  Buffer big(big_size);
+  big.write(string(big_size, 'B'));
+
+  // the small buffer ends up with chunks of both sizes
+  Buffer shared;
+  shared.write("head");
+  shared.shareFrom(&big);
+  shared.write("tail");
+  EXPECT_EQ(shared.byteCount(), big_size + 8);
+  size_t count = 0;
+  for (Buffer::Iterator it = shared.begin(); !it.eob(); it.next()) {
+    count++;
+  }
+  EXPECT_EQ(count, big_size + 8);
+
+  // a copy is packed into chunks of the copier's size
+  Buffer copy;
+  copy.copyFrom(&big);
+  EXPECT_EQ(copy.byteCount(), big_size);
+  EXPECT_EQ(copy.numChunks(), 4);
+  EXPECT_EQ(copy.readSize(), Buffer::BlockSize);
+
+  // appending moves the big chunk as it is
+  Buffer appended;
+  appended.write("head");
+  appended.appendFrom(&big);
+  EXPECT_EQ(appended.byteCount(), big_size + 4);
+  appended.consume(4);
+  EXPECT_EQ(appended.readSize(), big_size);
+  EXPECT_EQ(big.byteCount(), 0);
+}
+
+TEST(Find, CharInLaterChunk) {
+  Buffer buf;
+  buf.write(string(Buffer::BlockSize + 100, 'x'));
+  buf.write("y\r");
+
+  Buffer::Iterator it = buf.begin();
+  string skipped;
+  EXPECT_TRUE(it.findChar('\r', 'y', &skipped));
+  EXPECT_EQ(it.getChar(), 'y');
+  EXPECT_EQ(it.bytesRead(), Buffer::BlockSize + 100);
+  EXPECT_EQ(skipped, string(Buffer::BlockSize + 100, 'x'));
+
+  // not found: stops at the end of the buffer
+  it.next();
+  it.next();
+  EXPECT_FALSE(it.findChar('z', 'z', NULL));
+  EXPECT_TRUE(it.eob());
+}
+
+TEST(Find, CharAcrossHoles) {
+  Buffer buf;
+  buf.write("abc");
+  EXPECT_TRUE(buf.reserve(Buffer::BlockSize)); // leaves a hole
+  buf.write("def");
+
+  Buffer::Iterator it = buf.begin();
+  string skipped;
+  EXPECT_TRUE(it.findChar('e', 'e', &skipped));
+  EXPECT_EQ(skipped, "abcd");
+  EXPECT_EQ(it.bytesRead(), 4);
+}
+
+TEST(Find, StringStraddlingChunks) {
+  // place the delimiter at every offset around a chunk boundary
+  for (int split = 1; split < 4; split++) {
+    Buffer buf;
+    buf.write(string(Buffer::BlockSize - split, 'x'));
+    buf.write("\r\n\r\nrest");
+
+    Buffer::Iterator it = buf.begin();
+    EXPECT_TRUE(it.findString("\r\n\r\n"));
+    EXPECT_EQ(it.bytesRead(), size_t(Buffer::BlockSize - split));
+  }
+}
+
+TEST(Find, StringPartialMatches) {
+  Buffer buf;
+  buf.write("a\r\nb\r\n\r");
+
+  Buffer::Iterator it = buf.begin();
+  EXPECT_FALSE(it.findString("\r\n\r\n"));
+
+  buf.write("\n");
+  Buffer::Iterator again = buf.begin();
+  EXPECT_TRUE(again.findString("\r\n\r\n"));
+  EXPECT_EQ(again.bytesRead(), 4);
+}
+
+TEST(FailureCases, CantShareConsumed) {
+  Buffer buf1, buf2;
+
+  buf2.write("XY");
+  buf2.consume(1);
+  EXPECT_FATAL(buf1.shareFrom(&buf2));
+}
+
 TEST(FailureCases, CantReserve) {
   Buffer buf;
   EXPECT_FALSE(buf.reserve(Buffer::BlockSize+1));
@@ -0,0 +1,101 @@
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
+
+#include "byte_scan.hpp"
+
+namespace base {
+
+typedef const char* (*FindFunction)(const char*, size_t, char, char);
+
+static pthread_once_t once_control = PTHREAD_ONCE_INIT;
+static FindFunction find_function = ByteScan::findScalar;
+static const char* find_isa = "scalar";
+
+static void selectKernel() {
+#if defined(HAVE_AVX2_KERNEL)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    find_function = ByteScan::findAVX2;
+    find_isa = "avx2";
+    return;
+  }
+#endif
+#if defined(__SSE2__)
+  find_function = ByteScan::findSSE2;
+  find_isa = "sse2";
+#endif
+}
+
+const char* ByteScan::find(const char* ptr, size_t len, char a, char b) {
+  pthread_once(&once_control, selectKernel);
+  return find_function(ptr, len, a, b);
+}
+
+const char* ByteScan::isa() {
+  pthread_once(&once_control, selectKernel);
+  return find_isa;
+}
+
+const char* ByteScan::findScalar(const char* ptr, size_t len,
+                                 char a, char b) {
+  for (const char* end = ptr + len; ptr < end; ptr++) {
+    if ((*ptr == a) || (*ptr == b)) {
+      return ptr;
+    }
+  }
+  return NULL;
+}
+
+const char* ByteScan::findSSE2(const char* ptr, size_t len, char a, char b) {
+#if defined(__SSE2__)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  for (; len >= 16; ptr += 16, len -= 16) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+                                                    _mm_cmpeq_epi8(x, vb)));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+  }
+#endif
+  // the tail (or everything, without SSE2)
+  return findScalar(ptr, len, a, b);
+}
+
+#if defined(HAVE_AVX2_KERNEL)
+
+__attribute__((target("avx2")))
+const char* ByteScan::findAVX2(const char* ptr, size_t len, char a, char b) {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  for (; len >= 32; ptr += 32, len -= 32) {
+    const __m256i x =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const unsigned mask =
+      _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va),
+                                           _mm256_cmpeq_epi8(x, vb)));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+  }
+  return findSSE2(ptr, len, a, b);
+}
+
+#else
+
+const char* ByteScan::findAVX2(const char* ptr, size_t len, char a, char b) {
+  return findSSE2(ptr, len, a, b);
+}
+
+#endif  // HAVE_AVX2_KERNEL
+
+}  // namespace base
@@ -0,0 +1,49 @@
+#ifndef MCP_BASE_BYTE_SCAN_HEADER
+#define MCP_BASE_BYTE_SCAN_HEADER
+
+#include <stddef.h>
+
+namespace base {
+
+// ByteScan looks for delimiter bytes in a contiguous piece of memory
+// many bytes at a time. It uses the widest vector instructions the
+// CPU supports (AVX2 or SSE2 on x86), decided once at run time, and
+// falls back to a plain loop elsewhere.
+//
+// Usage:
+//
+//   // find the end of the current token
+//   const char* p = ByteScan::find(data, len, ' ', '\r');
+//   if (p == NULL) { ... neither byte is in 'data' ... }
+//
+
+class ByteScan {
+public:
+  // Returns a pointer to the first byte in [ptr, ptr+len) that is
+  // either 'a' or 'b', or NULL if there is none. Pass the same byte
+  // twice to look for a single one.
+  static const char* find(const char* ptr, size_t len, char a, char b);
+
+  // Returns the name of the instruction set find() uses.
+  static const char* isa();
+
+  // Same as find() but forcing a given instruction set. Meant for
+  // testing and benchmarking. findAVX2() may only be called if
+  // isa() says AVX2 is available; findSSE2() falls back to the
+  // scalar version where SSE2 isn't.
+  static const char* findScalar(const char* ptr, size_t len, char a, char b);
+  static const char* findSSE2(const char* ptr, size_t len, char a, char b);
+  static const char* findAVX2(const char* ptr, size_t len, char a, char b);
+
+private:
+  ByteScan() {}
+  ~ByteScan() {}
+
+  // Non-copyable, non-assignable
+  ByteScan(const ByteScan&);
+  ByteScan& operator=(const ByteScan&);
+};
+
+}  // namespace base
+
+#endif  // MCP_BASE_BYTE_SCAN_HEADER
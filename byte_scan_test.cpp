@@ -0,0 +1,65 @@
+#include <string.h>  // memset
+
+#include "byte_scan.hpp"
+#include "test_unit.hpp"
+
+namespace {
+
+using base::ByteScan;
+
+typedef const char* (*FindFunction)(const char*, size_t, char, char);
+
+// Checks 'find' against the scalar version for every delimiter
+// position and every length up to 'max_len', starting at every
+// misalignment within a vector.
+bool agreesWithScalar(FindFunction find) {
+  const size_t max_len = 100;
+  char data[max_len + 64];
+  for (size_t start = 0; start < 32; start++) {
+    for (size_t len = 0; len <= max_len; len++) {
+      for (size_t pos = 0; pos <= len; pos++) {
+        memset(data, 'x', sizeof(data));
+        if (pos < len) {
+          data[start + pos] = (pos % 2) ? '\r' : ' ';
+        }
+        // a delimiter just past the end must not be found
+        data[start + len] = '\r';
+
+        const char* p = data + start;
+        const char* expected = ByteScan::findScalar(p, len, ' ', '\r');
+        if (find(p, len, ' ', '\r') != expected) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+TEST(Scalar, FirstOfTwo) {
+  const char data[] = "GET /x HTTP/1.1\r\n";
+  EXPECT_TRUE(ByteScan::findScalar(data, 17, ' ', '\r') == data + 3);
+  EXPECT_TRUE(ByteScan::findScalar(data, 17, '\r', '\r') == data + 15);
+  EXPECT_TRUE(ByteScan::findScalar(data, 17, 'z', 'z') == NULL);
+  EXPECT_TRUE(ByteScan::findScalar(data, 0, 'G', 'G') == NULL);
+}
+
+TEST(Vector, SSE2) {
+  EXPECT_TRUE(agreesWithScalar(ByteScan::findSSE2));
+}
+
+TEST(Vector, AVX2) {
+  if (strcmp(ByteScan::isa(), "avx2") == 0) {
+    EXPECT_TRUE(agreesWithScalar(ByteScan::findAVX2));
+  }
+}
+
+TEST(Vector, Selected) {
+  EXPECT_TRUE(agreesWithScalar(ByteScan::find));
+}
+
+} // unnamed namespace
+
+int main(int argc, char *argv[]) {
+  return RUN_TESTS(argc, argv);
+}
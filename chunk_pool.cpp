@@ -0,0 +1,193 @@
+#include "chunk_pool.hpp"
+#include "logging.hpp"
+
+namespace base {
+
+ChunkPool::LocalCache::LocalCache()
+  : pool(NULL),
+    head(NULL),
+    count(0),
+    hits(0),
+    misses(0),
+    next(NULL),
+    prev(NULL) {
+}
+
+ChunkPool::LocalCache::~LocalCache() {
+  // Issued at thread exit. Hands the free chunks back to the pool.
+  if (pool != NULL) {
+    pool->retire(this);
+  }
+}
+
+ChunkPool::ChunkPool(size_t chunk_size, size_t max_depot_bytes, int batch_size)
+  : chunk_size_(chunk_size),
+    max_depot_bytes_(max_depot_bytes),
+    batch_size_(batch_size > 0 ? batch_size : 1),
+    depot_(NULL),
+    depot_bytes_(0),
+    caches_(NULL),
+    retired_hits_(0),
+    retired_misses_(0),
+    resident_bytes_(0) {
+  if (chunk_size_ < sizeof(FreeChunk)) {
+    LOG(LogMessage::FATAL) << "chunk size too small: " << chunk_size_;
+  }
+}
+
+ChunkPool::~ChunkPool() {
+  // Caches of threads that are still alive (usually just the one
+  // destroying the pool) are emptied and detached, so that their
+  // thread's exit won't touch this pool.
+  while (caches_ != NULL) {
+    LocalCache* cache = caches_;
+    caches_ = cache->next;
+    while (cache->head != NULL) {
+      FreeChunk* chunk = cache->head;
+      cache->head = chunk->next;
+      delete [] reinterpret_cast<char*>(chunk);
+    }
+    cache->count = 0;
+    cache->pool = NULL;
+  }
+
+  while (depot_ != NULL) {
+    FreeChunk* batch = depot_;
+    depot_ = batch->next_batch;
+    releaseBatch(batch);
+  }
+}
+
+char* ChunkPool::alloc() {
+  LocalCache* cache = localCache();
+  if (cache->head == NULL) {
+    refill(cache);
+  }
+
+  // fast path: there's a free chunk in this thread's list
+  if (cache->head != NULL) {
+    FreeChunk* chunk = cache->head;
+    cache->head = chunk->next;
+    cache->count--;
+    cache->hits++;
+    return reinterpret_cast<char*>(chunk);
+  }
+
+  cache->misses++;
+  __sync_fetch_and_add(&resident_bytes_, chunk_size_);
+  return new char[chunk_size_];
+}
+
+void ChunkPool::free(char* chunk) {
+  LocalCache* cache = localCache();
+  FreeChunk* free_chunk = reinterpret_cast<FreeChunk*>(chunk);
+  free_chunk->next = cache->head;
+  cache->head = free_chunk;
+  cache->count++;
+
+  // Keep one batch around for the next allocations and send the
+  // surplus to the depot.
+  if (cache->count >= 2 * batch_size_) {
+    flush(cache, batch_size_);
+  }
+}
+
+void ChunkPool::getStats(Stats* stats) const {
+  ScopedLock l(&m_);
+  stats->hits = retired_hits_;
+  stats->misses = retired_misses_;
+  for (LocalCache* cache = caches_; cache != NULL; cache = cache->next) {
+    stats->hits += cache->hits;
+    stats->misses += cache->misses;
+  }
+  stats->resident_bytes = resident_bytes_;
+  stats->depot_bytes = depot_bytes_;
+}
+
+ChunkPool::LocalCache* ChunkPool::localCache() {
+  LocalCache* cache = local_.getAddr();
+  if (cache->pool == NULL) {
+    // First use of the pool by this thread.
+    ScopedLock l(&m_);
+    cache->pool = this;
+    cache->next = caches_;
+    if (caches_ != NULL) {
+      caches_->prev = cache;
+    }
+    caches_ = cache;
+  }
+  return cache;
+}
+
+void ChunkPool::refill(LocalCache* cache) {
+  ScopedLock l(&m_);
+  if (depot_ == NULL) {
+    return;
+  }
+
+  FreeChunk* batch = depot_;
+  depot_ = batch->next_batch;
+  depot_bytes_ -= batch_size_ * chunk_size_;
+  cache->head = batch;
+  cache->count = batch_size_;
+}
+
+void ChunkPool::flush(LocalCache* cache, int num_chunks) {
+  // Detach 'num_chunks' chunks from the front of the cache's list.
+  FreeChunk* batch = cache->head;
+  FreeChunk* last = batch;
+  for (int i = 1; i < num_chunks; i++) {
+    last = last->next;
+  }
+  cache->head = last->next;
+  cache->count -= num_chunks;
+  last->next = NULL;
+
+  // Only full batches go to the depot, so that refill() always hands
+  // out 'batch_size_' chunks.
+  const size_t batch_bytes = batch_size_ * chunk_size_;
+  if (num_chunks == batch_size_) {
+    ScopedLock l(&m_);
+    if (depot_bytes_ + batch_bytes <= max_depot_bytes_) {
+      batch->next_batch = depot_;
+      depot_ = batch;
+      depot_bytes_ += batch_bytes;
+      return;
+    }
+  }
+
+  releaseBatch(batch);
+}
+
+void ChunkPool::retire(LocalCache* cache) {
+  while (cache->count >= batch_size_) {
+    flush(cache, batch_size_);
+  }
+  if (cache->count > 0) {
+    flush(cache, cache->count);
+  }
+
+  ScopedLock l(&m_);
+  retired_hits_ += cache->hits;
+  retired_misses_ += cache->misses;
+  if (cache->prev != NULL) {
+    cache->prev->next = cache->next;
+  } else {
+    caches_ = cache->next;
+  }
+  if (cache->next != NULL) {
+    cache->next->prev = cache->prev;
+  }
+  cache->pool = NULL;
+}
+
+void ChunkPool::releaseBatch(FreeChunk* batch) {
+  while (batch != NULL) {
+    FreeChunk* chunk = batch;
+    batch = batch->next;
+    delete [] reinterpret_cast<char*>(chunk);
+    __sync_fetch_and_sub(&resident_bytes_, chunk_size_);
+  }
+}
+
+}  // namespace base
@@ -0,0 +1,130 @@
+#ifndef MCP_BASE_CHUNK_POOL_HEADER
+#define MCP_BASE_CHUNK_POOL_HEADER
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "lock.hpp"
+#include "thread_local.hpp"
+
+namespace base {
+
+// A ChunkPool hands out fixed-size pieces of memory ("chunks") and
+// recycles them, so that code that allocates and frees chunks at a
+// high rate (e.g., Buffer) does not go through the global allocator
+// every time.
+//
+// Each thread keeps its own free list, which requires no
+// synchronization. When a thread's list grows past two batches, one
+// batch of chunks moves to a shared depot; when a thread's list runs
+// dry, it grabs a whole batch from the depot. This way a chunk that
+// is allocated in one thread and freed in another (a common pattern
+// for socket buffers) finds its way back in a few lock acquisitions
+// per batch, rather than one per chunk.
+//
+// The depot has a high-water cap. Batches that would take it over
+// the cap are returned to the heap.
+//
+// Thread safety:
+//
+//   alloc() and free() can be called from any thread, and a chunk
+//   can be freed by a thread other than the one that allocated it.
+//   getStats() may be called concurrently with them; the hits and
+//   misses it reports may be slightly stale.
+//
+//   A ChunkPool must outlive the threads that use it, except for the
+//   thread that destroys it.
+//
+// Usage:
+//
+//   ChunkPool pool(4096, 1<<20 /* 1MB depot */);
+//   char* chunk = pool.alloc();
+//   ... use chunk's 4096 bytes ...
+//   pool.free(chunk);
+//
+
+class ChunkPool {
+public:
+  struct Stats {
+    uint64_t hits;            // allocations served from a free list
+    uint64_t misses;          // allocations that went to the heap
+    uint64_t resident_bytes;  // obtained from the heap, in use or cached
+    uint64_t depot_bytes;     // cached in the shared depot
+  };
+
+  // Builds a pool of 'chunk_size' chunks whose depot holds at most
+  // 'max_depot_bytes'. Chunks move between threads and the depot in
+  // groups of 'batch_size'.
+  ChunkPool(size_t chunk_size, size_t max_depot_bytes, int batch_size = 32);
+
+  // Returns all cached chunks to the heap.
+  // REQUIRES: no other thread is using the pool and all the chunks
+  // handed out were freed.
+  ~ChunkPool();
+
+  // Returns a chunk of chunkSize() bytes.
+  char* alloc();
+
+  // Takes back 'chunk', which must have been obtained from alloc()
+  // on this same pool.
+  void free(char* chunk);
+
+  // Fills 'stats' with the counters accumulated so far.
+  void getStats(Stats* stats) const;
+
+  // accessors
+
+  size_t chunkSize() const  { return chunk_size_; }
+
+private:
+  // A free chunk's own memory is used to link it to the others.
+  struct FreeChunk {
+    FreeChunk* next;        // next chunk in the same list
+    FreeChunk* next_batch;  // next batch in the depot (batch heads only)
+  };
+
+  struct LocalCache {
+    ChunkPool*  pool;       // not owned here; NULL until first use
+    FreeChunk*  head;
+    int         count;
+    uint64_t    hits;
+    uint64_t    misses;
+    LocalCache* next;       // list of caches of live threads
+    LocalCache* prev;
+
+    LocalCache();
+    ~LocalCache();
+  };
+
+  const size_t            chunk_size_;
+  const size_t            max_depot_bytes_;
+  const int               batch_size_;
+
+  ThreadLocal<LocalCache> local_;
+
+  // All depot state, including the list of registered caches, is
+  // protected by m_.
+  mutable Mutex           m_;
+  FreeChunk*              depot_;          // a stack of batches
+  size_t                  depot_bytes_;
+  LocalCache*             caches_;
+  uint64_t                retired_hits_;   // from caches of exited threads
+  uint64_t                retired_misses_;
+
+  // Changed only on the slow paths, with atomic instructions.
+  uint64_t                resident_bytes_;
+
+  LocalCache* localCache();
+  void refill(LocalCache* cache);
+  void flush(LocalCache* cache, int num_chunks);
+  void retire(LocalCache* cache);
+  void releaseBatch(FreeChunk* batch);
+
+  // Non-copyable, non-assignable
+  ChunkPool(const ChunkPool&);
+  ChunkPool& operator=(const ChunkPool&);
+};
+
+}  // namespace base
+
+#endif  // MCP_BASE_CHUNK_POOL_HEADER
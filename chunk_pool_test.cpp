@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <vector>
+
+#include "callback.hpp"
+#include "chunk_pool.hpp"
+#include "thread.hpp"
+#include "test_unit.hpp"
+
+namespace {
+
+using base::Callback;
+using base::ChunkPool;
+using base::makeCallableOnce;
+using base::makeThread;
+using std::vector;
+
+const size_t ChunkSize = 4096;
+
+TEST(SingleThread, Recycle) {
+  ChunkPool pool(ChunkSize, 1<<20, 4);
+  ChunkPool::Stats stats;
+
+  char* chunk = pool.alloc();
+  pool.free(chunk);
+  char* again = pool.alloc();
+  EXPECT_TRUE(chunk == again);
+  pool.free(again);
+
+  pool.getStats(&stats);
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.resident_bytes, ChunkSize);
+  EXPECT_EQ(stats.depot_bytes, 0);
+}
+
+TEST(SingleThread, SurplusGoesToDepot) {
+  ChunkPool pool(ChunkSize, 1<<20, 4);
+  ChunkPool::Stats stats;
+
+  // The 8th free crosses the two-batch mark and sends one batch over.
+  vector<char*> chunks;
+  for (int i = 0; i < 8; i++) {
+    chunks.push_back(pool.alloc());
+  }
+  for (int i = 0; i < 8; i++) {
+    pool.free(chunks[i]);
+  }
+  pool.getStats(&stats);
+  EXPECT_EQ(stats.misses, 8);
+  EXPECT_EQ(stats.resident_bytes, 8*ChunkSize);
+  EXPECT_EQ(stats.depot_bytes, 4*ChunkSize);
+}
+
+TEST(SingleThread, HighWaterCap) {
+  // The depot fits a single batch; the surplus goes back to the heap.
+  ChunkPool pool(ChunkSize, 4*ChunkSize, 4);
+  ChunkPool::Stats stats;
+
+  vector<char*> chunks;
+  for (int i = 0; i < 16; i++) {
+    chunks.push_back(pool.alloc());
+  }
+  for (int i = 0; i < 16; i++) {
+    pool.free(chunks[i]);
+  }
+  pool.getStats(&stats);
+  EXPECT_EQ(stats.depot_bytes, 4*ChunkSize);
+  EXPECT_EQ(stats.resident_bytes, 8*ChunkSize);
+}
+
+// Holds chunks so that they can be allocated in one thread and freed
+// in another.
+class ChunkHolder {
+public:
+  explicit ChunkHolder(ChunkPool* pool) : pool_(pool) {}
+
+  void allocChunks(int num) {
+    for (int i = 0; i < num; i++) {
+      char* chunk = pool_->alloc();
+      chunk[0] = 'x';
+      chunks_.push_back(chunk);
+    }
+  }
+
+  void freeChunks() {
+    for (size_t i = 0; i < chunks_.size(); i++) {
+      pool_->free(chunks_[i]);
+    }
+    chunks_.clear();
+  }
+
+private:
+  ChunkPool*    pool_;
+  vector<char*> chunks_;
+};
+
+TEST(MultiThread, CrossThreadFree) {
+  ChunkPool pool(ChunkSize, 1<<20, 4);
+  ChunkPool::Stats stats;
+  ChunkHolder holder(&pool);
+
+  Callback<void>* body =
+    makeCallableOnce(&ChunkHolder::allocChunks, &holder, 16);
+  pthread_join(makeThread(body), NULL);
+  body = makeCallableOnce(&ChunkHolder::freeChunks, &holder);
+  pthread_join(makeThread(body), NULL);
+
+  // Both threads exited. Everything they cached is in the depot now.
+  pool.getStats(&stats);
+  EXPECT_EQ(stats.misses, 16);
+  EXPECT_EQ(stats.depot_bytes, 16*ChunkSize);
+
+  // And is available to this thread.
+  holder.allocChunks(16);
+  pool.getStats(&stats);
+  EXPECT_EQ(stats.hits, 16);
+  EXPECT_EQ(stats.misses, 16);
+  EXPECT_EQ(stats.resident_bytes, 16*ChunkSize);
+  holder.freeChunks();
+}
+
+} // unnamed namespace
+
+int main(int argc, char *argv[]) {
+  return RUN_TESTS(argc, argv);
+}
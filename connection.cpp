@@ -2,16 +2,21 @@
 #include <cstring>      // strerror
 #include <errno.h>      // errno
 #include <fcntl.h>
+#include <limits.h>     // IOV_MAX
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>    // readv
 #include <unistd.h>     // read, write, close
 
+#include <algorithm>
 #include <iostream>
 
 #include "callback.hpp"
 #include "connection.hpp"
 #include "io_manager.hpp"
 #include "logging.hpp"
+#include "memory_budget.hpp"
 
 namespace base {
 
@@ -21,13 +26,32 @@ Connection::Connection(IOManager* io_manager, int client_fd)
     closed_(false),
     io_manager_(io_manager),
     in_error_(false),
-    refs_(0) {
+    run_inline_(false),
+    read_size_(MinReadSize),
+    read_offered_(0),
+    refs_(0),
+    in_charged_(0),
+    out_charged_(0),
+    read_paused_(false),
+    batching_(false),
+    write_deferred_(false),
+    input_held_(false),
+    last_read_(0),
+    input_since_(0),
+    last_written_(0),
+    timer_(0),
+    read_stopped_(false) {
+
+  memset(&write_msg_, 0, sizeof(write_msg_));
+  write_msg_.msg_iov = write_iov_;
 
   // Puts the Descriptor in read/write mode. Descriptor takes
   // ownership of the upcalls.
   Callback<void>* readUpCall = makeCallableMany(&Connection::doRead, this);
   Callback<void>* writeUpCall = makeCallableMany(&Connection::doWrite, this);
   io_desc_ = io_manager_->newDescriptor(client_fd_, readUpCall, writeUpCall);
+  io_desc_->setCompletions(makeCallableMany(&Connection::readComplete, this),
+                           makeCallableMany(&Connection::writeComplete, this));
 }
 
 Connection::Connection(IOManager* io_manager)
@@ -37,7 +61,23 @@ Connection::Connection(IOManager* io_manager)
     io_manager_(io_manager),
     io_desc_(NULL),
     in_error_(false),
-    refs_(0) {
+    run_inline_(false),
+    read_size_(MinReadSize),
+    read_offered_(0),
+    refs_(0),
+    in_charged_(0),
+    out_charged_(0),
+    read_paused_(false),
+    batching_(false),
+    write_deferred_(false),
+    input_held_(false),
+    last_read_(0),
+    input_since_(0),
+    last_written_(0),
+    timer_(0),
+    read_stopped_(false) {
+  memset(&write_msg_, 0, sizeof(write_msg_));
+  write_msg_.msg_iov = write_iov_;
 
   // The Descriptor 'io_desc_' will be put in connection mode in
   // startConnect(), if the connection doesn't complete
@@ -56,6 +96,45 @@ Connection::~Connection() {
   if (io_desc_) {
     io_manager_->delDescriptor(io_desc_);
   }
+
+  memoryBudget()->charge(&in_charged_, 0);
+  memoryBudget()->charge(&out_charged_, 0);
+}
+
+// Unless changed, a connection may hold 4MB in its buffers and all
+// connections together 1GB.
+static const size_t MaxBytesPerConnection = 4 << 20;
+static const size_t MaxBytesAllConnections = size_t(1) << 30;
+
+static pthread_once_t budget_init_control = PTHREAD_ONCE_INIT;
+static MemoryBudget* memory_budget = NULL;
+
+static void initMemoryBudget() {
+  memory_budget = new MemoryBudget(MaxBytesAllConnections,
+                                   MaxBytesPerConnection);
+}
+
+MemoryBudget* Connection::memoryBudget() {
+  pthread_once(&budget_init_control, initMemoryBudget);
+  return memory_budget;
+}
+
+// Connections reaped so far for each timeout; atomic access.
+static uint64_t reaped_idle = 0;
+static uint64_t reaped_header_read = 0;
+static uint64_t reaped_write_stall = 0;
+
+void Connection::getReapStats(ReapStats* stats) {
+  stats->idle = reaped_idle;
+  stats->header_read = reaped_header_read;
+  stats->write_stall = reaped_write_stall;
+}
+
+// Calls to socketWrite() so far; atomic access.
+static uint64_t send_calls = 0;
+
+uint64_t Connection::sendCalls() {
+  return send_calls;
 }
 
 void Connection::acquire() {
@@ -78,6 +157,13 @@ void Connection::release() {
   }
 }
 
+void Connection::setRunInline(bool run_inline) {
+  run_inline_ = run_inline;
+  if (io_desc_) {
+    io_desc_->setRunInline(run_inline);
+  }
+}
+
 void Connection::startConnect(const string& host, int port) {
   // Create a non-blocking socket.
   client_fd_ = socket(AF_INET, SOCK_STREAM, 0);
@@ -118,6 +204,7 @@ void Connection::startConnect(const string& host, int port) {
   } else {
     Callback<void>* write_cb = makeCallableMany(&Connection::doConnect, this);
     io_desc_ = io_manager_->newDescriptor(client_fd_, NULL, write_cb);
+    io_desc_->setRunInline(run_inline_);
     io_desc_->writeWhenReady();
   }
 }
@@ -142,6 +229,9 @@ void Connection::doConnect() {
       Callback<void>* read_cb = makeCallableMany(&Connection::doRead, this);
       Callback<void>* write_cb = makeCallableMany(&Connection::doWrite, this);
       io_desc_->setUpCalls(read_cb, write_cb);
+      io_desc_->setCompletions(
+        makeCallableMany(&Connection::readComplete, this),
+        makeCallableMany(&Connection::writeComplete, this));
     }
   }
 
@@ -153,29 +243,196 @@ void Connection::doConnect() {
 }
 
 void Connection::startRead() {
+  startTimeouts();
+  waitForInput();
+}
+
+// Returns the period, in seconds, of the checks for 'timeouts', or
+// zero if there is none to check. A connection is reaped at most a
+// quarter past its timeout.
+static double checkPeriod(const Connection::Timeouts& timeouts) {
+  const double all[] = { timeouts.idle,
+                         timeouts.header_read,
+                         timeouts.write_stall };
+  double shortest = 0;
+  for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+    if (all[i] > 0 && (shortest == 0 || all[i] < shortest)) {
+      shortest = all[i];
+    }
+  }
+  return shortest / 4;
+}
+
+void Connection::startTimeouts() {
+  const double period = checkPeriod(timeouts_);
+  if (period == 0) {
+    return;
+  }
+
+  const TicksClock::Ticks now = TicksClock::getTicks();
+  last_read_ = now;
+  m_write_.lock();
+  last_written_ = now;
+  m_write_.unlock();
+
+  // This acquire() is matched by the release() of whoever disarms
+  // the timer.
   acquire();
-  io_desc_->readWhenReady();
+  ScopedLock l(&m_timer_);
+  timer_ = io_manager_->addTimer(period,
+                                 makeCallableOnce(&Connection::checkTimeouts,
+                                                  this));
+}
+
+void Connection::stopTimeouts() {
+  bool disarmed = false;
+  m_timer_.lock();
+  read_stopped_ = true;
+  if (timer_ != 0) {
+    m_write_.lock();
+    const bool flushing = writing_;
+    m_write_.unlock();
+
+    // If the timer can't be cancelled, its check is under way and
+    // will notice reading stopped.
+    if (! flushing && io_manager_->cancelTimer(timer_)) {
+      timer_ = 0;
+      disarmed = true;
+    }
+  }
+  m_timer_.unlock();
+
+  if (disarmed) {
+    release();
+  }
 }
 
-static int socketRead(int fd, char* buf, size_t size) {
+void Connection::checkTimeouts() {
+  const TicksClock::Ticks now = TicksClock::getTicks();
+  const double ticks_per_sec = TicksClock::ticksPerSecond();
+
+  // Figure which state the connection is in and for how long.
+  uint64_t* reaped = NULL;
+  m_write_.lock();
+  const bool flushing = writing_;
+  if (flushing) {
+    if (timeouts_.write_stall > 0 &&
+        now - last_written_ > timeouts_.write_stall * ticks_per_sec) {
+      reaped = &reaped_write_stall;
+    }
+  } else if (input_since_ != 0) {
+    if (timeouts_.header_read > 0 &&
+        now - input_since_ > timeouts_.header_read * ticks_per_sec) {
+      reaped = &reaped_header_read;
+    }
+  } else {
+    const TicksClock::Ticks last = std::max(last_read_, last_written_);
+    if (timeouts_.idle > 0 && now - last > timeouts_.idle * ticks_per_sec) {
+      reaped = &reaped_idle;
+    }
+  }
+  m_write_.unlock();
+
+  // Shutting the socket down, rather than closing it, lets both the
+  // read and the write sides notice and wind down with the file
+  // descriptor still theirs.
+  if (reaped != NULL && ! closed_) {
+    __sync_fetch_and_add(reaped, 1);
+    shutdown(client_fd_, SHUT_RDWR);
+  }
+
+  m_timer_.lock();
+  const bool done = (reaped != NULL) || (read_stopped_ && ! flushing);
+  if (done) {
+    timer_ = 0;
+  } else {
+    Callback<void>* check = makeCallableOnce(&Connection::checkTimeouts, this);
+    timer_ = io_manager_->addTimer(checkPeriod(timeouts_), check);
+  }
+  m_timer_.unlock();
+
+  // This release() matches the acquire() done when the timer was
+  // first armed.
+  if (done) {
+    release();
+  }
+}
+
+static int socketRead(int fd, const struct iovec* iov, int iovcnt) {
   int res;
   do {
-    res = read(fd, buf, size);
+    res = readv(fd, iov, iovcnt);
   } while ((res < 0) && (errno == EINTR));
   return res;
 }
 
 void Connection::doRead() {
+  struct iovec iov[MaxReadSize / Buffer::BlockSize + 1];
+  const int max_iov = sizeof(iov) / sizeof(iov[0]);
+
+  // Bytes read but not yet handed to readDone().
+  size_t batch = 0;
+
+  // Whether reading goes on, be it when the socket is ready again or
+  // once a paused read is resumed.
+  bool reading = false;
+
   while (true) {
-    in_.reserve(1024);
-    int bytes_read = socketRead(client_fd_, in_.writePtr(), in_.writeSize());
+    const int iovcnt = in_.writeVector(iov, max_iov, read_size_);
+    size_t offered = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      offered += iov[i].iov_len;
+    }
+
+    int bytes_read = socketRead(client_fd_, iov, iovcnt);
     if (bytes_read > 0) {
+      last_read_ = TicksClock::getTicks();
+      if (input_since_ == 0) {
+        input_since_ = last_read_;
+      }
       in_.advance(bytes_read);
+      batch += bytes_read;
+      adaptReadSize(bytes_read, offered);
+
+      // A short read means the socket was drained. Otherwise, keep
+      // on reading before parsing, unless the batch got too big.
+      const bool drained = size_t(bytes_read) < offered;
+      if (!drained && (batch < MaxReadSize)) {
+        continue;
+      }
+
+      batch = 0;
+      const ReadState state = processInput();
+      if (state != READ_OK) {
+        reading = (state == READ_PAUSED);
+        break;
+      }
+
+      if (!drained) {
+        continue;
+      }
+
+      // The socket was drained. If more data arrives, edge triggered
+      // polling will report it.
+      waitForInput();
+      reading = true;
+      break;
+    }
+
+    // Whatever was read so far gets processed before the socket
+    // is waited on, or given up on.
+    if (batch > 0) {
+      const ReadState state = processInput();
+      if (state != READ_OK) {
+        reading = (state == READ_PAUSED);
+        break;
+      }
     }
+    batch = 0;
 
     if ((bytes_read < 0) && (errno == EAGAIN)) {
-      acquire();
-      io_desc_->readWhenReady();
+      waitForInput();
+      reading = true;
       break;
 
     } else if (bytes_read < 0) {
@@ -183,17 +440,14 @@ void Connection::doRead() {
         << "Error on read (" << client_fd_ << "): " << strerror(errno);
       break;
 
-    } else if (bytes_read == 0) {
+    } else /* bytes_read == 0 */ {
       // The socket was closed.
       break;
-
-    } else if (!readDone()) {
-      LOG(LogMessage::WARNING)
-        << "Error procesing read (" << client_fd_ << ")";
-      break;
     }
+  }
 
-    // Continue issuing reads.
+  if (!reading) {
+    stopTimeouts();
   }
 
   // This release matches the acquire done when scheduling the
@@ -201,38 +455,262 @@ void Connection::doRead() {
   release();
 }
 
+void Connection::waitForInput() {
+  acquire();
+  if (io_desc_->completesIO()) {
+    const int max_iov = sizeof(read_iov_) / sizeof(read_iov_[0]);
+    const int iovcnt = in_.writeVector(read_iov_, max_iov, read_size_);
+    read_offered_ = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      read_offered_ += read_iov_[i].iov_len;
+    }
+    if (io_desc_->submitReadv(read_iov_, iovcnt)) {
+      return;
+    }
+  }
+
+  in_.unreserve();
+  io_desc_->readWhenReady();
+}
+
+void Connection::readComplete(int res) {
+  // Whether reading goes on, as in doRead().
+  bool reading = false;
+
+  if (res > 0) {
+    last_read_ = TicksClock::getTicks();
+    if (input_since_ == 0) {
+      input_since_ = last_read_;
+    }
+    in_.advance(res);
+    adaptReadSize(res, read_offered_);
+
+    const ReadState state = processInput();
+    if (state == READ_OK) {
+      waitForInput();
+      reading = true;
+    } else {
+      reading = (state == READ_PAUSED);
+    }
+
+  } else if (res == -EAGAIN) {
+    // Older kernels don't wait on a non-blocking socket. Fall back to
+    // waiting for it to be readable.
+    in_.unreserve();
+    acquire();
+    io_desc_->readWhenReady();
+    reading = true;
+
+  } else if (res < 0) {
+    LOG(LogMessage::WARNING)
+      << "Error on read (" << client_fd_ << "): " << strerror(-res);
+  }
+
+  if (!reading) {
+    stopTimeouts();
+  }
+
+  // This release matches the acquire done when submitting the read.
+  release();
+}
+
+void Connection::resumeRead() {
+  if (input_held_) {
+    const ReadState state = processInput();
+    if (state != READ_OK) {
+      if (state != READ_PAUSED) {
+        stopTimeouts();
+      }
+
+      // This release matches the acquire done when pausing.
+      release();
+      return;
+    }
+  }
+
+  // A read request picks up whatever arrived while paused.
+  if (io_desc_->completesIO()) {
+    waitForInput();
+    release();
+    return;
+  }
+  doRead();
+}
+
+Connection::ReadState Connection::processInput() {
+  while (true) {
+    input_held_ = false;
+    const size_t pending = in_.byteCount();
+    if (!batchReadDone()) {
+      LOG(LogMessage::WARNING)
+        << "Error procesing read (" << client_fd_ << ")";
+      return READ_ERROR;
+    }
+
+    // What is left is (the start of) a request that arrived no
+    // earlier than the last read.
+    const size_t left = in_.byteCount();
+    if (left == 0) {
+      input_since_ = 0;
+    } else if (left < pending) {
+      input_since_ = last_read_;
+    }
+
+    const ReadState state = checkReadBudget();
+    if (state == READ_OVERFLOW) {
+      LOG(LogMessage::WARNING)
+        << "Input over memory budget (" << client_fd_ << ")";
+    }
+
+    // Input held back while output was over budget should be handled
+    // now if the output drained meanwhile.
+    if ((state != READ_OK) || !input_held_) {
+      return state;
+    }
+  }
+}
+
+bool Connection::batchReadDone() {
+  m_write_.lock();
+  batching_ = true;
+  m_write_.unlock();
+
+  const bool res = readDone();
+
+  // Whatever output readDone() produced goes out in one write (or as
+  // few as 'out_' takes).
+  m_write_.lock();
+  batching_ = false;
+  const bool deferred = write_deferred_;
+  write_deferred_ = false;
+  m_write_.unlock();
+
+  if (deferred) {
+    startWrite();
+  }
+  return res;
+}
+
+bool Connection::outputOverBudget() {
+  MemoryBudget* budget = memoryBudget();
+  budget->charge(&in_charged_, in_.byteCount());
+
+  ScopedLock l(&m_write_);
+  budget->charge(&out_charged_, out_.byteCount());
+  if (writing_ && budget->overLimit(in_charged_ + out_charged_)) {
+    input_held_ = true;
+  }
+  return input_held_;
+}
+
+Connection::ReadState Connection::checkReadBudget() {
+  MemoryBudget* budget = memoryBudget();
+  budget->charge(&in_charged_, in_.byteCount());
+
+  ScopedLock l(&m_write_);
+  budget->charge(&out_charged_, out_.byteCount());
+  if (! budget->overLimit(in_charged_ + out_charged_)) {
+    return READ_OK;
+  }
+
+  // A pending write will drain 'out_' and can resume reading when
+  // done. The resumed read will start anew, so it gets its own
+  // reference and the input is left as if the socket was drained.
+  if (writing_) {
+    in_.unreserve();
+    acquire();
+    read_paused_ = true;
+    budget->notePause();
+    return READ_PAUSED;
+  }
+
+  // Nothing is waiting to be sent, so pausing would not free
+  // anything. That is fine as long as it is others who are using the
+  // budget up, but not if this connection's input alone does.
+  if (in_charged_ > budget->maxBytesPerOwner()) {
+    budget->noteOverflow();
+    return READ_OVERFLOW;
+  }
+  return READ_OK;
+}
+
+void Connection::adaptReadSize(size_t bytes_read, size_t offered) {
+  // Grow quickly when reads come back full; otherwise follow a
+  // moving average of the last reads.
+  if (bytes_read == offered) {
+    read_size_ = std::min(2 * read_size_, size_t(MaxReadSize));
+  } else {
+    read_size_ = (3 * read_size_ + bytes_read) / 4;
+    read_size_ = std::max(read_size_, size_t(MinReadSize));
+  }
+}
+
 void Connection::startWrite() {
   {
     ScopedLock l(&m_write_);
     if (writing_) {
       return;
     }
+    if (batching_ && out_.byteCount() < MaxDeferredWrite) {
+      write_deferred_ = true;
+      return;
+    }
     writing_ = true;
+    write_deferred_ = false;
+    last_written_ = TicksClock::getTicks();
   }
 
   acquire();
   doWrite();
 }
 
-static int socketWrite(int fd, const char* buf, size_t size) {
+// Same as writev(), but a peer that went away -- or a socket that was
+// shut down when reaped -- makes it fail with EPIPE rather than raise
+// SIGPIPE. If 'more' is true, the kernel is told more data follows
+// right away, so it needn't push out a partial segment.
+static int socketWrite(int fd, struct iovec* iov, int iovcnt, bool more) {
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+
   int res;
   do {
-    res = write(fd, buf, size);
+    __sync_fetch_and_add(&send_calls, 1);
+    res = sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
   } while ((res < 0) && (errno == EINTR));
   return res;
 }
 
 void Connection::doWrite() {
+  // The request, if taken, keeps this call's reference.
+  if (io_desc_->completesIO() && submitWrite()) {
+    return;
+  }
+
+  // Gathers as many pending chunks of 'out_' as a single sendmsg()
+  // takes. A response spanning several chunks thus goes out in one
+  // system call.
+  struct iovec iov[IOV_MAX];
+  bool resume_read = false;
+
   while (true) {
-    // Note that size here is the contiguous part of it It may very
-    // well be more data on the buffer that is not contiguous and thus
-    // would not appear in here.
     m_write_.lock();
-    int size = out_.readSize();
-    const char* data = out_.readPtr();
+    if (out_.byteCount() == 0) {
+      writing_ = false;
+      resume_read |= checkWriteBudget(false /* no force */);
+      m_write_.unlock();
+      break;
+    }
+    int iovcnt = out_.readVector(iov, IOV_MAX);
+    size_t offered = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      offered += iov[i].iov_len;
+    }
+    const bool more = offered < out_.byteCount();
     m_write_.unlock();
 
-    int bytes_written = socketWrite(client_fd_, data, size);
+    int bytes_written = socketWrite(client_fd_, iov, iovcnt, more);
 
     {
       ScopedLock l(&m_write_);
@@ -245,18 +723,26 @@ void Connection::doWrite() {
       } else if (bytes_written < 0) {
         // LOG(LogMessage::ERROR) << "Error on write " << strerror(errno);
         std::cout << "Error on write " << strerror(errno) << std::endl;
+        resume_read |= checkWriteBudget(true /* force */);
         break;
 
       } else if (bytes_written == 0) {
         // LOG(Logmessage::NORMAL) << "Closing on write " << client_fd_;
         std::cout << "Closing on write " << client_fd_ << std::endl;
+        resume_read |= checkWriteBudget(true /* force */);
         break;
 
       }
 
+      // Consume exactly what the kernel took. If it was less than
+      // what was offered, the next sendmsg() will likely hit EAGAIN.
       out_.consume(bytes_written);
-      if ((size == bytes_written) && (out_.readSize() == 0)) {
+      last_written_ = TicksClock::getTicks();
+      if (out_.byteCount() == 0) {
         writing_ = false;
+      }
+      resume_read |= checkWriteBudget(false /* no force */);
+      if (! writing_) {
         break;
       }
 
@@ -265,8 +751,100 @@ void Connection::doWrite() {
     }
   }
 
+  // The paused read kept its reference, which the resumed read will
+  // release.
+  if (resume_read) {
+    io_manager_->addTask(makeCallableOnce(&Connection::resumeRead, this));
+  }
+
   // This release matched the acquire that scheduled the doWrite()
   release();
 }
 
+bool Connection::submitWrite() {
+  m_write_.lock();
+  if (out_.byteCount() == 0) {
+    m_write_.unlock();
+    return false;
+  }
+  const int iovcnt = out_.readVector(write_iov_, MaxWriteVector);
+  size_t offered = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    offered += write_iov_[i].iov_len;
+  }
+  const bool more = offered < out_.byteCount();
+  m_write_.unlock();
+
+  write_msg_.msg_iovlen = iovcnt;
+  return io_desc_->submitSendmsg(&write_msg_,
+                                 MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+}
+
+void Connection::writeComplete(int res) {
+  bool resume_read = false;
+  bool more = false;
+
+  {
+    ScopedLock l(&m_write_);
+
+    if (res == -EAGAIN) {
+      // As in readComplete(), wait for the socket instead.
+      acquire();
+      io_desc_->writeWhenReady();
+
+    } else if (res < 0) {
+      std::cout << "Error on write " << strerror(-res) << std::endl;
+      resume_read |= checkWriteBudget(true /* force */);
+
+    } else if (res == 0) {
+      std::cout << "Closing on write " << client_fd_ << std::endl;
+      resume_read |= checkWriteBudget(true /* force */);
+
+    } else {
+      out_.consume(res);
+      last_written_ = TicksClock::getTicks();
+      if (out_.byteCount() == 0) {
+        writing_ = false;
+      }
+      resume_read |= checkWriteBudget(false /* no force */);
+      more = writing_;
+    }
+  }
+
+  // The rest of the output goes in a request of its own.
+  if (more) {
+    acquire();
+    doWrite();
+  }
+
+  // The paused read kept its reference, which the resumed read will
+  // release.
+  if (resume_read) {
+    io_manager_->addTask(makeCallableOnce(&Connection::resumeRead, this));
+  }
+
+  // This release matches the acquire done when submitting the write.
+  release();
+}
+
+bool Connection::checkWriteBudget(bool force) {
+  MemoryBudget* budget = memoryBudget();
+  budget->charge(&out_charged_, out_.byteCount());
+  if (! read_paused_) {
+    return false;
+  }
+
+  // Reading goes on once 'out_' is empty or has shrunk enough. If
+  // writing failed, it goes on regardless: the read will find out
+  // about the socket's state and wind the connection down.
+  const size_t charged = in_charged_ + out_charged_;
+  if (! force && writing_ && ! budget->underLowWater(charged)) {
+    return false;
+  }
+
+  read_paused_ = false;
+  budget->noteResume();
+  return true;
+}
+
 } // namespace base
@@ -2,9 +2,12 @@
 #define MCP_BASE_CONNECTION_HEADER
 
 #include <string>
+#include <sys/socket.h>   // msghdr
+#include <sys/uio.h>      // iovec
 
 #include "buffer.hpp"
 #include "lock.hpp"
+#include "ticks_clock.hpp"
 
 namespace base {
 
@@ -44,6 +47,47 @@ class IOManager;
 //     occur concurrently. So the output buffer needs to be protected
 //     the m_write_ lock.
 //
+// Memory budget:
+//
+//   The bytes sitting in 'in_' and 'out_' are charged against a
+//   process-wide MemoryBudget (see memoryBudget()), which has a limit
+//   per connection and one for all connections together. When a
+//   connection goes over either limit while it still has output to
+//   flush, it stops reading from its socket; doWrite() resumes
+//   reading once enough output has been sent. A peer that pipelines
+//   requests without reading the responses is thus held back by TCP
+//   flow control, rather than by our running out of memory. A
+//   connection whose input alone goes over the per-connection limit
+//   (e.g., a request too large) is dropped.
+//
+// Write coalescing:
+//
+//   A write started while readDone() runs is deferred until it
+//   returns, unless 'out_' grows past MaxDeferredWrite first. The
+//   responses to a pipelined batch of requests thus go out together,
+//   in as few system calls as the output takes, rather than one or
+//   more per response.
+//
+// Completion-based I/O:
+//
+//   If the io_manager's poller carries out I/O itself (io_uring), the
+//   connection doesn't wait for its socket to be ready. It keeps a
+//   readv() request pending with the kernel instead, and hands
+//   'out_' to sendmsg() requests, and picks up where it left when
+//   they complete (see readComplete() and writeComplete()). The
+//   requests go to the kernel in batches, along with the poller's
+//   waits, rather than one system call each.
+//
+// Timeouts:
+//
+//   A server-side connection may be given timeouts (see
+//   setTimeouts()) so that peers that linger don't hold on to its
+//   socket and buffers forever. The read and write sides only stamp
+//   the time of their progress; an IOManager timer checks the stamps
+//   every so often and reaps a connection that went over a timeout by
+//   shutting its socket down. The reading and writing then wind down
+//   as if the peer had gone away.
+//
 // Example Usage:
 //
 //   class MyServerConnection : public base::Connection {
@@ -71,6 +115,7 @@ class IOManager;
 //
 
 class Descriptor;
+class MemoryBudget;
 
 class Connection {
 public:
@@ -86,6 +131,32 @@ public:
   void acquire();
   void release();
 
+  // Returns the budget all Connections charge their buffers
+  // against. Its limits can be changed at any time with setLimits().
+  static MemoryBudget* memoryBudget();
+
+  // How long, in seconds, a connection may stay in each of the states
+  // below before it is reaped. Zero means no limit.
+  struct Timeouts {
+    Timeouts() : idle(0), header_read(0), write_stall(0) {}
+
+    double idle;          // neither input nor output pending
+    double header_read;   // a request arrived only in part
+    double write_stall;   // output pending but none of it being taken
+  };
+
+  // How many connections, process-wide, were reaped for each timeout.
+  struct ReapStats {
+    uint64_t idle;
+    uint64_t header_read;
+    uint64_t write_stall;
+  };
+  static void getReapStats(ReapStats* stats);
+
+  // How many system calls connections issued to send data,
+  // process-wide. (Unlike reads, these don't show in /proc/self/io.)
+  static uint64_t sendCalls();
+
   // accessors
 
   IOManager* io_manager() { return io_manager_; }
@@ -150,17 +221,44 @@ protected:
   // If there isn't an ongoing write yet, starts one. An ongoing write
   // will flush to the underlying socket all the contents of 'out_' at
   // that juncture. This call should be issued every time 'out_' was
-  // written to.
+  // written to. While readDone() runs, the write may be deferred
+  // until it returns (see "Write coalescing" above).
   //
   // Tha call increments the reference count for the time it takes to
   // wait for the underlying socket to be ready until the writing the
   // data in 'out_' to it.
   void startWrite();
 
-  // Closes the underlying file descriptor.
+  // Returns true if this connection's output took it over its memory
+  // budget. A readDone() that produces output for each request it
+  // parses may check this between requests and, if true, return
+  // right away, leaving the remaining requests in 'in_'. Reading then
+  // pauses, and readDone() is issued again on the remaining input
+  // once enough output was sent.
+  //
+  // Note: Can only be issued from within readDone().
+  bool outputOverBudget();
+
+  // Asks for this connection's reads and writes to be issued on the
+  // io_manager's polling thread when possible, rather than handed to
+  // a worker (see Descriptor::setRunInline()). Worth it only if
+  // readDone() is quick. Can be issued before the connection is
+  // established.
+  void setRunInline(bool run_inline);
+
+  // Sets the timeouts this connection is reaped after. Must be
+  // issued before startRead(), which is when they start counting.
+  void setTimeouts(const Timeouts& timeouts) { timeouts_ = timeouts; }
+
+  // Shuts the underlying socket down. Reading and writing wind down
+  // as if the peer had gone away, and the file descriptor is closed
+  // when the last reference is released. Closing it here would let
+  // its number be reused while requests on it are still pending.
+  // Unless the caller holds a reference, the connection may be gone
+  // by the time this returns.
   void close() {
-    ::close(client_fd_);
     closed_ = true;
+    shutdown(client_fd_, SHUT_RDWR);
   }
 
 private:
@@ -169,15 +267,124 @@ private:
   IOManager*      io_manager_;      // not owned by this
   Descriptor*     io_desc_;         // owned by this
   bool            in_error_;        // last op failed?
+  bool            run_inline_;      // see setRunInline()
   string          error_string_;    // last error description
 
+  // How much to ask of each read. It adapts to the recent reads on
+  // this connection within [MinReadSize, MaxReadSize]. Touched only
+  // by the (single) read side.
+  enum { MinReadSize = 1024, MaxReadSize = 64 << 10 };
+  size_t          read_size_;
+
+  // Most output a write may be deferred for while readDone() runs.
+  enum { MaxDeferredWrite = 64 << 10 };
+
+  // The requests pending with the poller when it completes I/O (see
+  // "Completion-based I/O" above). 'read_iov_' and 'read_offered_'
+  // are touched by the read side only; the write ones, by whoever
+  // has 'writing_' set.
+  enum { MaxWriteVector = 64 };
+  struct iovec    read_iov_[MaxReadSize / Buffer::BlockSize + 1];
+  size_t          read_offered_;
+  struct iovec    write_iov_[MaxWriteVector];
+  struct msghdr   write_msg_;
+
   Mutex           m_refs_;          // protects refs_
   int             refs_;            // reference counting state
 
+  // Bytes charged to the memory budget for each buffer. 'in_charged_'
+  // is touched only by the read side, or by doWrite() while reading
+  // is paused. The remaining state is protected by m_write_.
+  size_t          in_charged_;
+  size_t          out_charged_;
+  bool            read_paused_;     // waiting for doWrite() to resume
+  bool            batching_;        // readDone() is running
+  bool            write_deferred_;  // startWrite() issued while batching
+  bool            input_held_;      // readDone() stopped short (read side)
+
+  // Timeouts and the progress stamps they are checked against. The
+  // read side stamps 'last_read_' and 'input_since_' (which is zero
+  // while there is no input pending); checkTimeouts() reads them
+  // racily, which at worst delays a reaping by one check.
+  // 'last_written_' is protected by m_write_.
+  Timeouts          timeouts_;
+  TicksClock::Ticks last_read_;
+  TicksClock::Ticks input_since_;
+  TicksClock::Ticks last_written_;
+
+  Mutex           m_timer_;         // protects state below
+  uint64_t        timer_;           // IOManager::TimerHandle, if armed
+  bool            read_stopped_;    // checks go on only while writing
+
+  enum ReadState { READ_OK, READ_PAUSED, READ_OVERFLOW, READ_ERROR };
+
+  // Issues readDone() and starts any write it deferred.
+  bool batchReadDone();
+
+  // Issues readDone() -- again, if it held input back -- and then
+  // charges the buffers to the memory budget to decide whether
+  // reading can go on. If it returns READ_PAUSED, a reference was
+  // taken on behalf of the read that doWrite() is to resume. Any
+  // other value but READ_OK means reading should stop.
+  ReadState processInput();
+  ReadState checkReadBudget();
+
+  // Internal read helper scheduled by doWrite() to resume a paused
+  // read. Hands any input held back to readDone() before going back
+  // to the socket. Decrements reference count at the end.
+  void resumeRead();
+
+  // Charges 'out_' to the memory budget and returns true if a paused
+  // read should be resumed, which 'force' requests regardless of the
+  // budget.
+  // REQUIRES: m_write_ is held.
+  bool checkWriteBudget(bool force);
+
+  // Arms the timer that issues checkTimeouts(), if any timeout was
+  // set. The armed timer holds a reference.
+  void startTimeouts();
+
+  // Disarms the timer once reading stopped for good, unless there is
+  // still output to flush, in which case checkTimeouts() drops it
+  // after the output is flushed (or stalls).
+  void stopTimeouts();
+
+  // Reaps the connection if it went over one of its timeouts and
+  // otherwise re-arms the timer.
+  void checkTimeouts();
+
   // Internal read helper called when 'startRead()' can effectively
-  // run. Decrements reference count at the end.
+  // run. Reads with readv() into as many chunks as 'read_size_' asks
+  // for and calls 'readDone()' once the socket is drained (or once a
+  // large batch piles up), rather than after every read. Decrements
+  // reference count at the end.
   void doRead();
 
+  // Updates 'read_size_' after a read that returned 'bytes_read' out
+  // of 'offered' bytes.
+  void adaptReadSize(size_t bytes_read, size_t offered);
+
+  // Waits for more input, taking a reference for the read to come.
+  // Submits a readv() request if the poller completes I/O, and
+  // otherwise waits for the socket to be readable.
+  void waitForInput();
+
+  // Handles the result 'res' of the readv() request like doRead() does
+  // a read, and submits the next one. Decrements reference count at
+  // the end.
+  void readComplete(int res);
+
+  // Submits a sendmsg() request for as much of 'out_' as a request
+  // takes. Returns false if there is nothing to send or the poller
+  // wouldn't take it.
+  // REQUIRES: 'writing_' is set.
+  bool submitWrite();
+
+  // Handles the result 'res' of the sendmsg() request like doWrite()
+  // does a write, and submits the next one if there is output left.
+  // Decrements reference count at the end.
+  void writeComplete(int res);
+
   // Called when there is data in the input buffer to be
   // read. Subclasses need to implement this to handle the parsing and
   // processing of the packet. Returns true if the read was successful
@@ -197,7 +404,9 @@ private:
   virtual void connDone() {}
 
   // Writes all data available in the 'out_' Buffer into
-  // 'client_fd'.
+  // 'client_fd', gathering several chunks per system call. Resumes
+  // reading if it had been paused for lack of budget. If the poller
+  // completes I/O, submits a sendmsg() request instead.
   void doWrite();
 
   // Non-copyable, non-assignable
@@ -13,5 +13,16 @@ public:
   static const int LINE_SIZE = 64;
 };
 
+// To be issued in each round of a spin-wait loop. It tells the CPU
+// the loop is waiting, so that it can save power and leave more of
+// the core to a sibling hyperthread.
+inline void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
 }  // namescape base
 #endif // MCP_BASE_CPU_ARCH_HEADER
@@ -0,0 +1,205 @@
+#include <dirent.h>
+#include <stdio.h>    // sscanf
+#include <stdlib.h>   // strtol
+#include <unistd.h>   // sysconf
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <utility>
+
+#include "cpu_topology.hpp"
+
+namespace base {
+
+using std::pair;
+using std::set;
+
+static const char* const SysCpu = "/sys/devices/system/cpu";
+static const char* const SysNode = "/sys/devices/system/node";
+
+pthread_once_t CpuTopology::once_control_ = PTHREAD_ONCE_INIT;
+CpuTopology*   CpuTopology::machine_ = NULL;
+
+// Reads the first line of the file 'path' into 'line'. Returns false
+// if the file can't be read.
+static bool readLine(const string& path, string* line) {
+  std::ifstream in(path.c_str());
+  std::getline(in, *line);
+  return ! in.fail();
+}
+
+// Reads the number in the file 'path', or returns 'otherwise'.
+static int readNumber(const string& path, int otherwise) {
+  string line;
+  if (! readLine(path, &line) || line.empty()) {
+    return otherwise;
+  }
+  return atoi(line.c_str());
+}
+
+static bool byId(const CpuTopology::Cpu& a, const CpuTopology::Cpu& b) {
+  return a.id < b.id;
+}
+
+CpuTopology::CpuTopology(const vector<Cpu>& cpus)
+  : cpus_(cpus) {
+  std::sort(cpus_.begin(), cpus_.end(), byId);
+  set<int> nodes;
+  for (size_t i = 0; i < cpus_.size(); i++) {
+    nodes.insert(cpus_[i].node);
+  }
+  nodes_.assign(nodes.begin(), nodes.end());
+}
+
+const CpuTopology& CpuTopology::machine() {
+  pthread_once(&once_control_, readMachine);
+  return *machine_;
+}
+
+void CpuTopology::readMachine() {
+  vector<int> online;
+  string line;
+  if (! readLine(string(SysCpu) + "/online", &line) ||
+      ! parseList(line, &online)) {
+    online.clear();
+    const int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < num_cpus; i++) {
+      online.push_back(i);
+    }
+  }
+
+  vector<Cpu> cpus;
+  for (size_t i = 0; i < online.size(); i++) {
+    std::ostringstream dir;
+    dir << SysCpu << "/cpu" << online[i] << "/topology/";
+    Cpu cpu;
+    cpu.id = online[i];
+    cpu.node = 0;
+    cpu.package = readNumber(dir.str() + "physical_package_id", 0);
+    cpu.core = readNumber(dir.str() + "core_id", online[i]);
+    cpus.push_back(cpu);
+  }
+
+  // Nodes list their CPUs, rather than the other way around.
+  DIR* dir = opendir(SysNode);
+  if (dir != NULL) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+      int node;
+      char rest;
+      if (sscanf(entry->d_name, "node%d%c", &node, &rest) != 1) {
+        continue;
+      }
+      vector<int> ids;
+      if (! readLine(string(SysNode) + "/" + entry->d_name + "/cpulist",
+                     &line) ||
+          ! parseList(line, &ids)) {
+        continue;
+      }
+      for (size_t i = 0; i < cpus.size(); i++) {
+        if (std::find(ids.begin(), ids.end(), cpus[i].id) != ids.end()) {
+          cpus[i].node = node;
+        }
+      }
+    }
+    closedir(dir);
+  }
+
+  machine_ = new CpuTopology(cpus);
+}
+
+void CpuTopology::nodeCpus(int node, vector<int>* ids) const {
+  ids->clear();
+  for (size_t i = 0; i < cpus_.size(); i++) {
+    if (cpus_[i].node == node) {
+      ids->push_back(cpus_[i].id);
+    }
+  }
+}
+
+int CpuTopology::numPackages() const {
+  set<int> packages;
+  for (size_t i = 0; i < cpus_.size(); i++) {
+    packages.insert(cpus_[i].package);
+  }
+  return packages.size();
+}
+
+int CpuTopology::numCores() const {
+  set<pair<int, int> > cores;
+  for (size_t i = 0; i < cpus_.size(); i++) {
+    cores.insert(std::make_pair(cpus_[i].package, cpus_[i].core));
+  }
+  return cores.size();
+}
+
+string CpuTopology::toString() const {
+  std::ostringstream out;
+  out << numNodes() << (numNodes() == 1 ? " node, " : " nodes, ")
+      << numPackages() << (numPackages() == 1 ? " package, " : " packages, ")
+      << numCores() << (numCores() == 1 ? " core, " : " cores, ")
+      << numCpus() << (numCpus() == 1 ? " CPU (" : " CPUs (");
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    vector<int> ids;
+    nodeCpus(nodes_[i], &ids);
+    out << (i > 0 ? "; " : "") << "node " << nodes_[i] << ": "
+        << listToString(ids);
+  }
+  out << ")";
+  return out.str();
+}
+
+bool CpuTopology::parseList(const string& list, vector<int>* ids) {
+  ids->clear();
+  std::istringstream in(list);
+  string range;
+  while (std::getline(in, range, ',')) {
+    const char* p = range.c_str();
+    char* end;
+    const long first = strtol(p, &end, 10);
+    if (end == p || first < 0) {
+      return false;
+    }
+    long last = first;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first) {
+        return false;
+      }
+    }
+    while (*end == ' ' || *end == '\n') {
+      end++;
+    }
+    if (*end != '\0') {
+      return false;
+    }
+    for (long id = first; id <= last; id++) {
+      ids->push_back(id);
+    }
+  }
+  return ! ids->empty();
+}
+
+string CpuTopology::listToString(const vector<int>& ids) {
+  vector<int> sorted(ids);
+  std::sort(sorted.begin(), sorted.end());
+  std::ostringstream out;
+  size_t i = 0;
+  while (i < sorted.size()) {
+    size_t j = i;
+    while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) {
+      j++;
+    }
+    out << (i > 0 ? "," : "") << sorted[i];
+    if (j > i) {
+      out << "-" << sorted[j];
+    }
+    i = j + 1;
+  }
+  return out.str();
+}
+
+}  // namespace base
@@ -0,0 +1,80 @@
+#ifndef MCP_BASE_CPU_TOPOLOGY_HEADER
+#define MCP_BASE_CPU_TOPOLOGY_HEADER
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace base {
+
+using std::string;
+using std::vector;
+
+// The CPUs of the machine, as the kernel lays them out under
+// /sys/devices/system: which ones are online and, for each, the NUMA
+// node, the package (socket) and the core it belongs to. CPUs of the
+// same core are hyperthread siblings.
+//
+// Where /sys doesn't tell, every online CPU is taken to be a core of
+// its own, in package 0 of node 0.
+//
+// Thread Safety:
+//
+//   A topology doesn't change after it's built; all calls are
+//   thread-safe.
+//
+class CpuTopology {
+public:
+  struct Cpu {
+    int id;        // as in /sys/devices/system/cpu/cpu<id>
+    int node;      // NUMA node
+    int package;   // physical_package_id
+    int core;      // core_id, unique within the package
+  };
+
+  // Builds the topology made of 'cpus'.
+  explicit CpuTopology(const vector<Cpu>& cpus);
+
+  // Returns the topology of this machine, read from /sys the first
+  // time around.
+  static const CpuTopology& machine();
+
+  // Returns the online CPUs, by id.
+  const vector<Cpu>& cpus() const { return cpus_; }
+
+  // Returns the NUMA nodes that have CPUs, in increasing order.
+  const vector<int>& nodes() const { return nodes_; }
+
+  // Fills 'ids' with the CPUs of node 'node'.
+  void nodeCpus(int node, vector<int>* ids) const;
+
+  int numCpus() const { return cpus_.size(); }
+  int numNodes() const { return nodes_.size(); }
+  int numPackages() const;
+  int numCores() const;
+
+  // Returns a one-line description, e.g. "2 nodes, 2 packages, 8
+  // cores, 16 CPUs (node 0: 0-3,8-11; node 1: 4-7,12-15)".
+  string toString() const;
+
+  // Parses a CPU list in the format of /sys, e.g. "0-3,8,10-11", into
+  // 'ids'. Returns false if 'list' is malformed.
+  static bool parseList(const string& list, vector<int>* ids);
+
+  // Formats 'ids' as a CPU list; the reverse of parseList().
+  static string listToString(const vector<int>& ids);
+
+private:
+  vector<Cpu> cpus_;
+  vector<int> nodes_;
+
+  static pthread_once_t once_control_;
+  static CpuTopology*   machine_;
+
+  // Reads the topology of this machine into machine_.
+  static void readMachine();
+};
+
+}  // namespace base
+
+#endif // MCP_BASE_CPU_TOPOLOGY_HEADER
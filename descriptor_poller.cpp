@@ -0,0 +1,98 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "descriptor_poller.hpp"
+#include "descriptor_poller_backend.hpp"
+#include "logging.hpp"
+
+namespace base {
+
+DescriptorPoller::Backend DescriptorPoller::default_backend_ =
+  DescriptorPoller::EPOLL;
+
+DescriptorPoller::DescriptorPoller()
+  : backend_(NULL),
+    backend_type_(EPOLL) {
+}
+
+DescriptorPoller::~DescriptorPoller() {
+  delete backend_;
+}
+
+void DescriptorPoller::setDefaultBackend(Backend backend) {
+  default_backend_ = backend;
+}
+
+DescriptorPoller::Backend DescriptorPoller::defaultBackend() {
+  return default_backend_;
+}
+
+void DescriptorPoller::create() {
+  if (default_backend_ == URING) {
+    backend_ = newUringBackend();
+    if (backend_ != NULL && backend_->create()) {
+      backend_type_ = URING;
+      return;
+    }
+
+    LOG(LogMessage::WARNING) << "io_uring not available, using epoll";
+    delete backend_;
+  }
+
+  backend_ = newEpollBackend();
+  if (backend_ == NULL || !backend_->create()) {
+    perror("Can't create poller");
+    exit(1);
+  }
+  backend_type_ = EPOLL;
+}
+
+void DescriptorPoller::setEvent(int fd, Descriptor* descr) {
+  backend_->setEvent(fd, descr);
+}
+
+void DescriptorPoller::delEvent(Descriptor* descr) {
+  backend_->delEvent(descr);
+}
+
+int DescriptorPoller::poll(int timeout_usec) {
+  return backend_->poll(timeout_usec);
+}
+
+void DescriptorPoller::wakeup() {
+  backend_->wakeup();
+}
+
+void DescriptorPoller::getEvents(int i, int* events, Descriptor** descr) {
+  backend_->getEvents(i, events, descr);
+}
+
+bool DescriptorPoller::submitReadv(Descriptor* descr,
+                                   const struct iovec* iov,
+                                   int iovcnt) {
+  return backend_->submitReadv(descr, iov, iovcnt);
+}
+
+bool DescriptorPoller::submitSendmsg(Descriptor* descr,
+                                     const struct msghdr* msg,
+                                     int flags) {
+  return backend_->submitSendmsg(descr, msg, flags);
+}
+
+bool DescriptorPoller::submitAccept(Descriptor* descr) {
+  return backend_->submitAccept(descr);
+}
+
+int DescriptorPoller::getResult(int i, int done) {
+  return backend_->getResult(i, done);
+}
+
+bool DescriptorPoller::completesIO() const {
+  return backend_->completesIO();
+}
+
+uint64_t DescriptorPoller::syscalls() const {
+  return backend_->syscalls();
+}
+
+}  // namespace base
@@ -1,24 +1,51 @@
 #ifndef MCP_BASE_DESCRIPTOR_POLLER_HEADER
 #define MCP_BASE_DESCRIPTOR_POLLER_HEADER
 
+#include <inttypes.h>
+#include <sys/socket.h>   // msghdr
+#include <sys/uio.h>      // iovec
+
 namespace base {
 
 class Descriptor;
+class PollerBackend;
 
 // The class is a wrapper around the different poll() variations.
-// Currently, it works with epoll (in Linux) and kqueue (in MAC OS).
+// Currently, it works with epoll and io_uring (in Linux) and kqueue
+// (in MAC OS).
+//
+// On Linux, the backend is picked at runtime (see setDefaultBackend()).
+// The io_uring backend keeps a multishot, edge-triggered poll request
+// per descriptor and, besides, carries out reads, writes and accepts
+// itself (see submitReadv()). Requests issued while the polling
+// thread is busy are submitted in batches, along with its next wait
+// for completions. If the kernel lacks io_uring, or the multishot
+// polls it needs, pollers fall back to epoll.
 class DescriptorPoller {
 public:
   // Events the implementation should monitor for.
   enum PollEvents {
     DP_ERROR       = 0x0000001,
     DP_READ_READY  = 0x0000002,
-    DP_WRITE_READY = 0x0000004
+    DP_WRITE_READY = 0x0000004,
+    DP_READ_DONE   = 0x0000008,   // see submitReadv()
+    DP_WRITE_DONE  = 0x0000010
+  };
+
+  // Polling mechanisms.
+  enum Backend {
+    EPOLL,
+    URING
   };
 
   DescriptorPoller();
   ~DescriptorPoller();
 
+  // Picks the backend that pollers created from now on will try to
+  // use. The default is EPOLL.
+  static void setDefaultBackend(Backend backend);
+  static Backend defaultBackend();
+
   // Initializes internal event processing machinery. Must be called
   // before any other call in the class is issued.
   void create();
@@ -29,9 +56,21 @@ public:
   // Poll().
   void setEvent(int fd, Descriptor* descr);
 
+  // Stops polling for 'descr', whose socket may already be closed.
+  // Events for it found by a poll() before this call may still be
+  // reported. Can be called from any thread.
+  void delEvent(Descriptor* descr);
+
   // Returns the number of ready descriptors and prepare to issue
-  // 'getEvents()' for each of them.
-  int poll();
+  // 'getEvents()' for each of them. Waits at most 'timeout_usec'
+  // microseconds for a descriptor to become ready. The wait is as
+  // precise as the platform allows, but never shorter.
+  int poll(int timeout_usec);
+
+  // Makes a poll() in progress in another thread return right away,
+  // or, if there's none, the next one. Several wakeups before a poll()
+  // returns count as one. Can be called from any thread.
+  void wakeup();
 
   // Returns in 'event's the anding of all PollEvents set for the i-th
   // descriptor, along with that descriptors additional data,
@@ -39,10 +78,42 @@ public:
   // Poll() call.
   void getEvents(int i, int* events, Descriptor** descr);
 
+  // Completion-based I/O. If the backend carries out requests itself
+  // (io_uring), these queue one on the socket of 'descr' and return
+  // true; a later poll() reports the descriptor with DP_READ_DONE
+  // (for reads and accepts) or DP_WRITE_DONE. Otherwise they return
+  // false, and the caller should wait for readiness and do the I/O
+  // itself. 'iov' and 'msg' must stay valid until the request
+  // completes. A descriptor may have one read or accept, and one
+  // write, pending at a time. Can be called from any thread.
+  bool submitReadv(Descriptor* descr, const struct iovec* iov, int iovcnt);
+  bool submitSendmsg(Descriptor* descr, const struct msghdr* msg, int flags);
+  bool submitAccept(Descriptor* descr);
+
+  // Returns the result of the i-th descriptor's request that 'done'
+  // (DP_READ_DONE or DP_WRITE_DONE) reports: the bytes transferred,
+  // the accepted socket, or -errno.
+  int getResult(int i, int done);
+
+  // accessors
+
+  // The backend in use, after create().
+  Backend backend() const { return backend_type_; }
+
+  // Whether the submit*() calls above are carried out.
+  bool completesIO() const;
+
+  // How many polling system calls (epoll_ctl(), epoll_wait(),
+  // io_uring_enter(), ...) the poller issued so far. Reads and writes
+  // aren't counted.
+  uint64_t syscalls() const;
+
 private:
   // The implementation is architecture dependant.
-  struct InternalPoller;
-  InternalPoller* poller_;
+  PollerBackend* backend_;
+  Backend        backend_type_;
+
+  static Backend default_backend_;
 
   // Non-copyable, non-assignable.
   DescriptorPoller(const DescriptorPoller&);
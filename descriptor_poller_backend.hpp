@@ -0,0 +1,61 @@
+#ifndef MCP_BASE_DESCRIPTOR_POLLER_BACKEND_HEADER
+#define MCP_BASE_DESCRIPTOR_POLLER_BACKEND_HEADER
+
+#include <inttypes.h>
+#include <sys/socket.h>   // msghdr
+#include <sys/uio.h>      // iovec
+
+namespace base {
+
+class Descriptor;
+
+// The interface each DescriptorPoller implementation provides. This
+// header is meant for the implementations only; see
+// descriptor_poller.hpp for what each call does.
+class PollerBackend {
+public:
+  PollerBackend() : syscalls_(0) {}
+  virtual ~PollerBackend() {}
+
+  // Returns false if the mechanism is not available here.
+  virtual bool create() = 0;
+
+  virtual void setEvent(int fd, Descriptor* descr) = 0;
+  virtual void delEvent(Descriptor* descr) = 0;
+  virtual int poll(int timeout_usec) = 0;
+  virtual void wakeup() = 0;
+  virtual void getEvents(int i, int* events, Descriptor** descr) = 0;
+
+  // Backends that only report readiness keep these defaults.
+  virtual bool completesIO() const { return false; }
+  virtual bool submitReadv(Descriptor* descr,
+                           const struct iovec* iov,
+                           int iovcnt) { return false; }
+  virtual bool submitSendmsg(Descriptor* descr,
+                             const struct msghdr* msg,
+                             int flags) { return false; }
+  virtual bool submitAccept(Descriptor* descr) { return false; }
+  virtual int getResult(int i, int done) { return 0; }
+
+  uint64_t syscalls() const { return syscalls_; }
+
+protected:
+  // Implementations count their polling system calls here; atomic
+  // access.
+  void countSyscall() { __sync_fetch_and_add(&syscalls_, 1); }
+
+private:
+  uint64_t syscalls_;
+
+  // Non-copyable, non-assignable.
+  PollerBackend(const PollerBackend&);
+  PollerBackend& operator=(const PollerBackend&);
+};
+
+// Each returns NULL where the mechanism wasn't compiled in.
+PollerBackend* newEpollBackend();
+PollerBackend* newUringBackend();
+
+}  // namespace base
+
+#endif  // MCP_BASE_DESCRIPTOR_POLLER_BACKEND_HEADER
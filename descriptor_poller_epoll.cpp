@@ -4,61 +4,146 @@
 #include <cstdlib>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "descriptor_poller.hpp"
+#include "descriptor_poller_backend.hpp"
 
 namespace base {
 
-struct DescriptorPoller::InternalPoller {
+namespace {
+
+class EpollBackend : public PollerBackend {
+public:
+  EpollBackend() : fd_(-1), wakeup_fd_(-1), has_pwait2_(true) {}
+  virtual ~EpollBackend();
+
+  virtual bool create();
+  virtual void setEvent(int fd, Descriptor* descr);
+  virtual void delEvent(Descriptor* descr);
+  virtual int poll(int timeout_usec);
+  virtual void wakeup();
+  virtual void getEvents(int i, int* events, Descriptor** descr);
+
+private:
   static const int MAX_FDS_PER_POLL = 1024;
 
   int fd_;
   struct epoll_event events_[MAX_FDS_PER_POLL];
 
-  InternalPoller() : fd_(-1) {}
+  // An eventfd in the epoll set, written to by wakeup(). Its events
+  // are consumed here and never reach getEvents().
+  int wakeup_fd_;
+
+  // epoll_wait() only takes timeouts in milliseconds. Kernels since
+  // 5.11 have epoll_pwait2(), which takes a timespec; we fall back to
+  // the former if the running kernel lacks the latter.
+  bool has_pwait2_;
+
+  int wait(int timeout_usec);
+
+  // Drops the wakeup event, if any, out of the 'num_events' found
+  // ready, and returns how many events remain.
+  int dropWakeup(int num_events);
 };
 
-DescriptorPoller::DescriptorPoller() {
-  poller_ = new InternalPoller;
+EpollBackend::~EpollBackend() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  if (wakeup_fd_ != -1) {
+    close(wakeup_fd_);
+  }
 }
 
-DescriptorPoller::~DescriptorPoller() {
-  if (poller_->fd_ == -1) {
-    close(poller_->fd_);
+bool EpollBackend::create() {
+  fd_ = epoll_create(MAX_FDS_PER_POLL);
+  if (fd_ < 0) {
+    perror("Can't create epoll");
+    exit(1);
   }
 
-  delete poller_;
-}
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeup_fd_ < 0) {
+    perror("Can't create eventfd");
+    exit(1);
+  }
 
-void DescriptorPoller::create() {
-  poller_->fd_ = epoll_create(InternalPoller::MAX_FDS_PER_POLL);
-  if (poller_->fd_ < 0) {
-    perror("Can't create epoll");
+  // The wakeup event is told apart from the descriptors' by its
+  // data, which points to the backend itself.
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.ptr = reinterpret_cast<void*>(this);
+  if (epoll_ctl(fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev) != 0) {
+    perror("Can't add eventfd to epoll: ");
     exit(1);
   }
+  return true;
 }
 
-void DescriptorPoller::setEvent(int fd, Descriptor* descr) {
+void EpollBackend::setEvent(int fd, Descriptor* descr) {
   struct epoll_event ev;
   ev.events = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLET;
   ev.data.ptr = reinterpret_cast<void*>(descr);
-  int rc = epoll_ctl(poller_->fd_, EPOLL_CTL_ADD, fd, &ev);
+  countSyscall();
+  int rc = epoll_ctl(fd_, EPOLL_CTL_ADD, fd, &ev);
   if (rc != 0) {
     perror("Can't add epoll descriptor: ");
     exit(1);
   }
 }
 
-int DescriptorPoller::poll() {
+void EpollBackend::delEvent(Descriptor* descr) {
+  // Closing the socket already took it out of the epoll set.
+}
+
+int EpollBackend::wait(int timeout_usec) {
+  countSyscall();
+
+#if defined(SYS_epoll_pwait2)
+  if (has_pwait2_) {
+    struct timespec ts;
+    ts.tv_sec = timeout_usec / 1000000;
+    ts.tv_nsec = (timeout_usec % 1000000) * 1000;
+    int res = syscall(SYS_epoll_pwait2, fd_, events_, MAX_FDS_PER_POLL,
+                      &ts, NULL, 0);
+    if (res >= 0 || errno != ENOSYS) {
+      return res;
+    }
+    has_pwait2_ = false;
+  }
+#endif
+
+  // Round up so as to not wake up before the timeout.
+  return epoll_wait(fd_, events_, MAX_FDS_PER_POLL,
+                    (timeout_usec + 999) / 1000);
+}
+
+int EpollBackend::dropWakeup(int num_events) {
+  for (int i = 0; i < num_events; i++) {
+    if (events_[i].data.ptr == reinterpret_cast<void*>(this)) {
+      // Reset the counter so the next write makes a new edge.
+      uint64_t count;
+      while (read(wakeup_fd_, &count, sizeof(count)) < 0 && errno == EINTR) {
+      }
+      events_[i] = events_[num_events - 1];
+      return num_events - 1;
+    }
+  }
+  return num_events;
+}
+
+int EpollBackend::poll(int timeout_usec) {
   int res;
   for (;;) {
 
-    res = epoll_wait(poller_->fd_,
-                     poller_->events_, InternalPoller::MAX_FDS_PER_POLL,
-                     100 /* ms */);
+    res = wait(timeout_usec);
 
     if (res >= 0) {
+      res = dropWakeup(res);
       break;
     }
 
@@ -74,23 +159,35 @@ int DescriptorPoller::poll() {
   return res;
 }
 
-void DescriptorPoller::getEvents(int i, int* events, Descriptor** descr) {
+void EpollBackend::wakeup() {
+  const uint64_t one = 1;
+  while (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+void EpollBackend::getEvents(int i, int* events, Descriptor** descr) {
   *events &= 0x00000000;
-  *descr = reinterpret_cast<Descriptor*>(poller_->events_[i].data.ptr);
+  *descr = reinterpret_cast<Descriptor*>(events_[i].data.ptr);
 
-  if (poller_->events_[i].events & EPOLLERR) {
-    *events |= DP_ERROR;
+  if (events_[i].events & EPOLLERR) {
+    *events |= DescriptorPoller::DP_ERROR;
     return;
   }
 
-  if (poller_->events_[i].events & (EPOLLHUP | EPOLLIN)) {
-    *events |= DP_READ_READY;
+  if (events_[i].events & (EPOLLHUP | EPOLLIN)) {
+    *events |= DescriptorPoller::DP_READ_READY;
   }
-  if (poller_->events_[i].events & (EPOLLHUP | EPOLLOUT)) {
-    *events |= DP_WRITE_READY;
+  if (events_[i].events & (EPOLLHUP | EPOLLOUT)) {
+    *events |= DescriptorPoller::DP_WRITE_READY;
   }
 }
 
+}  // unnamed namespace
+
+PollerBackend* newEpollBackend() {
+  return new EpollBackend;
+}
+
 }  // namespace base
 
 #endif  // LINUX
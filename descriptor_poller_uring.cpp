@@ -0,0 +1,747 @@
+#if defined(LINUX)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "descriptor_poller.hpp"
+#include "descriptor_poller_backend.hpp"
+#include "lock.hpp"
+
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#endif
+
+namespace base {
+
+#if defined(__NR_io_uring_setup)
+
+namespace {
+
+// There is no liburing around, so we talk to the kernel directly.
+int ioUringSetup(unsigned entries, struct io_uring_params* p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int ioUringEnter(int fd,
+                 unsigned to_submit,
+                 unsigned min_complete,
+                 unsigned flags,
+                 void* arg,
+                 size_t arg_size) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 arg, arg_size);
+}
+
+// Each descriptor has a slot, and its requests carry the slot's
+// index and generation, and what kind of request they are, as user
+// data. The values below are beyond any generation and mark the
+// requests that aren't for a descriptor.
+enum RequestKind {
+  POLL_REQUEST  = 0,
+  READ_REQUEST  = 1,    // readv or accept
+  WRITE_REQUEST = 2
+};
+
+const int KindShift = 30;
+const uint64_t IndexMask = (uint64_t(1) << KindShift) - 1;
+
+const uint64_t WakeupData = ~uint64_t(0);
+const uint64_t RemoveData = ~uint64_t(0) - 1;
+const uint64_t ProbeData  = ~uint64_t(0) - 2;
+
+const uint32_t PollMask =
+  EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLET;
+
+class UringBackend : public PollerBackend {
+public:
+  UringBackend();
+  virtual ~UringBackend();
+
+  virtual bool create();
+  virtual void setEvent(int fd, Descriptor* descr);
+  virtual void delEvent(Descriptor* descr);
+  virtual int poll(int timeout_usec);
+  virtual void wakeup();
+  virtual void getEvents(int i, int* events, Descriptor** descr);
+
+  virtual bool completesIO() const { return true; }
+  virtual bool submitReadv(Descriptor* descr,
+                           const struct iovec* iov,
+                           int iovcnt);
+  virtual bool submitSendmsg(Descriptor* descr,
+                             const struct msghdr* msg,
+                             int flags);
+  virtual bool submitAccept(Descriptor* descr);
+  virtual int getResult(int i, int done);
+
+private:
+  static const int MAX_FDS_PER_POLL = 1024;
+  static const unsigned SQ_ENTRIES = 256;
+  static const unsigned CQ_ENTRIES = 4096;
+
+  struct Slot {
+    Descriptor* descr;
+    int         fd;
+    uint32_t    gen;
+    bool        live;    // still polled for; delEvent() clears it
+    bool        armed;   // a poll request is in the kernel
+    bool        reading; // ditto, a read or accept request
+    bool        writing; // ditto, a write request
+    uint64_t    batch;   // poll() that last reported it
+    int         index;   // and where, in events_
+  };
+
+  struct Event {
+    Descriptor* descr;
+    uint32_t    mask;       // from the poll request
+    int         done;       // DP_READ_DONE and DP_WRITE_DONE
+    int         read_res;
+    int         write_res;
+  };
+
+  int ring_fd_;
+
+  // The rings, shared with the kernel.
+  void*                 sq_ring_;
+  size_t                sq_ring_size_;
+  void*                 cq_ring_;
+  size_t                cq_ring_size_;
+  struct io_uring_sqe*  sqes_;
+  size_t                sqes_size_;
+
+  unsigned*             sq_head_;
+  unsigned*             sq_ktail_;
+  unsigned              sq_mask_;
+  unsigned              sq_entries_;
+  unsigned              sq_tail_;    // ahead of *sq_ktail_ while filling
+  unsigned*             cq_head_;
+  unsigned*             cq_tail_;
+  unsigned              cq_mask_;
+  struct io_uring_cqe*  cqes_;
+
+  // Protects the submission queue, the completion queue and the
+  // slots. Requests wait to be submitted along with the next wait for
+  // completions, unless issued by another thread while poll() waits,
+  // in which case they go in right away.
+  Mutex                          m_ring_;
+  std::vector<Slot>              slots_;
+  std::vector<int>               free_slots_;
+  std::map<Descriptor*, int>     slot_of_;
+  pthread_t                      poll_thread_;
+  bool                           has_poll_thread_;
+  bool                           waiting_;   // poll() is in the kernel
+
+  uint64_t batch_;
+  int      num_events_;
+  Event    events_[MAX_FDS_PER_POLL];
+
+  bool setupRing();
+  bool probeMultishot();
+
+  // Returns a zeroed submission entry, making room if needed.
+  struct io_uring_sqe* getSqe();
+
+  // Makes the entries from getSqe() visible to the kernel.
+  void publish();
+
+  void submit();
+  bool inPollThread() const;
+
+  // Publishes the entries from getSqe() and, if poll() is waiting in
+  // another thread, submits them. Requires m_ring_.
+  void flush();
+
+  // Returns the slot of 'descr', or NULL if it isn't polled for.
+  // Requires m_ring_.
+  Slot* findSlot(Descriptor* descr);
+
+  uint64_t userData(const Slot* slot, RequestKind kind) const;
+  void prepPoll(int idx);
+  void prepRemove(uint64_t target);
+  void prepCancel(uint64_t target);
+  void freeSlot(int idx);
+
+  // Moves the available completions into events_.
+  void reap();
+  void addEvent(Slot* slot, uint32_t mask);
+  void addResult(Slot* slot, RequestKind kind, int res);
+  Event* eventFor(Slot* slot);
+};
+
+UringBackend::UringBackend()
+  : ring_fd_(-1),
+    sq_ring_(MAP_FAILED),
+    sq_ring_size_(0),
+    cq_ring_(MAP_FAILED),
+    cq_ring_size_(0),
+    sqes_(reinterpret_cast<struct io_uring_sqe*>(MAP_FAILED)),
+    sqes_size_(0),
+    sq_tail_(0),
+    has_poll_thread_(false),
+    waiting_(false),
+    batch_(0),
+    num_events_(0) {
+}
+
+UringBackend::~UringBackend() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ != -1) {
+    close(ring_fd_);
+  }
+}
+
+bool UringBackend::create() {
+  return setupRing() && probeMultishot();
+}
+
+bool UringBackend::setupRing() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = CQ_ENTRIES;
+  ring_fd_ = ioUringSetup(SQ_ENTRIES, &p);
+  if (ring_fd_ < 0) {
+    ring_fd_ = -1;
+    return false;
+  }
+
+  // We rely on the kernel keeping completions that overflow the ring
+  // and on waits with a timeout (5.11 and later).
+  const uint32_t needed = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+  if ((p.features & needed) != needed) {
+    return false;
+  }
+
+  sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    return false;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      return false;
+    }
+  }
+
+  sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = reinterpret_cast<struct io_uring_sqe*>(sqes);
+
+  char* sq = reinterpret_cast<char*>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  sq_ktail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  sq_entries_ = p.sq_entries;
+  sq_tail_ = *sq_ktail_;
+
+  // Entry i of the submission queue always uses the i-th sqe.
+  unsigned* array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; i++) {
+    array[i] = i;
+  }
+
+  char* cq = reinterpret_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+  return true;
+}
+
+bool UringBackend::probeMultishot() {
+  // Kernels before 5.13 reject multishot polls; check that one on an
+  // eventfd keeps going after it fires.
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  ScopedLock l(&m_ring_);
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = EPOLLIN | EPOLLET;
+  sqe->user_data = ProbeData;
+  publish();
+  submit();
+
+  const uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+    close(fd);
+    return false;
+  }
+
+  struct __kernel_timespec ts;
+  ts.tv_sec = 1;
+  ts.tv_nsec = 0;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = reinterpret_cast<uint64_t>(&ts);
+  int rc;
+  do {
+    countSyscall();
+    rc = ioUringEnter(ring_fd_, 0, 1,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                      &arg, sizeof(arg));
+  } while (rc < 0 && errno == EINTR);
+
+  bool multishot = false;
+  unsigned head = *cq_head_;
+  const unsigned tail = *cq_tail_;
+  __sync_synchronize();
+  for (; head != tail; head++) {
+    const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    if (cqe->user_data == ProbeData && cqe->res > 0 &&
+        (cqe->flags & IORING_CQE_F_MORE)) {
+      multishot = true;
+    }
+  }
+  __sync_synchronize();
+  *cq_head_ = head;
+
+  // The probe's remaining completions are ignored by reap().
+  if (multishot) {
+    prepRemove(ProbeData);
+    publish();
+    submit();
+  }
+  close(fd);
+  return multishot;
+}
+
+struct io_uring_sqe* UringBackend::getSqe() {
+  while (sq_tail_ - *(volatile unsigned*)sq_head_ == sq_entries_) {
+    publish();
+    submit();
+  }
+
+  struct io_uring_sqe* sqe = &sqes_[sq_tail_ & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_tail_++;
+  return sqe;
+}
+
+void UringBackend::publish() {
+  __sync_synchronize();
+  *(volatile unsigned*)sq_ktail_ = sq_tail_;
+}
+
+void UringBackend::submit() {
+  int rc;
+  do {
+    countSyscall();
+    rc = ioUringEnter(ring_fd_, sq_entries_, 0, 0, NULL, 0);
+  } while (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+  if (rc < 0) {
+    perror("Error in io_uring_enter ");
+    exit(1);
+  }
+}
+
+bool UringBackend::inPollThread() const {
+  return has_poll_thread_ && pthread_equal(poll_thread_, pthread_self());
+}
+
+void UringBackend::flush() {
+  publish();
+  if (waiting_ && !inPollThread()) {
+    submit();
+  }
+}
+
+UringBackend::Slot* UringBackend::findSlot(Descriptor* descr) {
+  std::map<Descriptor*, int>::iterator it = slot_of_.find(descr);
+  return it == slot_of_.end() ? NULL : &slots_[it->second];
+}
+
+uint64_t UringBackend::userData(const Slot* slot, RequestKind kind) const {
+  const uint64_t idx = slot - &slots_[0];
+  return (uint64_t(slot->gen) << 32) | (uint64_t(kind) << KindShift) | idx;
+}
+
+void UringBackend::prepPoll(int idx) {
+  Slot* slot = &slots_[idx];
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = slot->fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = PollMask;
+  sqe->user_data = userData(slot, POLL_REQUEST);
+  slot->armed = true;
+}
+
+void UringBackend::prepRemove(uint64_t target) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = RemoveData;
+}
+
+void UringBackend::prepCancel(uint64_t target) {
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = RemoveData;
+}
+
+void UringBackend::freeSlot(int idx) {
+  Slot* slot = &slots_[idx];
+  slot->descr = NULL;
+  slot->fd = -1;
+  slot->gen = (slot->gen + 1) & 0x7fffffff;
+  slot->armed = false;
+  slot->reading = false;
+  slot->writing = false;
+  free_slots_.push_back(idx);
+}
+
+void UringBackend::setEvent(int fd, Descriptor* descr) {
+  ScopedLock l(&m_ring_);
+
+  int idx;
+  if (free_slots_.empty()) {
+    idx = slots_.size();
+    Slot slot;
+    slot.gen = 0;
+    slot.batch = 0;
+    slot.index = 0;
+    slots_.push_back(slot);
+  } else {
+    idx = free_slots_.back();
+    free_slots_.pop_back();
+  }
+
+  Slot* slot = &slots_[idx];
+  slot->descr = descr;
+  slot->fd = fd;
+  slot->live = true;
+  slot->reading = false;
+  slot->writing = false;
+  slot_of_[descr] = idx;
+
+  prepPoll(idx);
+  flush();
+}
+
+void UringBackend::delEvent(Descriptor* descr) {
+  ScopedLock l(&m_ring_);
+
+  std::map<Descriptor*, int>::iterator it = slot_of_.find(descr);
+  if (it == slot_of_.end()) {
+    return;
+  }
+  const int idx = it->second;
+  slot_of_.erase(it);
+
+  // The requests hold on to the socket; removing them lets a closed
+  // socket go. Their completions are dropped from now on, and the
+  // slot is freed once the last one is in.
+  Slot* slot = &slots_[idx];
+  slot->live = false;
+  if (!slot->armed && !slot->reading && !slot->writing) {
+    freeSlot(idx);
+    return;
+  }
+
+  if (slot->armed) {
+    prepRemove(userData(slot, POLL_REQUEST));
+  }
+  if (slot->reading) {
+    prepCancel(userData(slot, READ_REQUEST));
+  }
+  if (slot->writing) {
+    prepCancel(userData(slot, WRITE_REQUEST));
+  }
+  flush();
+}
+
+bool UringBackend::submitReadv(Descriptor* descr,
+                               const struct iovec* iov,
+                               int iovcnt) {
+  ScopedLock l(&m_ring_);
+  Slot* slot = findSlot(descr);
+  if (slot == NULL || slot->reading) {
+    return false;
+  }
+
+  // The offset is ignored for sockets.
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = slot->fd;
+  sqe->addr = reinterpret_cast<uint64_t>(iov);
+  sqe->len = iovcnt;
+  sqe->user_data = userData(slot, READ_REQUEST);
+  slot->reading = true;
+  flush();
+  return true;
+}
+
+bool UringBackend::submitSendmsg(Descriptor* descr,
+                                 const struct msghdr* msg,
+                                 int flags) {
+  ScopedLock l(&m_ring_);
+  Slot* slot = findSlot(descr);
+  if (slot == NULL || slot->writing) {
+    return false;
+  }
+
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = slot->fd;
+  sqe->addr = reinterpret_cast<uint64_t>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = flags;
+  sqe->user_data = userData(slot, WRITE_REQUEST);
+  slot->writing = true;
+  flush();
+  return true;
+}
+
+bool UringBackend::submitAccept(Descriptor* descr) {
+  ScopedLock l(&m_ring_);
+  Slot* slot = findSlot(descr);
+  if (slot == NULL || slot->reading) {
+    return false;
+  }
+
+  // As accept() does, without asking for the peer's address.
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = slot->fd;
+  sqe->user_data = userData(slot, READ_REQUEST);
+  slot->reading = true;
+  flush();
+  return true;
+}
+
+int UringBackend::poll(int timeout_usec) {
+  if (!has_poll_thread_) {
+    poll_thread_ = pthread_self();
+    has_poll_thread_ = true;
+  }
+
+  // Completions left over from the previous poll() don't need a
+  // system call, unless there are requests to submit. Requests issued
+  // from now on, while the kernel waits, are submitted by whoever
+  // issues them.
+  m_ring_.lock();
+  const unsigned to_submit = sq_tail_ - *(volatile unsigned*)sq_head_;
+  const bool ready = *(volatile unsigned*)cq_tail_ != *cq_head_;
+  waiting_ = !ready || to_submit > 0;
+  m_ring_.unlock();
+
+  if (waiting_) {
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_usec / 1000000;
+    ts.tv_nsec = (timeout_usec % 1000000) * 1000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+    countSyscall();
+    int rc = ioUringEnter(ring_fd_, to_submit, 1,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                          &arg, sizeof(arg));
+
+    // Timing out or being interrupted just means fewer completions.
+    // A busy kernel still returns what it has.
+    if (rc < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      perror("Error in io_uring_enter ");
+      exit(1);
+    }
+  }
+
+  reap();
+  return num_events_;
+}
+
+void UringBackend::reap() {
+  ScopedLock l(&m_ring_);
+
+  waiting_ = false;
+  batch_++;
+  num_events_ = 0;
+
+  unsigned head = *cq_head_;
+  const unsigned tail = *(volatile unsigned*)cq_tail_;
+  __sync_synchronize();
+
+  for (; head != tail && num_events_ < MAX_FDS_PER_POLL; head++) {
+    const struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    const uint64_t data = cqe->user_data;
+    if (data == WakeupData || data == RemoveData || data == ProbeData) {
+      continue;
+    }
+
+    const int idx = data & IndexMask;
+    const RequestKind kind = RequestKind((data & 0xffffffff) >> KindShift);
+    Slot* slot = &slots_[idx];
+    if (slot->gen != (data >> 32)) {
+      continue;
+    }
+
+    if (kind != POLL_REQUEST) {
+      if (kind == READ_REQUEST) {
+        slot->reading = false;
+      } else {
+        slot->writing = false;
+      }
+      if (slot->live) {
+        addResult(slot, kind, cqe->res);
+      } else if (!slot->armed && !slot->reading && !slot->writing) {
+        freeSlot(idx);
+      }
+      continue;
+    }
+
+    if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+      slot->armed = false;
+      if (!slot->live) {
+        if (!slot->reading && !slot->writing) {
+          freeSlot(idx);
+        }
+        continue;
+      }
+
+      // The kernel may end a multishot poll, e.g., when the
+      // completion queue overflows. Unless it failed, put it back.
+      if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        addEvent(slot, EPOLLERR);
+        continue;
+      }
+      prepPoll(idx);
+      publish();
+    }
+
+    if (slot->live && cqe->res > 0) {
+      addEvent(slot, cqe->res);
+    }
+  }
+
+  __sync_synchronize();
+  *(volatile unsigned*)cq_head_ = head;
+}
+
+UringBackend::Event* UringBackend::eventFor(Slot* slot) {
+  // A descriptor may complete several times in a batch: once per
+  // wakeup of its poll and once per request. We report it once, as
+  // epoll would.
+  if (slot->batch == batch_) {
+    return &events_[slot->index];
+  }
+
+  slot->batch = batch_;
+  slot->index = num_events_;
+  Event* event = &events_[num_events_++];
+  event->descr = slot->descr;
+  event->mask = 0;
+  event->done = 0;
+  return event;
+}
+
+void UringBackend::addEvent(Slot* slot, uint32_t mask) {
+  eventFor(slot)->mask |= mask;
+}
+
+void UringBackend::addResult(Slot* slot, RequestKind kind, int res) {
+  // There is one request per direction in the kernel at a time, so
+  // at most one result of each in a batch.
+  Event* event = eventFor(slot);
+  if (kind == READ_REQUEST) {
+    event->done |= DescriptorPoller::DP_READ_DONE;
+    event->read_res = res;
+  } else {
+    event->done |= DescriptorPoller::DP_WRITE_DONE;
+    event->write_res = res;
+  }
+}
+
+void UringBackend::wakeup() {
+  // A no-op request completes right away and ends the wait.
+  ScopedLock l(&m_ring_);
+  struct io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_NOP;
+  sqe->user_data = WakeupData;
+  publish();
+  submit();
+}
+
+void UringBackend::getEvents(int i, int* events, Descriptor** descr) {
+  *events &= 0x00000000;
+  *events |= events_[i].done;
+  *descr = events_[i].descr;
+
+  if (events_[i].mask & EPOLLERR) {
+    *events |= DescriptorPoller::DP_ERROR;
+    return;
+  }
+
+  if (events_[i].mask & (EPOLLHUP | EPOLLIN)) {
+    *events |= DescriptorPoller::DP_READ_READY;
+  }
+  if (events_[i].mask & (EPOLLHUP | EPOLLOUT)) {
+    *events |= DescriptorPoller::DP_WRITE_READY;
+  }
+}
+
+int UringBackend::getResult(int i, int done) {
+  return done == DescriptorPoller::DP_READ_DONE ? events_[i].read_res
+                                                : events_[i].write_res;
+}
+
+}  // unnamed namespace
+
+PollerBackend* newUringBackend() {
+  return new UringBackend;
+}
+
+#else  // !__NR_io_uring_setup
+
+PollerBackend* newUringBackend() {
+  return NULL;
+}
+
+#endif  // __NR_io_uring_setup
+
+}  // namespace base
+
+#endif  // LINUX
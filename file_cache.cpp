@@ -1,9 +1,15 @@
+#include <algorithm>
+
 #include "file_cache.hpp"
 #include "logging.hpp"
 
 
 namespace base {
 
+// Cached files are held in chunks of up to this size. Most files fit
+// in a single chunk, and thus in a single iovec when sent.
+static const size_t MaxFileChunk = 2 << 20;
+
 FileCache::FileCache(int max_size) : max_size_(max_size),
   bytes_used_(0), num_pins_(0), num_hits_(0), num_failed_(0) {}
 
@@ -127,10 +133,13 @@ Buffer* FileCache::loadFileToBuffer(const string& file_name) {
   fstat(fd, &stat_buf);
 
   size_t to_read = stat_buf.st_size;
-  Buffer* buf = new Buffer();
+  const size_t chunk_size = std::max(std::min(to_read, MaxFileChunk),
+                                     size_t(Buffer::BlockSize));
+  Buffer* buf = new Buffer(chunk_size);
   while(to_read > 0) {
-    buf->reserve(buf->BlockSize);
-    int bytes_read = read(fd, buf->writePtr(), buf->writeSize());
+    buf->reserve(buf->chunkSize());
+    const size_t len = std::min(buf->writeSize(), to_read);
+    int bytes_read = read(fd, buf->writePtr(), len);
 
     if (bytes_read < 0) {
       LOG(LogMessage::ERROR) << "could not read file " <<file_name
@@ -140,13 +149,16 @@ Buffer* FileCache::loadFileToBuffer(const string& file_name) {
       return NULL;
     }
 
+    if (bytes_read == 0) {
+      break;
+    }
+    buf->advance(bytes_read);
     to_read -= bytes_read;
   }
 
   if (to_read != 0) {
     LOG(LogMessage::WARNING) << "file change while reading " << file_name;
   }
-  buf->advance(stat_buf.st_size - to_read);
   close(fd);
   return buf;
 }
@@ -1,7 +1,7 @@
 #include <fcntl.h>    // O_RDONLY
 #include <stdio.h>    // perror
 #include <stdlib.h>   // exit
-#include <sstream>
+#include <string.h>   // memcpy, strlen
 #include <sys/stat.h> // fstat
 #include <unistd.h>   // read, write, close
 
@@ -9,16 +9,19 @@
 #include "http_connection.hpp"
 #include "http_parser.hpp"
 #include "http_response.hpp"
+#include "http_response_writer.hpp"
 #include "logging.hpp"
+#include "memory_budget.hpp"
 #include "request_stats.hpp"
 #include "thread_pool_fast.hpp"
 #include "ticks_clock.hpp"
 
 namespace http {
 
-using std::ostringstream;
 using base::Buffer;
+using base::MemPiece;
 using base::FileCache;
+using base::MemoryBudget;
 using base::RequestStats;
 using base::ThreadPoolFast;
 using base::TicksClock;
@@ -27,6 +30,7 @@ HTTPServerConnection::HTTPServerConnection(HTTPService* service, int client_fd)
   : Connection(service->service_manager()->io_manager(), client_fd),
     my_service_(service),
     file_cache_(service->file_cache()) {
+  setTimeouts(service->timeouts());
   startRead();
 }
 
@@ -45,14 +49,35 @@ bool HTTPServerConnection::readDone() {
       return true;
 
     } else /* rc == 0 */ {
-      in_.consume(it.bytesRead());
+      // request_ refers to the input, so consume it only after the
+      // request was handled
       if (! handleRequest(&request_)) {
         return false;
       }
+      in_.consume(it.bytesRead());
+
+      // Leave any further requests for when the responses so far
+      // have been sent, if they took up the memory budget.
+      if (outputOverBudget()) {
+        return true;
+      }
     }
   }
 }
 
+// Writes "<name> <value>\r\n" at 'p' and returns the position past
+// it.
+static char* appendCounter(const char* name, uint64_t value, char* p) {
+  const size_t name_len = strlen(name);
+  memcpy(p, name, name_len);
+  p += name_len;
+  *p++ = ' ';
+  p += ResponseWriter::formatUint(value, p);
+  *p++ = '\r';
+  *p++ = '\n';
+  return p;
+}
+
 bool HTTPServerConnection::handleRequest(Request* request) {
   // This is a way to remotely shutdown the Server to which this
   // connection belongs.
@@ -66,23 +91,77 @@ bool HTTPServerConnection::handleRequest(Request* request) {
   if (request_.address == "stats") {
     uint32_t reqsLastSec;
     stats->getStats(TicksClock::getTicks(), &reqsLastSec);
-    ostringstream stats_stream;
-    stats_stream << reqsLastSec;
-    string stats_string = stats_stream.str();
+    char stats_string[ResponseWriter::MaxDigits];
+    const size_t stats_len =
+      ResponseWriter::formatUint(reqsLastSec, stats_string);
+
+    m_write_.lock();
+
+    ResponseWriter writer(&out_);
+    writer.statusLine(ResponseWriter::OK);
+    writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+    writer.header("Server", "Lab02a");
+    writer.header("Accept-Ranges", "bytes");
+    writer.header("Content-Length", stats_len);
+    writer.header("Content-Type", "text/html");
+    writer.endHeaders();
+    writer.body(MemPiece(stats_string, stats_len));
+
+    m_write_.unlock();
+
+    startWrite();
+    return true;
+  }
+
+  if (request_.address == "memstats") {
+    MemoryBudget::Stats mem;
+    memoryBudget()->getStats(&mem);
+    char page[256];
+    char* p = page;
+    p = appendCounter("bytes", mem.bytes, p);
+    p = appendCounter("peak_bytes", mem.peak_bytes, p);
+    p = appendCounter("pauses", mem.pauses, p);
+    p = appendCounter("resumes", mem.resumes, p);
+    p = appendCounter("overflows", mem.overflows, p);
+    const size_t page_len = p - page;
 
     m_write_.lock();
 
-    out_.write("HTTP/1.1 200 OK\r\n");
-    out_.write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
-    out_.write("Server: Lab02a\r\n");
-    out_.write("Accept-Ranges: bytes\r\n");
+    ResponseWriter writer(&out_);
+    writer.statusLine(ResponseWriter::OK);
+    writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+    writer.header("Server", "Lab02a");
+    writer.header("Content-Length", page_len);
+    writer.header("Content-Type", "text/plain");
+    writer.endHeaders();
+    writer.body(MemPiece(page, page_len));
+
+    m_write_.unlock();
+
+    startWrite();
+    return true;
+  }
+
+  if (request_.address == "connstats") {
+    Connection::ReapStats reaped;
+    Connection::getReapStats(&reaped);
+    char page[256];
+    char* p = page;
+    p = appendCounter("idle_reaped", reaped.idle, p);
+    p = appendCounter("header_read_reaped", reaped.header_read, p);
+    p = appendCounter("write_stall_reaped", reaped.write_stall, p);
+    const size_t page_len = p - page;
 
-    ostringstream os;
-    os << "Content-Length: " << stats_string.size() << "\r\n";
-    out_.write(os.str().c_str());
-    out_.write("Content-Type: text/html\r\n");
-    out_.write("\r\n");
-    out_.write(stats_string.c_str());
+    m_write_.lock();
+
+    ResponseWriter writer(&out_);
+    writer.statusLine(ResponseWriter::OK);
+    writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+    writer.header("Server", "Lab02a");
+    writer.header("Content-Length", page_len);
+    writer.header("Content-Type", "text/plain");
+    writer.endHeaders();
+    writer.body(MemPiece(page, page_len));
 
     m_write_.unlock();
 
@@ -99,27 +178,31 @@ bool HTTPServerConnection::handleRequest(Request* request) {
   // Grab from or load the file to the cache.
   Buffer* buf;
   int error;
-  FileCache::CacheHandle h = file_cache_->pin(request_.address, &buf, & error);
+  FileCache::CacheHandle h = file_cache_->pin(request_.address.toString(),
+                                              &buf,
+                                              &error);
 
   if (h != 0) {
     m_write_.lock();
 
-    out_.write("HTTP/1.1 200 OK\r\n");
-    out_.write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
-    out_.write("Server: Lab02a\r\n");
-    out_.write("Accept-Ranges: bytes\r\n");
-
-    ostringstream os;
-    os << "Content-Length: " << buf->readSize() << "\r\n";
-    out_.write(os.str().c_str());
-    out_.write("Content-Type: text/html\r\n");
-    out_.write("\r\n");
+    ResponseWriter writer(&out_);
+    writer.statusLine(ResponseWriter::OK);
+    writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+    writer.header("Server", "Lab02a");
+    writer.header("Accept-Ranges", "bytes");
+    writer.header("Content-Length", buf->byteCount());
+    writer.header("Content-Type", "text/html");
+    writer.endHeaders();
 
-    // Copy from cache into the connection buffer.
-    out_.copyFrom(buf);
+    // Link the cached chunks into the connection buffer. No copying
+    // is done; the chunks are reference counted, so the file can be
+    // unpinned (and even evicted) while the response is in flight.
+    out_.shareFrom(buf);
 
     m_write_.unlock();
 
+    file_cache_->unpin(h);
+
   } else {
 
     // TODO
@@ -131,26 +214,23 @@ bool HTTPServerConnection::handleRequest(Request* request) {
 
     m_write_.lock();
 
-    ostringstream html_stream;
-    html_stream <<"<HTML>\r\n";
-    html_stream <<"<HEAD><TITLE>400 Bad Request</TITLE></HEAD>\r\n";
-    html_stream <<"<BODY>Bad Request</BODY>\r\n";
-    html_stream <<"</HTML>\r\n";
-    html_stream <<"\r\n";
-
-    ostringstream os;
-    os << "Content-Length: " << html_stream.str().size() << "\r\n";
-
-    out_.write("HTTP/1.1 503 Bad Request\r\n");
-    out_.write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
-    out_.write("Server: MyServer\r\n");
-    out_.write("Connection: close\r\n");
-    out_.write("Transfer-Encoding: chunked\r\n");
-    out_.write(os.str().c_str());
-    out_.write("Content-Type: text/html; charset=iso-8859-1\r\n");
-    out_.write("\r\n");
-
-    out_.write(html_stream.str().c_str());
+    static const char html[] =
+      "<HTML>\r\n"
+      "<HEAD><TITLE>400 Bad Request</TITLE></HEAD>\r\n"
+      "<BODY>Bad Request</BODY>\r\n"
+      "</HTML>\r\n"
+      "\r\n";
+    const size_t html_len = sizeof(html) - 1;
+
+    ResponseWriter writer(&out_);
+    writer.statusLine(ResponseWriter::BAD_REQUEST);
+    writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+    writer.header("Server", "MyServer");
+    writer.header("Connection", "close");
+    writer.header("Content-Length", html_len);
+    writer.header("Content-Type", "text/html; charset=iso-8859-1");
+    writer.endHeaders();
+    writer.body(MemPiece(html, html_len));
 
     m_write_.unlock();
 
@@ -27,8 +27,6 @@ int Parser::parseRequest(Buffer::Iterator* in, Request* request) {
   // Host: localhost
   // <empty line>
 
-  string dummy;
-
   try {
     parseString(in, &request->method);
     skipChar(in, ' ');
@@ -37,12 +35,7 @@ int Parser::parseRequest(Buffer::Iterator* in, Request* request) {
     skipChar(in, ' ');
     parseString(in, &request->version);
     skipNewLine(in);
-
-    while (true) {
-      dummy.clear();
-      parseLine(in, &dummy);
-      if (dummy.size() == 0) break;
-    }
+    skipHeaders(in);
 
     return 0;
   }
@@ -102,35 +95,34 @@ int Parser::parseResponse(Buffer::Iterator* in, Response* response) {
   }
 }
 
-void Parser::parseString(Buffer::Iterator* in, string* res) {
-  if (in->eob()) throw IncompleteInput();
-  while (!in->eob()) {
-    const char c = in->getChar();
-    if (c == ' ') break;
-    if (c == '\r') break;
-    res->push_back(c);
-    in->next();
-  }
+void Parser::parseString(Buffer::Iterator* in, BufferSlice* res) {
   if (in->eob()) throw IncompleteInput();
+  if (! in->sliceTo(' ', '\r', res)) throw IncompleteInput();
 }
 
 void Parser::parseLine(Buffer::Iterator* in, string* res) {
   if (in->eob()) throw IncompleteInput();
-  while (!in->eob()) {
-    const char c = in->getChar();
-    if (c == '\r') {
-      in->next();
-      if (in->getChar() == '\n') {
-        in->next();
-        return;
-      } else {
-        throw ErrorInRequest();
-      }
-    }
-    res->push_back(c);
+  if (! in->findChar('\r', '\r', res)) throw IncompleteInput();
+  in->next();
+  if (in->eob()) throw IncompleteInput();
+  if (in->getChar() != '\n') throw ErrorInRequest();
+  in->next();
+}
+
+void Parser::skipHeaders(Buffer::Iterator* in) {
+  // The request line may be followed directly by the empty line.
+  if (in->eob()) throw IncompleteInput();
+  if (in->getChar() == '\r') {
+    skipNewLine(in);
+    return;
+  }
+
+  // Otherwise skip all header lines in one go, up to and including
+  // the empty line that ends them.
+  if (! in->findString("\r\n\r\n")) throw IncompleteInput();
+  for (int i = 0; i < 4; i++) {
     in->next();
   }
-  if (in->eob()) throw IncompleteInput();
 }
 
 void Parser::skipChar(Buffer::Iterator* in, char skip) {
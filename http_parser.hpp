@@ -4,11 +4,13 @@
 #include <string>
 
 #include "buffer.hpp"
+#include "buffer_slice.hpp"
 
 namespace http {
 
 using std::string;
 using base::Buffer;
+using base::BufferSlice;
 
 class Request;
 class Response;
@@ -23,10 +25,11 @@ private:
   struct IncompleteInput {};
   struct ErrorInRequest {};
 
-  static void parseString(Buffer::Iterator* in, string* res);
+  static void parseString(Buffer::Iterator* in, BufferSlice* res);
   static void parseLine(Buffer::Iterator* in, string* res);
   static void skipChar(Buffer::Iterator* in, char skip);
   static void skipNewLine(Buffer::Iterator* in);
+  static void skipHeaders(Buffer::Iterator* in);
   static bool isEmptyLine(string line);
 
   Parser() {}
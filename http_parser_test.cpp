@@ -72,6 +72,72 @@ TEST(SingleRequest, Incomplete) {
   EXPECT_EQ(read_string, "ABC");
 }
 
+TEST(SingleRequest, StraddlingChunks) {
+  // Move the request across a chunk boundary one byte at a time, so
+  // that every delimiter gets split at some point.
+  const string request("GET /x.html HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  for (size_t split = 1; split < request.size(); split++) {
+    Buffer buf;
+    buf.write(string(Buffer::BlockSize - split, 'P'));
+    buf.consume(Buffer::BlockSize - split);
+    buf.write(request.c_str());
+
+    Request req;
+    Buffer::Iterator it(buf.begin());
+    EXPECT_EQ(Parser::parseRequest(&it, &req), 0);
+    EXPECT_EQ(req.address, "x.html");
+    EXPECT_EQ(req.version, "HTTP/1.1");
+    EXPECT_TRUE(it.eob());
+  }
+}
+
+TEST(SingleRequest, IncompleteAtCR) {
+  Buffer buf;
+  buf.write("GET /x.html HTTP/1.1\r\nHost: localhost\r");
+
+  Request req;
+  Buffer::Iterator it(buf.begin());
+  EXPECT_EQ(Parser::parseRequest(&it, &req), +1);
+
+  buf.write("\n\r\n");
+  Buffer::Iterator another_it(buf.begin());
+  EXPECT_EQ(Parser::parseRequest(&another_it, &req), 0);
+  EXPECT_TRUE(another_it.eob());
+}
+
+TEST(SingleRequest, FieldsReferToInput) {
+  Buffer buf;
+  buf.write("GET /x.html HTTP/1.1\r\n\r\n");
+
+  Request req;
+  Buffer::Iterator it(buf.begin());
+  EXPECT_EQ(Parser::parseRequest(&it, &req), 0);
+  EXPECT_TRUE(req.address.data() == buf.readPtr() + 5);
+  EXPECT_EQ(req.address, "x.html");
+}
+
+TEST(SingleRequest, FieldAcrossChunks) {
+  // the address starts in one chunk and ends in the next
+  Buffer buf;
+  buf.write(string(Buffer::BlockSize - 8, 'P'));
+  buf.consume(Buffer::BlockSize - 8);
+  buf.write("GET /index.html HTTP/1.1\r\n\r\n");
+
+  Request req;
+  Buffer::Iterator it(buf.begin());
+  EXPECT_EQ(Parser::parseRequest(&it, &req), 0);
+  EXPECT_EQ(req.method, "GET");
+  EXPECT_EQ(req.address, "index.html");
+  EXPECT_EQ(req.version, "HTTP/1.1");
+
+  // the gathered field, and copies of it, outlive the input
+  Request copy;
+  copy.cloneFrom(req);
+  buf.consume(it.bytesRead());
+  buf.write(string(Buffer::BlockSize, 'Q'));
+  EXPECT_EQ(copy.address, "index.html");
+}
+
 } // unnamed namespace
 
 int main(int argc, char *argv[]) {
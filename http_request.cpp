@@ -4,6 +4,7 @@
 namespace http {
 
 using base::Buffer;
+using base::MemPiece;
 
 void Request::clear() {
   method.clear();
@@ -18,11 +19,11 @@ void Request::cloneFrom(const Request& other) {
 }
 
 void Request::toBuffer(Buffer* out) const {
-  out->write(method.c_str());
+  out->write(MemPiece(method.data(), method.size()));
   out->write(" ");
-  out->write(address.c_str());
+  out->write(MemPiece(address.data(), address.size()));
   out->write(" ");
-  out->write(version.c_str());
+  out->write(MemPiece(version.data(), version.size()));
   out->write("\r\n\r\n");
 }
 
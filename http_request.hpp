@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "buffer_slice.hpp"
+
 namespace base {
 class Buffer;
 }
@@ -11,11 +13,15 @@ namespace http {
 
 using std::string;
 using base::Buffer;
+using base::BufferSlice;
 
+// The fields of a parsed Request refer to the input Buffer's
+// contents (see BufferSlice). They are valid only until that input
+// is consumed.
 struct Request {
-  string method;
-  string address;
-  string version;
+  BufferSlice method;
+  BufferSlice address;
+  BufferSlice version;
 
   void clear();
   void cloneFrom(const Request& other);
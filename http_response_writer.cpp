@@ -0,0 +1,100 @@
+#include <string.h>  // memcpy
+
+#include "http_response_writer.hpp"
+
+namespace http {
+
+// Status lines, ready to be copied out. Indexed by
+// ResponseWriter::Status.
+struct StatusLine {
+  const char* text;
+  size_t      len;
+};
+
+#define STATUS_LINE(s) { s, sizeof(s) - 1 }
+
+static const StatusLine status_lines[ResponseWriter::NUM_STATUS] = {
+  STATUS_LINE("HTTP/1.1 200 OK\r\n"),
+  STATUS_LINE("HTTP/1.1 400 Bad Request\r\n"),
+  STATUS_LINE("HTTP/1.1 404 Not Found\r\n"),
+  STATUS_LINE("HTTP/1.1 500 Internal Server Error\r\n"),
+  STATUS_LINE("HTTP/1.1 503 Service Unavailable\r\n")
+};
+
+#undef STATUS_LINE
+
+// Two digits at a time: the digits of 'n' are at [2*n, 2*n+1].
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Header lines up to this size are assembled on the stack and
+// written at once. Longer ones go out piece by piece.
+static const size_t MaxHeaderLine = 256;
+
+void ResponseWriter::statusLine(Status status) {
+  const StatusLine& line = status_lines[status];
+  out_->write(MemPiece(line.text, line.len));
+}
+
+void ResponseWriter::header(const MemPiece& name, const MemPiece& value) {
+  const size_t len = name.len() + value.len() + 4;
+  if (len > MaxHeaderLine) {
+    out_->write(name);
+    out_->write(MemPiece(": ", 2));
+    out_->write(value);
+    out_->write(MemPiece("\r\n", 2));
+    return;
+  }
+
+  char line[MaxHeaderLine];
+  char* p = line;
+  memcpy(p, name.ptr(), name.len());
+  p += name.len();
+  *p++ = ':';
+  *p++ = ' ';
+  memcpy(p, value.ptr(), value.len());
+  p += value.len();
+  *p++ = '\r';
+  *p++ = '\n';
+  out_->write(MemPiece(line, len));
+}
+
+void ResponseWriter::header(const MemPiece& name, uint64_t value) {
+  char digits[MaxDigits];
+  const size_t len = formatUint(value, digits);
+  header(name, MemPiece(digits, len));
+}
+
+size_t ResponseWriter::formatUint(uint64_t value, char* dest) {
+  // fill a scratch area from its end, then copy the digits over
+  char scratch[MaxDigits];
+  char* p = scratch + MaxDigits;
+  while (value >= 100) {
+    const int pair = (value % 100) * 2;
+    value /= 100;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  }
+  if (value >= 10) {
+    const int pair = value * 2;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  } else {
+    *--p = '0' + value;
+  }
+
+  const size_t len = scratch + MaxDigits - p;
+  memcpy(dest, p, len);
+  return len;
+}
+
+}  // namespace http
@@ -0,0 +1,74 @@
+#ifndef MCP_HTTP_RESPONSE_WRITER_HEADER
+#define MCP_HTTP_RESPONSE_WRITER_HEADER
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "buffer.hpp"
+#include "mem_piece.hpp"
+
+namespace http {
+
+using base::Buffer;
+using base::MemPiece;
+
+// A ResponseWriter appends the parts of an HTTP response to a
+// Buffer, in order. It does no allocations of its own: status lines
+// come from a table, numbers are formatted on the stack, and each
+// header line reaches the Buffer with a single write().
+//
+// Usage:
+//
+//   ResponseWriter writer(&out_);
+//   writer.statusLine(ResponseWriter::OK);
+//   writer.header("Content-Type", "text/html");
+//   writer.header("Content-Length", body.size());
+//   writer.endHeaders();
+//   writer.body(body);
+//
+// The caller is responsible for any locking 'out' requires.
+class ResponseWriter {
+public:
+  enum Status {
+    OK,                   // 200
+    BAD_REQUEST,          // 400
+    NOT_FOUND,            // 404
+    INTERNAL_ERROR,       // 500
+    SERVICE_UNAVAILABLE,  // 503
+    NUM_STATUS
+  };
+
+  // Largest number of digits formatUint() may produce.
+  enum { MaxDigits = 20 };
+
+  explicit ResponseWriter(Buffer* out) : out_(out) {}
+  ~ResponseWriter() {}
+
+  // Writes "HTTP/1.1 <code> <reason>\r\n".
+  void statusLine(Status status);
+
+  // Writes "<name>: <value>\r\n".
+  void header(const MemPiece& name, const MemPiece& value);
+  void header(const MemPiece& name, uint64_t value);
+
+  // Writes the empty line that separates the headers from the body.
+  void endHeaders()                  { out_->write(MemPiece("\r\n", 2)); }
+
+  void body(const MemPiece& data)    { out_->write(data); }
+
+  // Writes the decimal representation of 'value' at 'dest', which
+  // must have room for MaxDigits characters, and returns its length.
+  // No terminating null is written.
+  static size_t formatUint(uint64_t value, char* dest);
+
+private:
+  Buffer* out_;  // not owned here
+
+  // Non-copyable, non-assignable
+  ResponseWriter(const ResponseWriter&);
+  ResponseWriter& operator=(const ResponseWriter&);
+};
+
+}  // namespace http
+
+#endif  // MCP_HTTP_RESPONSE_WRITER_HEADER
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "buffer.hpp"
+#include "http_response_writer.hpp"
+#include "timer.hpp"
+
+// Builds the response the KV server sends for a key lookup, over and
+// over, on a single core. The "ostringstream" version is how the
+// connections used to do it; the "ResponseWriter" version is how they
+// do it now. Each response is consumed right after it is built, as if
+// it had been sent.
+
+namespace {
+
+using base::Buffer;
+using base::MemPiece;
+using base::Timer;
+using http::ResponseWriter;
+using std::ostringstream;
+using std::string;
+
+const int NumResponses = 2000000;
+
+void streamResponse(unsigned value, Buffer* out) {
+  ostringstream value_stream;
+  value_stream << value;
+  out->write("HTTP/1.1 200 OK\r\n");
+  out->write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
+  out->write("Server: Lab02a\r\n");
+  out->write("Accept-Ranges: bytes\r\n");
+
+  ostringstream os;
+  os << "Content-Length: " << value_stream.str().size() << "\r\n";
+  out->write(os.str().c_str());
+  out->write("Content-Type: text/html\r\n");
+  out->write("\r\n");
+
+  out->write(value_stream.str().c_str());
+}
+
+void writerResponse(unsigned value, Buffer* out) {
+  char value_string[ResponseWriter::MaxDigits];
+  const size_t value_len = ResponseWriter::formatUint(value, value_string);
+
+  ResponseWriter writer(out);
+  writer.statusLine(ResponseWriter::OK);
+  writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+  writer.header("Server", "Lab02a");
+  writer.header("Accept-Ranges", "bytes");
+  writer.header("Content-Length", value_len);
+  writer.header("Content-Type", "text/html");
+  writer.endHeaders();
+  writer.body(MemPiece(value_string, value_len));
+}
+
+void runBenchmark(const char* name, void (*respond)(unsigned, Buffer*)) {
+  Buffer out;
+  size_t bytes = 0;
+
+  Timer timer;
+  timer.start();
+
+  for (int i = 0; i < NumResponses; i++) {
+    respond(i * 7919u, &out);
+    bytes += out.byteCount();
+    out.consume(out.byteCount());
+  }
+
+  timer.end();
+  std::cout << name << ":\t" << NumResponses / timer.elapsed()
+            << " responses/sec (" << bytes / NumResponses
+            << " bytes each)" << std::endl;
+}
+
+}  // unnamed namespace
+
+int main(int argc, char* argv[]) {
+  runBenchmark("ostringstream", streamResponse);
+  runBenchmark("ResponseWriter", writerResponse);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <string>
+
+#include "buffer.hpp"
+#include "http_response_writer.hpp"
+#include "test_unit.hpp"
+
+namespace {
+
+using std::string;
+
+using base::Buffer;
+using http::ResponseWriter;
+
+string formatted(uint64_t value) {
+  char digits[ResponseWriter::MaxDigits];
+  return string(digits, ResponseWriter::formatUint(value, digits));
+}
+
+string contents(Buffer* buf) {
+  string res;
+  for (Buffer::Iterator it = buf->begin(); !it.eob(); it.next()) {
+    res.push_back(it.getChar());
+  }
+  return res;
+}
+
+TEST(FormatUint, Boundaries) {
+  EXPECT_EQ(formatted(0), "0");
+  EXPECT_EQ(formatted(9), "9");
+  EXPECT_EQ(formatted(10), "10");
+  EXPECT_EQ(formatted(99), "99");
+  EXPECT_EQ(formatted(100), "100");
+  EXPECT_EQ(formatted(4096), "4096");
+  EXPECT_EQ(formatted(1234567), "1234567");
+  EXPECT_EQ(formatted(18446744073709551615ULL), "18446744073709551615");
+}
+
+TEST(Response, Complete) {
+  Buffer buf;
+  ResponseWriter writer(&buf);
+  writer.statusLine(ResponseWriter::NOT_FOUND);
+  writer.header("Content-Type", "text/html");
+  writer.header("Content-Length", 5);
+  writer.endHeaders();
+  writer.body("hello");
+
+  EXPECT_EQ(contents(&buf), "HTTP/1.1 404 Not Found\r\n"
+                            "Content-Type: text/html\r\n"
+                            "Content-Length: 5\r\n"
+                            "\r\n"
+                            "hello");
+}
+
+TEST(Response, LongHeader) {
+  Buffer buf;
+  ResponseWriter writer(&buf);
+  const string value(1000, 'v');
+  writer.header("X-Long", value);
+
+  EXPECT_EQ(contents(&buf), "X-Long: " + value + "\r\n");
+}
+
+} // unnamed namespace
+
+int main(int argc, char *argv[]) {
+  return RUN_TESTS(argc, argv);
+}
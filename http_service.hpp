@@ -3,6 +3,7 @@
 
 #include <string>
 
+#include "connection.hpp"
 #include "lock.hpp"
 #include "file_cache.hpp"
 #include "request_stats.hpp"
@@ -12,6 +13,7 @@ namespace http {
 
 using std::string;
 using base::AcceptCallback;
+using base::Connection;
 using base::FileCache;
 using base::Notification;
 using base::RequestStats;
@@ -29,8 +31,11 @@ typedef base::Callback<void, Response*> ResponseCallback;
 // There are some HTTP documents that perform special tasks.  The
 // ServiceManager can be stopped by issuing a '/quit' HTTP GET
 // request. The '/stat' documet would return a statistics page for the
-// underlying ServiceManager. Any other request attempt would result
-// in trying to read a file from disk with that document name.
+// underlying ServiceManager, '/memstats' the counters of the memory
+// budget connections charge their buffers to, and '/connstats' how
+// many connections were reaped for going over their timeouts. Any
+// other request attempt would result in trying to read a file from
+// disk with that document name.
 class HTTPService {
 public:
   // Starts a listening HTTP service at 'port'. A HTTP service
@@ -49,6 +54,12 @@ public:
   // Asks the service manager to stop all the registered services.
   void stop();
 
+  // Sets the timeouts of the server connections accepted from now on
+  // (see Connection::Timeouts). None, by default.
+  void setTimeouts(const Connection::Timeouts& timeouts) {
+    timeouts_ = timeouts;
+  }
+
   // Client side
 
   // Tries to connect to 'host:port' and issues 'cb' with the
@@ -65,11 +76,13 @@ public:
   RequestStats* stats() { return &stats_; }
   ServiceManager* service_manager() { return service_manager_; }
   FileCache* file_cache() { return &file_cache_; }
+  const Connection::Timeouts& timeouts() const { return timeouts_; }
 
 private:
   ServiceManager* service_manager_;  // not owned here
   RequestStats    stats_;
   FileCache       file_cache_;
+  Connection::Timeouts timeouts_;
 
   // Starts the server-side of a new HTTP connection established on
   // socket 'client_fd'.
@@ -4,30 +4,127 @@
 #include <stdio.h>     // perror
 #include <stdlib.h>    // exit
 
+#include <algorithm>
+
 #include "descriptor_poller.hpp"
 #include "io_manager.hpp"
 #include "logging.hpp"
 #include "thread.hpp"
 #include "thread_pool_fast.hpp"
+#include "thread_pool_stealing.hpp"
 
 namespace base {
 
-using std::make_pair;
 using base::makeCallableMany;
 
-IOManager::IOManager(int num_workers)
-  : poller_(new DescriptorPoller),
-    worker_pool_(new ThreadPoolFast(num_workers)),
-    deleted_desc_(NULL),
+// How long a reactor may run upcalls inline in each polling
+// iteration, unless setInlineBudget() says otherwise.
+static const double DefaultInlineBudget = 0.0002;  // 200us
+
+const double IOManager::TimerResolution = 0.0001;  // 100us
+
+IOManager::PoolType IOManager::default_pool_ = IOManager::FAST;
+
+IOManager::Reactor::Reactor(int reactor_id)
+  : id(reactor_id),
+    poller(new DescriptorPoller),
+    poll_thread(0),
+    worker_pool(NULL),
+    load(0),
+    slot(0),
+    inline_ticks(0),
+    retired(NULL),
+    limbo(NULL),
+    timers(TicksClock::getTicks(),
+           TimerResolution * TicksClock::ticksPerSecond()),
+    wake_at(0) {
+  poller->create();
+}
+
+IOManager::Reactor::~Reactor() {
+  for (size_t i = 0; i < posted.size(); i++) {
+    if (posted[i]->once()) {
+      delete posted[i];
+    }
+  }
+  delete poller;
+}
+
+IOManager::IOManager(int num_workers,
+                     int num_reactors,
+                     Placement placement,
+                     bool worker_group_per_reactor)
+  : num_workers_(num_workers),
+    placement_(placement),
+    next_reactor_(0),
     stopped_(false),
-    polling_(false) {
-  poller_->create();
+    polling_(0) {
+  num_reactors = std::max(std::min(num_reactors, int(MaxReactors)), 1);
+  if (worker_group_per_reactor) {
+    num_reactors = std::max(std::min(num_reactors, num_workers), 1);
+  }
+
+  int first_worker = 0;
+  for (int i = 0; i < num_reactors; i++) {
+    Reactor* reactor = new Reactor(i);
+    if (worker_group_per_reactor) {
+      const int group_size = num_workers / num_reactors +
+                             (i < num_workers % num_reactors ? 1 : 0);
+      pools_.push_back(newPool(group_size, first_worker));
+      reactor->slot = first_worker + i;
+      pool_slots_.push_back(reactor->slot + 1);
+      first_worker += group_size;
+    } else {
+      if (pools_.empty()) {
+        pools_.push_back(newPool(num_workers, 0));
+        pool_slots_.push_back(num_reactors);
+      }
+      reactor->slot = i;
+    }
+    reactor->worker_pool = pools_.back();
+    reactors_.push_back(reactor);
+  }
+
+  setInlineBudget(DefaultInlineBudget);
 }
 
 IOManager::~IOManager() {
   stop();
-  delete worker_pool_;
-  delete poller_;
+  for (size_t i = 0; i < reactors_.size(); i++) {
+    // Descriptors closed after stop() returned.
+    deleteDescriptors(reactors_[i]);
+  }
+  for (size_t i = 0; i < pools_.size(); i++) {
+    delete pools_[i];
+  }
+  for (size_t i = 0; i < reactors_.size(); i++) {
+    delete reactors_[i];
+  }
+}
+
+void IOManager::setDefaultPool(PoolType type) {
+  default_pool_ = type;
+}
+
+IOManager::PoolType IOManager::defaultPool() {
+  return default_pool_;
+}
+
+WorkerPool* IOManager::newPool(int num_workers, int first_worker) {
+  if (default_pool_ == STEALING) {
+    return new ThreadPoolStealing(num_workers, first_worker);
+  }
+  return new ThreadPoolFast(num_workers, first_worker);
+}
+
+void IOManager::setAffinity(const ThreadAffinity& affinity) {
+  LOG(LogMessage::NORMAL) << "Placing " << reactors_.size()
+                          << " reactors and " << num_workers_
+                          << " workers: " << affinity.toString();
+  affinity_ = affinity;
+  for (size_t i = 0; i < pools_.size(); i++) {
+    pools_[i]->pin(affinity, pool_slots_[i], numThreads());
+  }
 }
 
 void IOManager::stop() {
@@ -37,25 +134,27 @@ void IOManager::stop() {
       return;
     }
 
-    // Signal the intention to stop and wait for the polling loop to
-    // pick it up and break. If we didn't do that, the polling loop
+    // Signal the intention to stop and wait for the polling loops to
+    // pick it up and break. If we didn't do that, the polling loops
     // would keep adding callbacks to the workers while we were trying
-    // to stop the manager.
+    // to stop the manager. Sleeping loops are woken up so they notice
+    // right away.
     stopped_ = true;
-    while (polling_) {
+    for (size_t i = 0; i < reactors_.size(); i++) {
+      reactors_[i]->poller->wakeup();
+    }
+    while (polling_ > 0) {
       cv_polling_.wait(&m_stop_);
     }
   }
 
   // Wait for all the workers to finish.
-  worker_pool_->stop();
+  for (size_t i = 0; i < pools_.size(); i++) {
+    pools_[i]->stop();
+  }
 
-  // Assuming no worker is running, unprotected access to
-  // deleted_dest_ is fine here.
-  while (deleted_desc_) {
-    Descriptor* hold = deleted_desc_;
-     deleted_desc_ = deleted_desc_->next_;
-    delete hold;
+  for (size_t i = 0; i < reactors_.size(); i++) {
+    deleteDescriptors(reactors_[i]);
   }
 }
 
@@ -66,17 +165,31 @@ bool IOManager::stopped() const {
 
 void IOManager::poll() {
   m_stop_.lock();
-  polling_ = true;
+  polling_ = reactors_.size();
   m_stop_.unlock();
 
-  pollBody();
+  // The calling thread runs the first reactor's loop.
+  for (size_t i = 1; i < reactors_.size(); i++) {
+    Callback<void>* body = makeCallableOnce(&IOManager::pollBody,
+                                            this,
+                                            reactors_[i]);
+    reactors_[i]->poll_thread = makeThread(body);
+  }
+
+  pollBody(reactors_[0]);
+
+  for (size_t i = 1; i < reactors_.size(); i++) {
+    pthread_join(reactors_[i]->poll_thread, NULL);
+  }
 }
 
 Descriptor* IOManager::newDescriptor(int fd,
                                      Callback<void>* read_cb,
                                      Callback<void>* write_cb) {
-  Descriptor* descr = new Descriptor(this, fd, read_cb, write_cb);
-  poller_->setEvent(fd, descr);
+  Reactor* reactor = pickReactor();
+  __sync_fetch_and_add(&reactor->load, 1);
+  Descriptor* descr = new Descriptor(this, reactor, fd, read_cb, write_cb);
+  reactor->poller->setEvent(fd, descr);
   return descr;
 }
 
@@ -85,95 +198,322 @@ void IOManager::delDescriptor(Descriptor* desc) {
     return;
   }
 
-  ScopedLock l(&m_deleted_desc_);
-  desc->next_ = deleted_desc_;
-  deleted_desc_ = desc;
+  Reactor* reactor = desc->reactor_;
+  reactor->poller->delEvent(desc);
+  __sync_fetch_and_or(&desc->state_, Descriptor::RETIRED);
+
+  Descriptor* head;
+  do {
+    head = reactor->retired;
+    desc->next_ = head;
+  } while (!__sync_bool_compare_and_swap(&reactor->retired, head, desc));
 }
 
-void IOManager::addTimer(double delay, Callback<void>* task) {
-  TicksClock::Ticks ts =
-    TicksClock::getTicks() + delay * TicksClock::ticksPerSecond();
+IOManager::TimerHandle IOManager::addTimer(double delay,
+                                           Callback<void>* task) {
+  return addTimerTo(nextReactor(), delay, 0, task);
+}
 
-  m_timer_queue_.lock();
-  timer_queue_.insert(make_pair(ts, task));
-  m_timer_queue_.unlock();
+IOManager::TimerHandle IOManager::addPeriodicTimer(double delay,
+                                                   double period,
+                                                   Callback<void>* task) {
+  if (period <= 0) {
+    LOG(LogMessage::ERROR) << "periodic timer needs a positive period";
+    delete task;
+    return InvalidTimer;
+  }
+  return addTimerTo(nextReactor(), delay, period, task);
+}
+
+IOManager::TimerHandle IOManager::addTimerTo(Reactor* reactor,
+                                             double delay,
+                                             double period,
+                                             Callback<void>* task) {
+  const double ticks_per_second = TicksClock::ticksPerSecond();
+  TicksClock::Ticks ts = TicksClock::getTicks() + delay * ticks_per_second;
+
+  // A period shorter than a tick would expire in every tick anyway.
+  TicksClock::Ticks period_ticks = 0;
+  if (period > 0) {
+    period_ticks = std::max(period, TimerResolution) * ticks_per_second;
+  }
+
+  reactor->m_timers.lock();
+  TimerWheel::Handle handle = reactor->timers.add(ts, task, period_ticks);
+  const bool wakeup = needsWakeup(reactor, ts);
+  reactor->m_timers.unlock();
+
+  if (wakeup) {
+    reactor->poller->wakeup();
+  }
+  return (handle << ReactorBits) | reactor->id;
+}
+
+bool IOManager::cancelTimer(TimerHandle handle) {
+  const size_t reactor_id = handle & (MaxReactors - 1);
+  if (handle == InvalidTimer || reactor_id >= reactors_.size()) {
+    return false;
+  }
+
+  Reactor* reactor = reactors_[reactor_id];
+  ScopedLock l(&reactor->m_timers);
+  return reactor->timers.cancel(handle >> ReactorBits);
 }
 
 void IOManager::addTask(Callback<void>* task) {
-  worker_pool_->addTask(task);
+  if (pools_.size() == 1) {
+    pools_[0]->addTask(task);
+  } else {
+    nextReactor()->worker_pool->addTask(task);
+  }
+}
+
+void IOManager::postToReactor(int reactor_id, Callback<void>* task) {
+  Reactor* reactor = reactors_[reactor_id];
+  reactor->m_timers.lock();
+  reactor->posted.push_back(task);
+  const bool wakeup = needsWakeup(reactor, 0);
+  reactor->m_timers.unlock();
+
+  if (wakeup) {
+    reactor->poller->wakeup();
+  }
+}
+
+bool IOManager::needsWakeup(Reactor* reactor, TicksClock::Ticks when) {
+  if (reactor->wake_at == 0 || when >= reactor->wake_at) {
+    return false;
+  }
+
+  // Whoever comes next finds the wakeup already under way.
+  reactor->wake_at = 0;
+  return true;
+}
+
+void IOManager::setInlineBudget(double seconds) {
+  inline_budget_ = seconds * TicksClock::ticksPerSecond();
+}
+
+uint64_t IOManager::pollerSyscalls() const {
+  uint64_t syscalls = 0;
+  for (size_t i = 0; i < reactors_.size(); i++) {
+    syscalls += reactors_[i]->poller->syscalls();
+  }
+  return syscalls;
+}
+
+IOManager::Reactor* IOManager::pickReactor() {
+  if ((reactors_.size() == 1) || (placement_ == ROUND_ROBIN)) {
+    return nextReactor();
+  }
+
+  // The loads are read without synchronization; being off by a few
+  // descriptors doesn't matter here.
+  Reactor* least = reactors_[0];
+  for (size_t i = 1; i < reactors_.size(); i++) {
+    if (reactors_[i]->load < least->load) {
+      least = reactors_[i];
+    }
+  }
+  return least;
 }
 
-void IOManager::pollBody() {
+IOManager::Reactor* IOManager::nextReactor() {
+  if (reactors_.size() == 1) {
+    return reactors_[0];
+  }
+  const unsigned next = __sync_fetch_and_add(&next_reactor_, 1);
+  return reactors_[next % reactors_.size()];
+}
+
+void IOManager::pollBody(Reactor* reactor) {
+  DescriptorPoller* poller = reactor->poller;
+
+  // Upcalls issued inline find this thread numbered after the workers.
+  ThreadPoolFast::setME(num_workers_ + reactor->id);
+  if (affinity_.policy() != ThreadAffinity::NONE) {
+    affinity_.pin(pthread_self(), reactor->slot, numThreads());
+  }
+
   while (!stopped()) {
-    int res = poller_->poll();
+    int res = poller->poll(pollTimeout(reactor));
     if (res == -1) {
       if (errno != EINTR) {
         perror("Error in epoll_wait ");
         exit(1);
       }
     }
+    reactor->inline_ticks = 0;
 
-    // Issue the alarm callbacks that are due. We'll clean up the
-    // queue shortly.
-    m_timer_queue_.lock();
-    TicksClock::Ticks now = TicksClock::getTicks();
-    TimerQueue::iterator to_execute = timer_queue_.begin();
-    while (to_execute != timer_queue_.end()) {
-      if (to_execute->first > now) {
-        break;
-      }
-      worker_pool_->addTask(to_execute->second);
-      timer_queue_.erase(to_execute++);
-    }
-    m_timer_queue_.unlock();
+    runTimers(reactor);
 
     int e;
     Descriptor* desc;
     for (int i = 0; i < res; i++) {
-      poller_->getEvents(i, &e, &desc);
+      poller->getEvents(i, &e, &desc);
       if (e & (DescriptorPoller::DP_ERROR | DescriptorPoller::DP_READ_READY)) {
         desc->readIfWaiting();
       }
       if (e & (DescriptorPoller::DP_ERROR | DescriptorPoller::DP_WRITE_READY)) {
         desc->writeIfWaiting();
       }
+      if (e & DescriptorPoller::DP_READ_DONE) {
+        desc->complete(&desc->read_done_,
+                       poller->getResult(i, DescriptorPoller::DP_READ_DONE));
+      }
+      if (e & DescriptorPoller::DP_WRITE_DONE) {
+        desc->complete(&desc->write_done_,
+                       poller->getResult(i, DescriptorPoller::DP_WRITE_DONE));
+      }
     }
 
-    Descriptor* to_delete = NULL;
-    m_deleted_desc_.lock();
-    to_delete = deleted_desc_;
-    deleted_desc_ = NULL;
-    m_deleted_desc_.unlock();
-    while (to_delete) {
-      Descriptor* hold = to_delete;
-      to_delete = to_delete->next_;
-      delete hold;
+    // One lock acquisition, and only as many workers woken up as
+    // there are upcalls, for the whole iteration.
+    vector<Callback<void>*>& ready = reactor->ready;
+    if (!ready.empty()) {
+      reactor->worker_pool->addTasks(&ready[0], ready.size());
+      ready.clear();
     }
+
+    reclaimDescriptors(reactor);
   }
 
   m_stop_.lock();
-  polling_ = false;
-  cv_polling_.signal();
+  polling_--;
+  cv_polling_.signalAll();
   m_stop_.unlock();
 }
 
+void IOManager::reclaimDescriptors(Reactor* reactor) {
+  Descriptor* fresh = __sync_lock_test_and_set(&reactor->retired, NULL);
+  if (fresh == NULL && reactor->limbo == NULL) {
+    return;
+  }
+
+  // This iteration's upcalls are with the workers already, so the
+  // epoch covers them.
+  WorkerPool* pool = reactor->worker_pool;
+  if (fresh != NULL) {
+    const uint64_t epoch = pool->epoch();
+    while (fresh != NULL) {
+      Descriptor* desc = fresh;
+      fresh = fresh->next_;
+      desc->retired_at_ = epoch;
+      desc->rounds_left_ = 2;
+      desc->next_ = reactor->limbo;
+      reactor->limbo = desc;
+    }
+  }
+
+  Descriptor** link = &reactor->limbo;
+  while (*link != NULL) {
+    Descriptor* desc = *link;
+    if (!pool->passed(desc->retired_at_)) {
+      link = &desc->next_;
+    } else if (--desc->rounds_left_ > 0) {
+      desc->retired_at_ = pool->epoch();
+      link = &desc->next_;
+    } else {
+      *link = desc->next_;
+      delete desc;
+      __sync_fetch_and_sub(&reactor->load, 1);
+    }
+  }
+}
+
+void IOManager::deleteDescriptors(Reactor* reactor) {
+  Descriptor* lists[] = { reactor->retired, reactor->limbo };
+  reactor->retired = NULL;
+  reactor->limbo = NULL;
+  for (int i = 0; i < 2; i++) {
+    while (lists[i] != NULL) {
+      Descriptor* hold = lists[i];
+      lists[i] = lists[i]->next_;
+      delete hold;
+    }
+  }
+}
+
+int IOManager::pollTimeout(Reactor* reactor) {
+  const double ticks_per_usec = TicksClock::ticksPerSecond() / 1e6;
+  const TicksClock::Ticks now = TicksClock::getTicks();
+  TicksClock::Ticks next = now + MaxPollWait * ticks_per_usec;
+
+  ScopedLock l(&reactor->m_timers);
+  if (!reactor->posted.empty()) {
+    return 0;
+  }
+  TicksClock::Ticks next_timer;
+  if (reactor->timers.nextExpiration(&next_timer) && next_timer < next) {
+    next = next_timer;
+  }
+  if (next <= now) {
+    return 0;
+  }
+
+  // From here on, whoever needs us earlier than 'next' wakes us up.
+  reactor->wake_at = next;
+  return int((next - now) / ticks_per_usec) + 1;
+}
+
+void IOManager::runTimers(Reactor* reactor) {
+  // Issue the alarm callbacks that are due, and the posted tasks,
+  // outside the lock so that they can add more of either.
+  vector<TimerWheel::Expired>& expired = reactor->expired;
+  vector<Callback<void>*>& to_run = reactor->to_run;
+  reactor->m_timers.lock();
+  reactor->wake_at = 0;
+  reactor->timers.advance(TicksClock::getTicks(), &expired);
+  to_run.swap(reactor->posted);
+  reactor->m_timers.unlock();
+
+  for (size_t i = 0; i < expired.size(); i++) {
+    Callback<void>* task = expired[i].task;
+    if (expired[i].periodic) {
+      task = makeCallableOnce(&IOManager::runPeriodic,
+                              this,
+                              reactor,
+                              expired[i].handle,
+                              task);
+    }
+    reactor->ready.push_back(task);
+  }
+  expired.clear();
+
+  for (size_t i = 0; i < to_run.size(); i++) {
+    (*to_run[i])();
+  }
+  to_run.clear();
+}
+
+void IOManager::runPeriodic(Reactor* reactor,
+                            TimerWheel::Handle handle,
+                            Callback<void>* task) {
+  (*task)();
+
+  ScopedLock l(&reactor->m_timers);
+  reactor->timers.done(handle);
+}
+
 // ************************************************************
 // Descriptor Implementetion
 //
 
 Descriptor::Descriptor(IOManager* io_manager,
+                       IOManager::Reactor* reactor,
                        int fd,
                        Callback<void>* read_cb,
                        Callback<void>* write_cb)
   : io_manager_(io_manager),
+    reactor_(reactor),
     fd_(fd),
     closed_(false),
     read_cb_(read_cb),   // takes ownership
     write_cb_(write_cb), // takes ownership
-    can_read_(false),
-    can_write_(false),
-    waiting_read_(false),
-    waiting_write_(false) {
+    state_(0),
+    next_(NULL),
+    retired_at_(0),
+    rounds_left_(0) {
   int flags = fcntl(fd_, F_GETFL, 0);
   fcntl(fd_, F_SETFL, flags | O_NONBLOCK);
 }
@@ -198,71 +538,119 @@ void Descriptor::setUpCalls(Callback<void>* read_cb, Callback<void>* write_cb) {
   delete write_cb_hold;
 }
 
-void Descriptor::readWhenReady() {
-  bool ready_now = false;
-
+void Descriptor::setCompletions(Callback<void, int>* read_done,
+                                Callback<void, int>* write_done) {
   m_.lock();
-  if (can_read_) {
-    ready_now = true;
-    can_read_ = false;
-  } else {
-    waiting_read_ = true;
-  }
+  Callback<void, int>* read_done_hold = read_done_.done;
+  Callback<void, int>* write_done_hold = write_done_.done;
+  read_done_.done = read_done;
+  write_done_.done = write_done;
   m_.unlock();
 
-  if (read_cb_ && ready_now) {
-    workerPool()->addTask(read_cb_);
-  }
+  delete read_done_hold;
+  delete write_done_hold;
 }
 
-void Descriptor::writeWhenReady() {
-  bool ready_now = false;
+bool Descriptor::completesIO() const {
+  return reactor_->poller->completesIO();
+}
 
-  m_.lock();
-  if (can_write_) {
-    ready_now = true;
-    can_write_ = false;
+bool Descriptor::submitReadv(const struct iovec* iov, int iovcnt) {
+  return reactor_->poller->submitReadv(this, iov, iovcnt);
+}
+
+bool Descriptor::submitSendmsg(const struct msghdr* msg, int flags) {
+  return reactor_->poller->submitSendmsg(this, msg, flags);
+}
+
+bool Descriptor::submitAccept() {
+  return reactor_->poller->submitAccept(this);
+}
+
+void Descriptor::setRunInline(bool run_inline) {
+  if (run_inline) {
+    __sync_fetch_and_or(&state_, RUN_INLINE);
   } else {
-    waiting_write_ = true;
+    __sync_fetch_and_and(&state_, ~unsigned(RUN_INLINE));
   }
-  m_.unlock();
+}
 
-  if (write_cb_ && ready_now) {
-    workerPool()->addTask(write_cb_);
+bool Descriptor::takeOrWait(unsigned ready,
+                            unsigned waiting,
+                            unsigned* old_state) {
+  unsigned state = state_;
+  for (;;) {
+    if (state & RETIRED) {
+      *old_state = state;
+      return false;
+    }
+    const unsigned next = (state & ready) ? (state & ~ready)
+                                          : (state | waiting);
+    const unsigned seen = __sync_val_compare_and_swap(&state_, state, next);
+    if (seen == state) {
+      break;
+    }
+    state = seen;
   }
+
+  *old_state = state;
+  return (state & ready) != 0;
 }
 
-void Descriptor::readIfWaiting() {
-  bool schedule_now = false;
+void Descriptor::readWhenReady() {
+  unsigned state;
+  if (takeOrWait(CAN_READ, WAITING_READ, &state) && read_cb_) {
+    workerPool()->addTask(read_cb_);
+  }
+}
 
-  m_.lock();
-  if (waiting_read_) {
-    schedule_now = true;
-    waiting_read_ = false;
-  } else {
-    can_read_ = true;
+void Descriptor::writeWhenReady() {
+  unsigned state;
+  if (takeOrWait(CAN_WRITE, WAITING_WRITE, &state) && write_cb_) {
+    workerPool()->addTask(write_cb_);
   }
-  m_.unlock();
+}
 
-  if (read_cb_ && schedule_now) {
-    workerPool()->addTask(read_cb_);
+void Descriptor::readIfWaiting() {
+  unsigned state;
+  if (takeOrWait(WAITING_READ, CAN_READ, &state) && read_cb_) {
+    dispatch(read_cb_, state & RUN_INLINE);
   }
 }
 
 void Descriptor::writeIfWaiting() {
-  bool schedule_now = false;
+  unsigned state;
+  if (takeOrWait(WAITING_WRITE, CAN_WRITE, &state) && write_cb_) {
+    dispatch(write_cb_, state & RUN_INLINE);
+  }
+}
 
-  m_.lock();
-  if (waiting_write_) {
-    schedule_now = true;
-    waiting_write_ = false;
-  } else {
-    can_write_ = true;
+void Descriptor::complete(Completion* completion, int res) {
+  completion->res = res;
+  if (completion->done != NULL) {
+    dispatch(completion, state_ & RUN_INLINE);
   }
-  m_.unlock();
+}
 
-  if (write_cb_ && schedule_now) {
-    workerPool()->addTask(write_cb_);
+void Descriptor::dispatch(Callback<void>* cb, bool run_inline) {
+  const TicksClock::Ticks budget = io_manager_->inline_budget_;
+  if (!run_inline || (reactor_->inline_ticks >= budget)) {
+    reactor_->ready.push_back(cb);
+    return;
+  }
+
+  // The upcall may release the last reference to its Connection and
+  // have this Descriptor deleted, but only by the end of the current
+  // polling iteration. So it is safe to come back here.
+  const TicksClock::Ticks start = TicksClock::getTicks();
+  (*cb)();
+  const TicksClock::Ticks elapsed = TicksClock::getTicks() - start;
+  reactor_->inline_ticks += elapsed;
+
+  // A handler that takes the reactor's whole budget by itself is not
+  // one that should be run inline.
+  if (elapsed >= budget) {
+    setRunInline(false);
   }
 }
 
@@ -1,19 +1,22 @@
 #ifndef MCP_BASE_IO_MANAGER_HEADER
 #define MCP_BASE_IO_MANAGER_HEADER
 
-#include <map>
 #include <pthread.h>
 #include <queue>
+#include <sys/socket.h>   // msghdr
+#include <sys/uio.h>      // iovec
 #include <vector>
 
 #include "callback.hpp"
 #include "lock.hpp"
+#include "thread_affinity.hpp"
+#include "thread_pool.hpp"
 #include "thread_pool_fast.hpp"
 #include "ticks_clock.hpp"
+#include "timer_wheel.hpp"
 
 namespace base {
 
-using std::multimap;
 using std::queue;
 using std::vector;
 
@@ -31,10 +34,62 @@ class DescriptorPoller;
 //
 // SOCKETS PASSED TO THIS CLASS MUST BE NON-BLOCKING
 //
-// Internally, the IOManager runs a 'polling' thread (epoll) to scan
-// through the sockets continuously. When a socket is found to be
-// ready, the IOManager runs the corresponding callback in a 'workers'
-// thread pool.
+// Internally, the IOManager runs one or more 'reactors'. A reactor is
+// a polling thread (epoll) with its own set of sockets and its own
+// timers. When a socket is found to be ready, the reactor runs
+// the corresponding callback in a 'workers' thread pool. The pool is
+// either shared by all reactors or, if so requested, each reactor
+// gets a worker group of its own, so that reactors contend on
+// nothing at all. A pool either has a single dispatch queue or, if
+// so picked (see setDefaultPool()), gives each worker a deque of its
+// own that idle workers steal from.
+//
+// The callbacks a reactor finds ready in one polling iteration go to
+// the workers as a batch, taking the pool's lock once and waking up
+// only as many idle workers as there are callbacks.
+//
+// A new Descriptor is assigned to a reactor either in round-robin
+// order or to the reactor with the fewest live Descriptors, and
+// stays there for its lifetime. With a single reactor (the default)
+// the IOManager behaves as it always did.
+//
+// A Descriptor may ask for its upcalls to run to completion on the
+// reactor thread itself (see Descriptor::setRunInline()), skipping
+// the hand-off to a worker. This suits handlers that take a few
+// microseconds. To keep a slow handler from stalling every other
+// socket in the reactor, each polling iteration has a time budget
+// for inline upcalls. Once it is spent, the remaining upcalls of the
+// iteration go to the workers; and a Descriptor whose upcall alone
+// took the whole budget is offloaded from then on.
+//
+// Timers are kept in a timing wheel per reactor (see TimerWheel), so
+// adding or cancelling one takes constant time. A reactor sleeps in
+// epoll only until its next timer is due, and so timers fire within
+// a fraction of a millisecond of their deadlines.
+//
+// Each reactor's poller can be woken up from other threads. This
+// happens when stop() is issued, when a timer is added that is due
+// before the reactor would wake up by itself, and when a task is
+// posted to the reactor (see postToReactor()). A reactor that is busy
+// is not woken up; it will pick up the change before polling again.
+//
+// Closing a Descriptor doesn't free it right away: a worker may still
+// be in one of its upcalls, or have one queued, and the reactor may
+// have an event for it in the batch at hand. delDescriptor() only
+// retires it. The reactor frees it at the end of a later iteration,
+// once the worker pool has gone past every task that could refer to
+// it. Neither side takes a lock for that.
+//
+// Worker threads are numbered (ThreadPoolFast::ME()) from 0 to
+// num_workers - 1; reactor threads come after that. Code that keeps
+// per-thread state indexed by ME() should size it for numThreads().
+//
+// The threads can be pinned to CPUs (see setAffinity()). For that,
+// each reactor is placed right before the workers it hands upcalls
+// to: all the reactors and then the shared pool, or each reactor
+// followed by its own worker group. A compact or per-node affinity
+// thus keeps a reactor, its workers and the connections they share
+// on one socket.
 //
 //
 // Thread Safety:
@@ -52,22 +107,50 @@ class DescriptorPoller;
 
 class IOManager {
 public:
-  // Builds an IOManager instance backed by a thread pool with
-  // 'num_workers' threads. The threads are dedicated for running the
-  // upcall registered (see newDescriptor below).
-  explicit IOManager(int num_workers);
+  // How new Descriptors are spread over the reactors.
+  enum Placement {
+    ROUND_ROBIN,   // in turns
+    LEAST_LOADED   // to the reactor with the fewest live Descriptors
+  };
+
+  // Thread pool implementations the workers can run on.
+  enum PoolType {
+    FAST,          // a shared dispatch queue (ThreadPoolFast)
+    STEALING       // per-worker deques (ThreadPoolStealing)
+  };
+
+  // Builds an IOManager instance with 'num_reactors' polling loops
+  // backed by thread pools with 'num_workers' threads in total. The
+  // threads are dedicated for running the upcall registered (see
+  // newDescriptor below). If 'worker_group_per_reactor' is set, the
+  // workers are split evenly among the reactors (and there will be
+  // no more reactors than workers); otherwise, all reactors share a
+  // single pool.
+  //
+  // Worker IDs (ThreadPoolFast::ME()) are in [0, num_workers) either
+  // way, whichever the pool type (see setDefaultPool()).
+  explicit IOManager(int num_workers,
+                     int num_reactors = 1,
+                     Placement placement = ROUND_ROBIN,
+                     bool worker_group_per_reactor = false);
 
   // The destructor requires stop() to complete before it can be
   // issued.
   ~IOManager();
 
+  // Picks the pool type that IOManagers created from now on will run
+  // their workers on. The default is FAST.
+  static void setDefaultPool(PoolType type);
+  static PoolType defaultPool();
+
   // Blocks the calling thread and starts polling for ready sockets on
-  // it. Upon finding such sockets, their upcalls would be issued in a
-  // non-determined thread in the worker pool. This call will return
-  // only when stop() is issued.
+  // it. The calling thread runs the first reactor; the others get
+  // threads of their own. Upon finding ready sockets, their upcalls
+  // would be issued in a non-determined thread in the worker pool of
+  // their reactor. This call will return only when stop() is issued.
   void poll();
 
-  // Stops the polling thread and the workers thread pool, returning
+  // Stops the polling threads and the workers thread pools, returning
   // only when all that machinery was tore down.
   //
   // NOTE:
@@ -84,51 +167,203 @@ public:
   // issue 'rcb', and ditto for write and 'wrb'.
   Descriptor* newDescriptor(int fd, Callback<void>* rcb, Callback<void> *wrb);
 
-  // Marks 'desc' as ready to be GC-ed and returns.
+  // Stops polling for 'desc' and retires it: its upcalls won't be
+  // scheduled anymore, and it is freed once no reactor or worker may
+  // still be using it. Takes no locks. Threads other than the
+  // IOManager's must not be using 'desc' by now.
   void delDescriptor(Descriptor* desc);
 
   // Timed execution support
 
+  // Identifies a timer; see cancelTimer().
+  typedef uint64_t TimerHandle;
+  static const TimerHandle InvalidTimer = 0;
+
   // Schedules 'task' to be executed at least 'delay' seconds
-  // (possibly fractional) from now.
-  void addTimer(double delay, Callback<void>* task);
+  // (possibly fractional) from now. Returns a handle to cancel it
+  // with.
+  TimerHandle addTimer(double delay, Callback<void>* task);
+
+  // Schedules 'task' to be executed 'delay' seconds from now and
+  // every 'period' seconds after that, until the timer is
+  // cancelled. 'task' must be a many-callback; the IOManager takes
+  // ownership of it. A task is never run concurrently with itself;
+  // periods it overruns are skipped.
+  TimerHandle addPeriodicTimer(double delay,
+                               double period,
+                               Callback<void>* task);
+
+  // Cancels the timer 'handle' and returns true if it hadn't fired
+  // yet or, for a periodic timer, if it wasn't cancelled already. A
+  // cancelled once-callback is disposed of here; a periodic task is
+  // disposed of when it is not running anymore. A task that is
+  // running when its timer is cancelled finishes normally.
+  bool cancelTimer(TimerHandle handle);
 
   // Schedules 'task' to be executed as soon as possible by one of the
   // io_manager's workers.
   void addTask(Callback<void>* task);
 
+  // Schedules 'task' to be executed on the polling thread of the
+  // reactor 'reactor_id', waking it up if needed. Tasks posted to a
+  // reactor run in the order they were posted, in between polls. They
+  // must not block. Tasks still pending when the IOManager stops are
+  // disposed of without running.
+  void postToReactor(int reactor_id, Callback<void>* task);
+
+  // Sets how long, in seconds (possibly fractional), a reactor may
+  // spend running upcalls inline in each polling iteration.
+  void setInlineBudget(double seconds);
+
+  // Pins the workers right away, and the reactors once they start
+  // polling, to the CPUs 'affinity' assigns them, and logs the
+  // placement. The first reactor runs on the thread that issues
+  // poll(), which gets pinned as well. Must be issued before poll().
+  void setAffinity(const ThreadAffinity& affinity);
+
   // Accessor
   bool stopped() { return stopped_; }
+  int numReactors() const { return reactors_.size(); }
+  int numThreads() const { return num_workers_ + reactors_.size(); }
+
+  // How many system calls the reactors' pollers issued so far.
+  uint64_t pollerSyscalls() const;
+
 private:
   friend class Descriptor;
 
-  DescriptorPoller* poller_;       // polling descriptor service
-  pthread_t         poll_thread_;  // thread running epoll
-  ThreadPoolFast*   worker_pool_;  // threads running upcalls, owned here
-
-  // A descriptor that got closed will add itself to this
-  // list. pollBody() periodically disposes of them. All GC activity
-  // is protected by m_deleted_desc_.
-  Mutex             m_deleted_desc_;
-  Descriptor*       deleted_desc_; // head of deleted descriptors
+  // Longest a reactor waits in a poll when nothing wakes it up. The
+  // granularity of its timers is TimerResolution.
+  static const int MaxPollWait = 100000;        // usec
+  static const double TimerResolution;          // sec
+
+  // Timer handles carry the id of the reactor whose wheel the timer
+  // is in, in their lower ReactorBits bits.
+  enum { ReactorBits = 8, MaxReactors = 1 << ReactorBits };
+
+  // The state of one polling loop. Each reactor is touched by its
+  // own polling thread and, through the locks below, by whoever
+  // registers or disposes of descriptors and timers on it.
+  struct Reactor {
+    int               id;            // index in reactors_
+    DescriptorPoller* poller;        // polling descriptor service
+    pthread_t         poll_thread;   // thread running epoll
+    WorkerPool*       worker_pool;   // threads running upcalls
+    int               load;          // live descriptors; atomic access
+    int               slot;          // in the threads' affinity
+
+    // Time spent in inline upcalls in the current polling iteration.
+    // Touched only by the polling thread.
+    TicksClock::Ticks inline_ticks;
+
+    // A descriptor that got closed pushes itself onto 'retired',
+    // without taking any lock. The polling thread moves them to
+    // 'limbo', where they wait until no worker can be using them
+    // anymore (see reclaimDescriptors()).
+    Descriptor*       retired;       // atomic access
+    Descriptor*       limbo;         // touched only by the poll thread
+
+    // Keeps the timestamps for the next alarms and their respective
+    // callbacks, and the tasks posted to the reactor. All access to
+    // them and to 'wake_at' is protected by m_timers.
+    Mutex             m_timers;
+    TimerWheel        timers;
+    vector<Callback<void>*> posted;
+
+    // When the reactor is about to poll, or polling, the time it will
+    // wake up by itself. Zero if it is awake or a wakeup is under way.
+    TicksClock::Ticks wake_at;
+
+    // Timers found expired and tasks taken from 'posted' in a polling
+    // iteration. Touched only by the polling thread.
+    vector<TimerWheel::Expired> expired;
+    vector<Callback<void>*> to_run;
+
+    // Upcalls and timer tasks found ready in a polling iteration. They
+    // are handed to the workers in one batch at the end of the
+    // iteration. Touched only by the polling thread.
+    vector<Callback<void>*> ready;
+
+    explicit Reactor(int id);
+    ~Reactor();
+  };
+  typedef vector<Reactor*> Reactors;
+  typedef vector<WorkerPool*> Pools;
+
+  static PoolType   default_pool_;
+
+  const int         num_workers_;
+  Reactors          reactors_;     // owned here
+  Pools             pools_;        // owned here; one, or one per reactor
+  const Placement   placement_;
+
+  // The threads' affinity, and the slot of each pool's first worker
+  // in it; see setAffinity().
+  ThreadAffinity    affinity_;
+  vector<int>       pool_slots_;
+  TicksClock::Ticks inline_budget_; // per reactor polling iteration
+  unsigned          next_reactor_; // round-robin cursor; atomic access
 
   // All stopping state is protected by m_stop_.
   mutable Mutex     m_stop_;
   bool              stopped_;      // has stop been requested?
-  bool              polling_;      // is polling still ongoing?
+  int               polling_;      // how many reactors still polling
   ConditionVar      cv_polling_;   // signal polling stopped
 
-  // Keeps the timestamps for the next alarms and their respective
-  // callbacks. All access to the queue is protected by
-  // m_timer_queue_.
-  Mutex             m_timer_queue_;
-  typedef multimap<TicksClock::Ticks, Callback<void>* > TimerQueue;
-  TimerQueue        timer_queue_;
-
-  // Loops through registered descriptors and issues the related
-  // callback when ready. In between iterations, garbage collect
-  // descriptors that are no longer in use.
-  void pollBody();
+  // Builds a worker pool of the default type, with 'num_workers'
+  // workers numbered from 'first_worker'.
+  static WorkerPool* newPool(int num_workers, int first_worker);
+
+  // Picks the reactor a new descriptor should go to according to
+  // 'placement_'.
+  Reactor* pickReactor();
+
+  // Picks the next reactor in round-robin order.
+  Reactor* nextReactor();
+
+  // Loops through the descriptors registered in 'reactor' and issues
+  // the related callback when ready. In between iterations, garbage
+  // collect descriptors that are no longer in use.
+  void pollBody(Reactor* reactor);
+
+  // Frees the descriptors retired from 'reactor' that are safe to
+  // free. A reactor's own references to a descriptor end with the
+  // polling iteration; the workers' end with the upcalls scheduled
+  // before it was retired. Those upcalls may have scheduled one more,
+  // though, so a descriptor waits for two rounds of the worker
+  // pool's task boundaries (see WorkerPool::passed()).
+  void reclaimDescriptors(Reactor* reactor);
+
+  // Frees all the descriptors retired from 'reactor'. Requires the
+  // reactor and the workers to be stopped.
+  void deleteDescriptors(Reactor* reactor);
+
+  // Returns how long, in microseconds, 'reactor' may wait in its
+  // next poll before a timer is due, no longer than MaxPollWait, and
+  // records when that wait ends. Returns zero if there are tasks
+  // posted.
+  int pollTimeout(Reactor* reactor);
+
+  // Schedules the tasks of the timers in 'reactor' that are due and
+  // runs the tasks posted to it.
+  void runTimers(Reactor* reactor);
+
+  // Wakes up 'reactor' if it is polling and 'when' is earlier than it
+  // would wake up by itself. Requires m_timers. Returns true if the
+  // caller should issue the wakeup (after releasing the lock).
+  bool needsWakeup(Reactor* reactor, TicksClock::Ticks when);
+
+  // Adds a timer to a reactor's wheel and returns its handle.
+  TimerHandle addTimerTo(Reactor* reactor,
+                         double delay,
+                         double period,
+                         Callback<void>* task);
+
+  // Runs the task of the periodic timer 'handle' in 'reactor' and
+  // lets the wheel know it is done.
+  void runPeriodic(Reactor* reactor,
+                   TimerWheel::Handle handle,
+                   Callback<void>* task);
 
   // Returns true if stop() was issue (but not necessarily completed).
   bool stopped() const;
@@ -149,6 +384,12 @@ private:
 //   -- before asking the IOManager to check on the socket's readiness
 //   again.
 //
+//   Where the reactor's poller carries out I/O itself (io_uring, see
+//   completesIO()), the socket can instead be handed read, write and
+//   accept requests, whose results come back through the completion
+//   upcalls (see setCompletions()). These are dispatched just like
+//   the readiness ones.
+//
 class Descriptor {
 public:
   // If a socket can be read from, schedules the associated read
@@ -159,57 +400,131 @@ public:
   // Similar to readWhenReady() but for writes.
   void writeWhenReady();
 
+  // If 'run_inline' is true, issues the upcalls on the reactor thread
+  // that found the socket ready, rather than on a worker, as long as
+  // the reactor has inline budget left. The upcalls must not block.
+  void setRunInline(bool run_inline);
+
   // Replaces both the read and write callbacks with 'read_cb' and
   // 'write_cb' respectively. Old callbacks, if any, are disposed and
   // ownership of 'read_cb' and 'write_cb' are transferred to this
   // Descriptor.
   void setUpCalls(Callback<void>* read_cb, Callback<void>* write_cb);
 
+  // Replaces the upcalls issued with the result of a read (or accept)
+  // and of a write request: the bytes transferred, the accepted
+  // socket, or -errno. Either may be NULL. Old callbacks, if any, are
+  // disposed of, and this Descriptor takes ownership of the new
+  // ones. Must be issued before any request.
+  void setCompletions(Callback<void, int>* read_done,
+                      Callback<void, int>* write_done);
+
+  // If completesIO(), these submit a readv(), sendmsg() or accept()
+  // on the socket and return true; the corresponding completion
+  // upcall is issued when it is done. Otherwise, or if a request in
+  // that direction is already pending, they return false. 'iov' and
+  // 'msg' must stay valid until the request completes.
+  bool submitReadv(const struct iovec* iov, int iovcnt);
+  bool submitSendmsg(const struct msghdr* msg, int flags);
+  bool submitAccept();
+
   // accessors
 
   int fd() const { return fd_; }
 
+  // Whether the reactor's poller carries out requests itself.
+  bool completesIO() const;
+
 private:
   friend class IOManager;
 
   IOManager*      io_manager_;     // my manager, not owned by this
+  IOManager::Reactor* reactor_;    // my poller, not owned by this
   int             fd_;             // underlying socket descriptor
   bool            closed_;         // was fd_ closed?
 
-  // All callback state is protected by m_.
+  // Replacing the callbacks is protected by m_.
   Mutex           m_;
   Callback<void>* read_cb_;        // read upcall, owned here
   Callback<void>* write_cb_;       // write upcall, owned here
-  bool            can_read_;       // can serve a read immediately
-  bool            can_write_;      // ditto write
-  bool            waiting_read_;   // a read wasr requested
-  bool            waiting_write_;  // ditto write
 
-  // List of descriptors that can be disposed.
+  // Issues a completion upcall with the result of a request. There is
+  // one per direction, reused for every request since only one is
+  // pending at a time.
+  class Completion : public Callback<void> {
+  public:
+    Completion() : done(NULL), res(0) {}
+    virtual ~Completion() { delete done; }
+
+    virtual void operator()() { (*done)(res); }
+    virtual bool once() const { return false; }
+
+    Callback<void, int>* done;     // owned here
+    int                  res;
+  };
+  Completion      read_done_;
+  Completion      write_done_;
+
+  // The readiness flags below, packed in 'state_' and changed only by
+  // compare-and-swap. Per direction, at most one of CAN_ and WAITING_
+  // is set: the side that finds the other's flag clears it and
+  // schedules the upcall, so each readiness edge is matched with one
+  // request and the upcall is scheduled exactly once.
+  enum State {
+    CAN_READ      = 0x01,  // can serve a read immediately
+    CAN_WRITE     = 0x02,  // ditto write
+    WAITING_READ  = 0x04,  // a read was requested
+    WAITING_WRITE = 0x08,  // ditto write
+    RUN_INLINE    = 0x10,  // upcalls on the reactor thread?
+    RETIRED       = 0x20   // delDescriptor()'ed; no more upcalls
+  };
+  unsigned        state_;          // atomic access
+
+  // List of descriptors that can be disposed, and the worker pool
+  // epoch and the number of rounds they are waiting for.
   Descriptor*     next_;
+  uint64_t        retired_at_;
+  int             rounds_left_;
 
   // io_manager's interface
 
-  // Creates a descriptor for the socket 'fd' on 'io_manager' and
-  // register 'read_cb' and 'write_cb' as the upcalls for when the
-  // socket can be read and written to, respectively.
+  // Creates a descriptor for the socket 'fd' on 'io_manager's
+  // 'reactor' and register 'read_cb' and 'write_cb' as the upcalls
+  // for when the socket can be read and written to, respectively.
   Descriptor(IOManager* io_manager,
+             IOManager::Reactor* reactor,
              int fd,
              Callback<void>* read_cb,
              Callback<void>* write_cb);
   ~Descriptor();
 
   // If the socket is on a 'wants to be read' mode, issues the read
-  // callback on the io_manager's threadpool and return. Otherwise,
-  // mark the socket as ready to read and return.
+  // callback (see dispatch()) and return. Otherwise, mark the socket
+  // as ready to read and return.
   void readIfWaiting();
 
   // Similar to readIfWaiting() but for writes.
   void writeIfWaiting();
 
+  // Issues the completion upcall 'completion' with 'res' (see
+  // dispatch()).
+  void complete(Completion* completion, int res);
+
+  // Issues the upcall 'cb' right here if 'run_inline' and there's
+  // inline budget left, or adds it to the reactor's batch for the
+  // worker pool otherwise. Must be called from the reactor's polling
+  // thread.
+  void dispatch(Callback<void>* cb, bool run_inline);
+
+  // Atomically takes the flag 'ready' if set and returns true;
+  // otherwise, sets 'waiting' and returns false. A retired descriptor
+  // is left as is. Also returns in 'old_state' the state the
+  // transition started from.
+  bool takeOrWait(unsigned ready, unsigned waiting, unsigned* old_state);
+
   // accessors
 
-  ThreadPoolFast* workerPool() { return io_manager_->worker_pool_; }
+  WorkerPool* workerPool() { return reactor_->worker_pool; }
 };
 
 } // namespace base
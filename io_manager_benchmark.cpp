@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>      // sched_yield
+#include <sys/eventfd.h>
+#include <unistd.h>     // read, write, close
+
+#include "callback.hpp"
+#include "io_manager.hpp"
+#include "thread.hpp"
+#include "timer.hpp"
+
+// Measures how many readiness events per second an IOManager turns
+// into upcalls when it watches many connections, only a few of which
+// are busy at any time. A connection here is an eventfd: the driver
+// pokes a group of them, waits until each had its read upcall, and
+// moves on to the next group.
+
+namespace {
+
+using base::Callback;
+using base::Descriptor;
+using base::IOManager;
+using base::Timer;
+using base::makeCallableMany;
+using base::makeCallableOnce;
+using base::makeThread;
+
+const int NumConnections = 10000;
+const double Seconds = 1.0;
+
+// Upcalls issued so far; atomic access.
+int served = 0;
+
+class Conn {
+public:
+  Conn() : fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), desc_(NULL) {}
+  ~Conn() { close(fd_); }
+
+  void start(IOManager* io_manager) {
+    desc_ = io_manager->newDescriptor(fd_,
+                                      makeCallableMany(&Conn::onRead, this),
+                                      NULL);
+    desc_->readWhenReady();
+  }
+
+  void stop(IOManager* io_manager) {
+    io_manager->delDescriptor(desc_);
+  }
+
+  void poke() {
+    const uint64_t one = 1;
+    while (write(fd_, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+  }
+
+  void onRead() {
+    uint64_t count;
+    while (read(fd_, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+    __sync_fetch_and_add(&served, 1);
+    desc_->readWhenReady();
+  }
+
+private:
+  int         fd_;
+  Descriptor* desc_;
+
+  // Non-copyable, non-assignable.
+  Conn(const Conn&);
+  Conn& operator=(const Conn&);
+};
+
+void runBenchmark(int num_workers, int num_active) {
+  IOManager io_manager(num_workers);
+  Conn* conns = new Conn[NumConnections];
+  for (int i = 0; i < NumConnections; i++) {
+    conns[i].start(&io_manager);
+  }
+  served = 0;
+
+  Callback<void>* body = makeCallableOnce(&IOManager::poll, &io_manager);
+  pthread_t tid = makeThread(body);
+
+  Timer timer;
+  timer.start();
+
+  // Every connection gets its turn, but only 'num_active' of them
+  // have anything to say at once.
+  int next = 0;
+  int target = 0;
+  do {
+    for (int i = 0; i < num_active; i++) {
+      conns[next].poke();
+      next = (next + 1) % NumConnections;
+    }
+    target += num_active;
+    while (served < target) {
+      sched_yield();
+    }
+    timer.end();
+  } while (timer.elapsed() < Seconds);
+
+  for (int i = 0; i < NumConnections; i++) {
+    conns[i].stop(&io_manager);
+  }
+  io_manager.stop();
+  pthread_join(tid, NULL);
+  delete [] conns;
+
+  std::cout << std::setiosflags(std::ios::left)
+            << std::setw(15) << NumConnections
+            << std::setw(10) << num_active
+            << std::setw(10) << num_workers
+            << int(served / timer.elapsed()) << std::endl;
+}
+
+}  // unnamed namespace
+
+int main(int argc, char* argv[]) {
+  std::cout << std::setiosflags(std::ios::left)
+            << std::setw(15) << "# connections"
+            << std::setw(10) << "active"
+            << std::setw(10) << "workers"
+            << "events/sec" << std::endl;
+
+  const int actives[] = { 1, 16, 256 };
+  for (int w = 1; w <= 4; w *= 4) {
+    for (size_t i = 0; i < sizeof(actives) / sizeof(actives[0]); i++) {
+      runBenchmark(w, actives[i]);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,442 @@
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "callback.hpp"
+#include "io_manager.hpp"
+#include "lock.hpp"
+#include "test_unit.hpp"
+#include "thread.hpp"
+#include "thread_pool_fast.hpp"
+#include "ticks_clock.hpp"
+
+namespace {
+
+using base::Callback;
+using base::IOManager;
+using base::makeCallableMany;
+using base::makeCallableOnce;
+using base::Notification;
+using base::ThreadPoolFast;
+using base::TicksClock;
+
+void sleepMillis(int msecs) {
+  struct timespec ts;
+  ts.tv_sec = msecs / 1000;
+  ts.tv_nsec = (msecs % 1000) * 1000000;
+  nanosleep(&ts, NULL);
+}
+
+// Records when (and how many times) it was fired.
+class Alarm {
+public:
+  Alarm() : count_(0), fired_at_(0) {}
+
+  void fire() {
+    fired_at_ = TicksClock::getTicks();
+    __sync_fetch_and_add(&count_, 1);
+    fired_.notify();
+  }
+
+  void wait() { fired_.wait(); }
+
+  int count() const { return count_; }
+  TicksClock::Ticks firedAt() const { return fired_at_; }
+
+private:
+  int               count_;
+  TicksClock::Ticks fired_at_;
+  Notification      fired_;
+};
+
+double secondsSince(TicksClock::Ticks start) {
+  return (TicksClock::getTicks() - start) / TicksClock::ticksPerSecond();
+}
+
+// Runs an IOManager's polling loop in a thread of its own for the
+// duration of a test.
+class Poller {
+public:
+  explicit Poller(IOManager* io_manager) : io_manager_(io_manager) {
+    Callback<void>* body = makeCallableOnce(&IOManager::poll, io_manager_);
+    tid_ = base::makeThread(body);
+
+    // Give the reactors time to go to sleep.
+    sleepMillis(10);
+  }
+
+  ~Poller() {
+    io_manager_->stop();
+    pthread_join(tid_, NULL);
+  }
+
+private:
+  IOManager* io_manager_;
+  pthread_t  tid_;
+};
+
+TEST(Timers, OnTime) {
+  IOManager io_manager(1 /* one worker */);
+  Alarm alarm;
+  const TicksClock::Ticks start = TicksClock::getTicks();
+  io_manager.addTimer(0.005, makeCallableOnce(&Alarm::fire, &alarm));
+  Poller poller(&io_manager);
+
+  // The reactor sleeps only until the timer is due, rather than for
+  // a whole poll interval.
+  alarm.wait();
+  const double elapsed =
+    (alarm.firedAt() - start) / TicksClock::ticksPerSecond();
+  EXPECT_TRUE(elapsed >= 0.005);
+  EXPECT_TRUE(elapsed < 0.050);
+}
+
+TEST(Timers, AddedWhileSleeping) {
+  IOManager io_manager(1 /* one worker */);
+  Poller poller(&io_manager);
+
+  // The reactor is asleep with nothing to do. The new timer must wake
+  // it up rather than wait for its poll to time out.
+  Alarm alarm;
+  const TicksClock::Ticks start = TicksClock::getTicks();
+  io_manager.addTimer(0.005, makeCallableOnce(&Alarm::fire, &alarm));
+  alarm.wait();
+  const double elapsed =
+    (alarm.firedAt() - start) / TicksClock::ticksPerSecond();
+  EXPECT_TRUE(elapsed >= 0.005);
+  EXPECT_TRUE(elapsed < 0.050);
+}
+
+TEST(Timers, Cancel) {
+  IOManager io_manager(1 /* one worker */);
+  Poller poller(&io_manager);
+
+  Alarm cancelled;
+  Alarm kept;
+  IOManager::TimerHandle h =
+    io_manager.addTimer(0.010, makeCallableOnce(&Alarm::fire, &cancelled));
+  io_manager.addTimer(0.020, makeCallableOnce(&Alarm::fire, &kept));
+  EXPECT_TRUE(io_manager.cancelTimer(h));
+  EXPECT_FALSE(io_manager.cancelTimer(h));
+
+  kept.wait();
+  EXPECT_EQ(cancelled.count(), 0);
+  EXPECT_FALSE(io_manager.cancelTimer(IOManager::InvalidTimer));
+}
+
+TEST(Timers, Periodic) {
+  IOManager io_manager(2 /* workers */);
+  Alarm alarm;
+  IOManager::TimerHandle h =
+    io_manager.addPeriodicTimer(0.005,
+                                0.005,
+                                makeCallableMany(&Alarm::fire, &alarm));
+  Poller poller(&io_manager);
+
+  sleepMillis(100);
+  EXPECT_TRUE(io_manager.cancelTimer(h));
+  const int count = alarm.count();
+  EXPECT_GT(count, 10);
+  EXPECT_TRUE(count <= 25);
+
+  sleepMillis(20);
+  EXPECT_TRUE(alarm.count() <= count + 1);
+  EXPECT_FALSE(io_manager.cancelTimer(h));
+}
+
+// Records the thread that ran it.
+class Probe {
+public:
+  Probe() : me_(-1) {}
+
+  void run() {
+    me_ = ThreadPoolFast::ME();
+    ran_.notify();
+  }
+
+  void wait() { ran_.wait(); }
+  int me() const { return me_; }
+
+private:
+  int          me_;
+  Notification ran_;
+};
+
+TEST(Wakeup, PostToReactor) {
+  IOManager io_manager(2 /* workers */, 2 /* reactors */);
+  Poller poller(&io_manager);
+
+  for (int i = 0; i < io_manager.numReactors(); i++) {
+    Probe probe;
+    const TicksClock::Ticks start = TicksClock::getTicks();
+    io_manager.postToReactor(i, makeCallableOnce(&Probe::run, &probe));
+    probe.wait();
+    EXPECT_TRUE(secondsSince(start) < 0.050);
+
+    // Reactor threads are numbered after the workers.
+    EXPECT_EQ(probe.me(), 2 + i);
+  }
+}
+
+TEST(Wakeup, Stop) {
+  IOManager io_manager(1 /* one worker */, 2 /* reactors */);
+  Callback<void>* body = makeCallableOnce(&IOManager::poll, &io_manager);
+  pthread_t tid = base::makeThread(body);
+  sleepMillis(10);
+
+  const TicksClock::Ticks start = TicksClock::getTicks();
+  io_manager.stop();
+  pthread_join(tid, NULL);
+  EXPECT_TRUE(secondsSince(start) < 0.050);
+}
+
+// Drains a socket whenever its read upcall is issued, and asks for the
+// next one right after. Checks that upcalls never overlap.
+class Drainer {
+public:
+  Drainer(int fd, int expected)
+    : fd_(fd), expected_(expected), received_(0), inside_(0), overlaps_(0),
+      done_(false), desc_(NULL) {}
+
+  void start(base::Descriptor* desc) {
+    desc_ = desc;
+    desc_->readWhenReady();
+  }
+
+  void onRead() {
+    if (__sync_fetch_and_add(&inside_, 1) != 0) {
+      __sync_fetch_and_add(&overlaps_, 1);
+    }
+
+    char buf[512];
+    int res;
+    while ((res = read(fd_, buf, sizeof(buf))) > 0) {
+      received_ += res;
+    }
+    const bool done = received_ == expected_;
+
+    __sync_fetch_and_sub(&inside_, 1);
+    if (done) {
+      done_ = true;
+    } else {
+      desc_->readWhenReady();
+    }
+  }
+
+  bool waitDone(double seconds) {
+    const TicksClock::Ticks start = TicksClock::getTicks();
+    while (!done_ && secondsSince(start) < seconds) {
+      sleepMillis(1);
+    }
+    return done_;
+  }
+
+  int received() const { return received_; }
+  int overlaps() const { return overlaps_; }
+
+private:
+  int               fd_;
+  int               expected_;
+  int               received_;   // touched only by the upcall
+  int               inside_;     // upcalls running; atomic access
+  int               overlaps_;   // atomic access
+  volatile bool     done_;
+  base::Descriptor* desc_;
+};
+
+// Sends 'count' bytes, one per write, over 'fd'.
+class Dripper {
+public:
+  Dripper(int fd, int count) : fd_(fd), count_(count) {}
+
+  void run() {
+    for (int i = 0; i < count_; i++) {
+      while (write(fd_, "x", 1) != 1) {
+      }
+    }
+  }
+
+private:
+  int fd_;
+  int count_;
+};
+
+TEST(Readiness, NoLostOrDuplicateUpcalls) {
+  IOManager io_manager(4 /* workers */);
+  Poller poller(&io_manager);
+
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  // Every byte makes an edge the reactor reports while the workers
+  // keep asking for the next read, so both sides race on the
+  // Descriptor's state all along.
+  const int num_bytes = 200000;
+  Drainer drainer(fds[0], num_bytes);
+  base::Descriptor* desc =
+    io_manager.newDescriptor(fds[0],
+                             makeCallableMany(&Drainer::onRead, &drainer),
+                             NULL);
+  drainer.start(desc);
+
+  Dripper dripper(fds[1], num_bytes);
+  pthread_t tid = base::makeThread(makeCallableOnce(&Dripper::run, &dripper));
+  pthread_join(tid, NULL);
+
+  // A lost wakeup would leave bytes in the socket for good.
+  EXPECT_TRUE(drainer.waitDone(5.0));
+  EXPECT_EQ(drainer.received(), num_bytes);
+  EXPECT_EQ(drainer.overlaps(), 0);
+
+  io_manager.delDescriptor(desc);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// A read callback that takes its time and tells, once deleted, whether
+// it had finished running by then.
+class SlowUpcall : public Callback<void> {
+public:
+  SlowUpcall(int msecs, int fd, volatile int* status)
+    : msecs_(msecs), fd_(fd), status_(status) {
+    *status_ = Created;
+  }
+
+  virtual ~SlowUpcall() {
+    *status_ = (*status_ == Finished) ? Freed : FreedEarly;
+  }
+
+  virtual bool once() const { return false; }
+
+  virtual void operator()() {
+    *status_ = Running;
+    char buf[64];
+    while (read(fd_, buf, sizeof(buf)) > 0) {
+    }
+    sleepMillis(msecs_);
+    *status_ = Finished;
+  }
+
+  enum Status { Created, Running, Finished, Freed, FreedEarly };
+
+private:
+  int           msecs_;
+  int           fd_;
+  volatile int* status_;
+};
+
+bool waitStatus(volatile int* status, int expected, double seconds) {
+  const TicksClock::Ticks start = TicksClock::getTicks();
+  while (*status != expected && secondsSince(start) < seconds) {
+    sleepMillis(1);
+  }
+  return *status == expected;
+}
+
+// Makes the (only) reactor go through 'iterations' polling iterations.
+void spinReactor(IOManager* io_manager, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    Probe probe;
+    io_manager->postToReactor(0, makeCallableOnce(&Probe::run, &probe));
+    probe.wait();
+  }
+}
+
+TEST(Reclaim, WhileUpcallRuns) {
+  IOManager io_manager(1 /* one worker */);
+  Poller poller(&io_manager);
+
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  volatile int status;
+  base::Descriptor* desc =
+    io_manager.newDescriptor(fds[0], new SlowUpcall(50, fds[0], &status), NULL);
+  desc->readWhenReady();
+  EXPECT_EQ(write(fds[1], "x", 1), 1);
+
+  // Close the descriptor while its upcall is in the middle of running,
+  // and have the reactor go through a few iterations meanwhile.
+  EXPECT_TRUE(waitStatus(&status, SlowUpcall::Running, 1.0));
+  io_manager.delDescriptor(desc);
+  spinReactor(&io_manager, 3);
+  EXPECT_EQ(status, SlowUpcall::Running);
+  EXPECT_TRUE(waitStatus(&status, SlowUpcall::Freed, 1.0));
+  EXPECT_NEQ(status, SlowUpcall::FreedEarly);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(Reclaim, WhileUpcallQueued) {
+  IOManager io_manager(1 /* one worker */);
+  Poller poller(&io_manager);
+
+  // Keep the only worker busy so the second upcall waits in line.
+  int busy_fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, busy_fds), 0);
+  volatile int busy_status;
+  base::Descriptor* busy =
+    io_manager.newDescriptor(busy_fds[0],
+                             new SlowUpcall(80, busy_fds[0], &busy_status),
+                             NULL);
+  busy->readWhenReady();
+  EXPECT_EQ(write(busy_fds[1], "x", 1), 1);
+  EXPECT_TRUE(waitStatus(&busy_status, SlowUpcall::Running, 1.0));
+
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  volatile int status;
+  base::Descriptor* desc =
+    io_manager.newDescriptor(fds[0], new SlowUpcall(0, fds[0], &status), NULL);
+  desc->readWhenReady();
+  EXPECT_EQ(write(fds[1], "x", 1), 1);
+
+  // Give the reactor time to queue the upcall, then close the
+  // descriptor before a worker gets to run it.
+  sleepMillis(10);
+  EXPECT_EQ(status, SlowUpcall::Created);
+  io_manager.delDescriptor(desc);
+  spinReactor(&io_manager, 3);
+  EXPECT_EQ(status, SlowUpcall::Created);
+  EXPECT_TRUE(waitStatus(&status, SlowUpcall::Freed, 1.0));
+  EXPECT_NEQ(status, SlowUpcall::FreedEarly);
+
+  io_manager.delDescriptor(busy);
+  close(fds[0]);
+  close(fds[1]);
+  close(busy_fds[0]);
+  close(busy_fds[1]);
+}
+
+TEST(Reclaim, StealingPool) {
+  // The work-stealing pool tells task boundaries apart by generation
+  // rather than by task number.
+  IOManager::setDefaultPool(IOManager::STEALING);
+  IOManager io_manager(2 /* workers */);
+  IOManager::setDefaultPool(IOManager::FAST);
+  Poller poller(&io_manager);
+
+  int fds[2];
+  EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  volatile int status;
+  base::Descriptor* desc =
+    io_manager.newDescriptor(fds[0], new SlowUpcall(50, fds[0], &status), NULL);
+  desc->readWhenReady();
+  EXPECT_EQ(write(fds[1], "x", 1), 1);
+
+  EXPECT_TRUE(waitStatus(&status, SlowUpcall::Running, 1.0));
+  io_manager.delDescriptor(desc);
+  spinReactor(&io_manager, 3);
+  EXPECT_EQ(status, SlowUpcall::Running);
+  EXPECT_TRUE(waitStatus(&status, SlowUpcall::Freed, 1.0));
+  EXPECT_NEQ(status, SlowUpcall::FreedEarly);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+}  // unnamed namespace
+
+int main(int argc, char* argv[]) {
+  return RUN_TESTS(argc, argv);
+}
@@ -1,21 +1,32 @@
+#include <algorithm>
+#include <fstream>
 #include <iomanip>
+#include <string>
+#include <vector>
 
 #include "callback.hpp"
+#include "descriptor_poller.hpp"
 #include "signal_handler.hpp"
 #include "kv_connection.hpp"
 #include "http_response.hpp"
 #include "kv_service.hpp"
 #include "io_manager.hpp"
+#include "thread_pool_fast.hpp"
+#include "ticks_clock.hpp"
 
 // client --local 15000 --server 10.0.1.12 --port 15001 --num_cons 500
 // --rate 500 --num-calls 10
 
 using base::AcceptCallback;
 using base::Callback;
+using base::Connection;
+using base::DescriptorPoller;
 using base::IOManager;
 using base::ServiceManager;
 using base::makeCallableOnce;
 using base::makeCallableMany;
+using base::ThreadPoolFast;
+using base::TicksClock;
 using kv::KVConnectCallback;
 using kv::KVClientConnection;
 using kv::KVService;
@@ -25,6 +36,11 @@ using http::ResponseCallback;
 
 using namespace std;
 
+// Request latencies are kept in a histogram of BucketMicros wide
+// buckets. The last bucket takes anything longer.
+const int BucketMicros = 5;
+const int NumBuckets = 4000;  // 20ms
+
 class Client {
 public:
   Client();
@@ -35,10 +51,13 @@ public:
   void requestDone(Response* response);
 
   uint32_t counter;
+  std::vector<uint32_t> latencies;  // histogram, see BucketMicros
+
 private:
   KVClientConnection*   conn_;
   Callback<void>*       request_cb_;   // owned here
   ResponseCallback*     response_cb_;  // owned here
+  TicksClock::Ticks     sent_at_;
 
   // non-copyable, non-assignable
   Client(const Client&);
@@ -47,8 +66,8 @@ private:
 
 
 
-Client::Client() : counter(0), conn_(NULL), request_cb_(NULL), 
-                   response_cb_(NULL) { }
+Client::Client() : counter(0), latencies(NumBuckets), conn_(NULL),
+                   request_cb_(NULL), response_cb_(NULL), sent_at_(0) { }
 
 Client::~Client() {
   delete request_cb_;
@@ -81,6 +100,7 @@ void Client::doRequest() {
     request.method = "GET";
     request.address = "/12";
     request.version = "KV/1.1";
+    sent_at_ = TicksClock::getTicks();
     conn_->asyncSend(&request, response_cb_);
   }
   conn_->release();
@@ -92,6 +112,12 @@ void Client::requestDone(Response* response) {
     return;
   }
 
+  static const double ticks_per_bucket =
+    TicksClock::ticksPerSecond() * BucketMicros / 1e6;
+  const TicksClock::Ticks elapsed = TicksClock::getTicks() - sent_at_;
+  const size_t bucket = elapsed / ticks_per_bucket;
+  latencies[std::min(bucket, size_t(NumBuckets - 1))]++;
+
   conn_->acquire();
   IOManager* io_manager = conn_->io_manager();
   counter++;
@@ -101,18 +127,62 @@ void Client::requestDone(Response* response) {
 }
 
 
-void runBenchmark(const int num_clients, const int num_workers) {
+// Returns the latency, in microseconds, under which 'fraction' of
+// the requests in 'histogram' completed.
+double percentile(const std::vector<uint64_t>& histogram,
+                  uint64_t total,
+                  double fraction) {
+  uint64_t seen = 0;
+  for (int i = 0; i < NumBuckets; i++) {
+    seen += histogram[i];
+    if (seen >= fraction * total) {
+      return (i + 1) * BucketMicros;
+    }
+  }
+  return NumBuckets * BucketMicros;
+}
+
+// Returns how many read and write system calls this process issued
+// so far. The kernel counts the reads (if it tells at all), but not
+// the sendmsg()s connections write with; those they count themselves.
+uint64_t readWriteSyscalls() {
+  std::ifstream io("/proc/self/io");
+  uint64_t total = 0;
+  std::string name;
+  uint64_t value;
+  while (io >> name >> value) {
+    if (name == "syscr:" || name == "syscw:") {
+      total += value;
+    }
+  }
+  return total + Connection::sendCalls();
+}
+
+// Runs 'num_clients' closed-loop clients against a KV server in this
+// same process for a second, polling with 'backend'. With
+// 'run_inline', both sides handle their messages on the polling
+// thread rather than on the workers.
+void runBenchmark(const int num_clients, const int num_workers,
+                  bool run_inline, DescriptorPoller::Backend backend) {
+  DescriptorPoller::setDefaultBackend(backend);
+
+  // The clients' callbacks may still be queued when the service stops
+  // and so the clients must outlive it.
+  Client clients[num_clients];
 
   ServiceManager service(num_workers);
   KVService kv_service(15000, &service);
+  kv_service.setRunInline(run_inline);
 
   IOManager* io_manager = service.io_manager();
   int total_counter = 0;
 
+  // The hash table needs a thread ID. This thread is about to run
+  // the service's reactor, so it can use the reactor's.
+  ThreadPoolFast::setME(service.num_workers());
   for (uint32_t i=0; i<1000; i++) {
     kv_service.lf_hashtable()->insert(i,i);
   }
-  Client clients[num_clients];
   for (int i=0; i<num_clients; ++i) {
     KVConnectCallback* connect_cb = makeCallableOnce(&Client::start, &clients[i]);
     kv_service.asyncConnect("127.0.0.1", 15000, connect_cb);
@@ -123,25 +193,63 @@ void runBenchmark(const int num_clients, const int num_workers) {
   // Launch a progress meter in the background. If things hang, let
   // the meter kill this process.
 
+  const uint64_t start_syscalls = readWriteSyscalls();
   service.run();
+  const uint64_t syscalls = readWriteSyscalls() - start_syscalls +
+                            io_manager->pollerSyscalls();
+
+  std::vector<uint64_t> histogram(NumBuckets);
   for (int i=0; i<num_clients; i++) {
     total_counter += clients[i].counter;
+    for (int j=0; j<NumBuckets; j++) {
+      histogram[j] += clients[i].latencies[j];
+    }
   }
 
   cout << setiosflags(ios::left) << setw(15) << num_clients;
   cout << setiosflags(ios::left) << setw(15) << num_workers;
-  cout << total_counter << endl;
+  cout << setiosflags(ios::left) << setw(10) << (run_inline ? "inline"
+                                                            : "pool");
+  cout << setiosflags(ios::left) << setw(8)
+       << (backend == DescriptorPoller::URING ? "uring" : "epoll");
+  cout << setiosflags(ios::left) << setw(15) << total_counter;
+  cout << setiosflags(ios::left) << setw(10)
+       << percentile(histogram, total_counter, 0.5);
+  cout << setiosflags(ios::left) << setw(10)
+       << percentile(histogram, total_counter, 0.99);
+  cout << int(100.0 * syscalls / max(total_counter, 1)) / 100.0 << endl;
 }
 
-
-int main(int argc, char* argv[]) {
+void printHeader() {
   cout << setiosflags(ios::left) << setw(15) << "# of clients";
   cout << setiosflags(ios::left) << setw(15) << "# of workers";
-  cout << setiosflags(ios::left) << "# of responses per second";
+  cout << setiosflags(ios::left) << setw(10) << "upcalls";
+  cout << setiosflags(ios::left) << setw(8) << "poller";
+  cout << setiosflags(ios::left) << setw(15) << "responses/sec";
+  cout << setiosflags(ios::left) << setw(10) << "p50 (us)";
+  cout << setiosflags(ios::left) << setw(10) << "p99 (us)";
+  cout << "syscalls/resp";
   cout << endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  printHeader();
   for (int i=0; i<5; i++) {
     for (int j=0; j<4; j++) {
-      runBenchmark(16<<i, 4<<j);
+      runBenchmark(16<<i, 4<<j, false /* pool */, DescriptorPoller::EPOLL);
+      runBenchmark(16<<i, 4<<j, true /* inline */, DescriptorPoller::EPOLL);
+    }
+  }
+
+  // Same load, polled by epoll and by io_uring. The system calls
+  // counted are the reads, writes, and the pollers' own.
+  cout << endl;
+  printHeader();
+  for (int i=0; i<5; i+=2) {
+    for (int inl=0; inl<2; inl++) {
+      runBenchmark(16<<i, 4, inl, DescriptorPoller::EPOLL);
+      runBenchmark(16<<i, 4, inl, DescriptorPoller::URING);
     }
   }
   return 0;
@@ -1,25 +1,29 @@
-#include <sstream>
+#include <ctype.h>  // isdigit
 
 #include "http_parser.hpp"
+#include "http_response_writer.hpp"
 #include "kv_connection.hpp"
 
 namespace kv {
 
-using std::istringstream;
-using std::ostringstream;  
 using base::TicksClock;
 using base::RequestStats;
 using base::ThreadPoolFast;
 using base::Connection;
 using base::Buffer;
+using base::BufferSlice;
+using base::MemPiece;
 using lock_free::LockFreeHashTable;
 using http::Parser;
 using http::Response;
+using http::ResponseWriter;
 
 KVServerConnection::KVServerConnection(KVService* service, int client_fd)
   : Connection(service->service_manager()->io_manager(), client_fd),
     my_service_(service), 
     lf_hashtable_(service->lf_hashtable()) {
+  setRunInline(service->runInline());
+  setTimeouts(service->timeouts());
   startRead();
 }
 
@@ -36,13 +40,21 @@ bool KVServerConnection::readDone() {
     } else if (rc > 0) {
       return true;
     } else {
-      in_.consume(it.bytesRead());
+      // request_ refers to the input, so consume it only after the
+      // request was handled
       if (! handleRequest(&request_)) {
 	return false;
       }
+      in_.consume(it.bytesRead());
       if (it.eob()) {
 	return true;
       }
+
+      // Leave any further requests for when the responses so far
+      // have been sent, if they took up the memory budget.
+      if (outputOverBudget()) {
+	return true;
+      }
     }
   }
 }
@@ -58,68 +70,36 @@ bool KVServerConnection::handleRequest(Request* requst) {
   if (request_.address == "stats") {
     uint32_t reqsLastSec;
     stats->getStats(TicksClock::getTicks(), &reqsLastSec);
-    ostringstream stats_stream;
-    stats_stream << reqsLastSec;
-    string stats_string = stats_stream.str();
+    char stats_string[ResponseWriter::MaxDigits];
+    const size_t stats_len =
+      ResponseWriter::formatUint(reqsLastSec, stats_string);
 
     m_write_.lock();
-    out_.write("HTTP/1.1 200 OK\r\n");
-    out_.write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
-    out_.write("Server: Lab02a\r\n");
-    out_.write("Accept-Ranges: bytes\r\n");
-
-    ostringstream os;
-    os << "Content-Length: " << stats_string.size() << "\r\n";
-    out_.write(os.str().c_str());
-    out_.write("Content-Type: text/html\r\n");
-    out_.write("\r\n");
- 
-    out_.write(stats_string.c_str());
-
+    writeResponse(MemPiece(stats_string, stats_len));
     m_write_.unlock();
 
     startWrite();
     return true;
   }
 
-  uint32_t key;
-  istringstream key_stream(request_.address);
-  key_stream >> key;
+  uint32_t key = 0;
+  const BufferSlice& address = request_.address;
+  for (size_t i = 0; (i < address.size()) && isdigit(address.data()[i]); i++) {
+    key = key * 10 + (address.data()[i] - '0');
+  }
   uint32_t value = 0;
   if (lf_hashtable_->lookup(key, value)) {
-    m_write_.lock();
+    char value_string[ResponseWriter::MaxDigits];
+    const size_t value_len = ResponseWriter::formatUint(value, value_string);
 
-    ostringstream value_stream;
-    value_stream << value;
-    out_.write("HTTP/1.1 200 OK\r\n");
-    out_.write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
-    out_.write("Server: Lab02a\r\n");
-    out_.write("Accept-Ranges: bytes\r\n");
-
-    ostringstream os;
-    os << "Content-Length: " << value_stream.str().size() << "\r\n";
-    out_.write(os.str().c_str());
-    out_.write("Content-Type: text/html\r\n");
-    out_.write("\r\n");
-
-    out_.write(value_stream.str().c_str());
- 
+    m_write_.lock();
+    writeResponse(MemPiece(value_string, value_len));
     m_write_.unlock();
 
   } else {
 
     m_write_.lock();
-  
-    out_.write("HTTP/1.1 200 OK\r\n");
-    out_.write("Date: Wed, 28 Oct 2009 15:24:11 GMT\r\n");
-    out_.write("Server: Lab02a\r\n");
-    out_.write("Accept-Ranges: bytes\r\n");
-
-    out_.write("Content-Length: 0\r\n");
-    out_.write("Content-Type: text/html\r\n");
-    out_.write("\r\n");
-    out_.write("value corresponding to the key not found\r\n");
-    
+    writeResponse("value corresponding to the key not found\r\n");
     m_write_.unlock();
   }
 
@@ -129,9 +109,23 @@ bool KVServerConnection::handleRequest(Request* requst) {
   return true;
 }
 
+void KVServerConnection::writeResponse(const MemPiece& body) {
+  ResponseWriter writer(&out_);
+  writer.statusLine(ResponseWriter::OK);
+  writer.header("Date", "Wed, 28 Oct 2009 15:24:11 GMT");
+  writer.header("Server", "Lab02a");
+  writer.header("Accept-Ranges", "bytes");
+  writer.header("Content-Length", body.len());
+  writer.header("Content-Type", "text/html");
+  writer.endHeaders();
+  writer.body(body);
+}
+
 KVClientConnection::KVClientConnection(KVService* service)
   : Connection(service->service_manager()->io_manager()),
-    my_service_(service) { }
+    my_service_(service) {
+  setRunInline(service->runInline());
+}
 
 void KVClientConnection::connect(const string& host,
                                  int port,
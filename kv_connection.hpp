@@ -36,7 +36,11 @@ private:
   virtual bool readDone();
 
   bool handleRequest(Request* request);
-  
+
+  // Writes a successful response carrying 'body' to out_.
+  // REQUIRES: m_write_ is held
+  void writeResponse(const base::MemPiece& body);
+
   // Non-copyable, non-assignalble
   KVServerConnection(const KVServerConnection&);
   KVServerConnection& operator=(const KVServerConnection&);
@@ -10,8 +10,9 @@ using base::makeCallableMany;
 
 KVService::KVService(int port, ServiceManager* service_manager)
   : service_manager_(service_manager),
-    stats_(service_manager->num_workers()),
-    lf_hashtable_(service_manager->num_workers()) {
+    stats_(service_manager->num_threads()),
+    lf_hashtable_(service_manager->num_threads()),
+    run_inline_(false) {
   AcceptCallback* cb = makeCallableMany(&KVService::acceptConnection, this);
   service_manager_->registerAcceptor(port, cb);
 }
@@ -1,6 +1,7 @@
 #ifndef MCP_KV_SERVICE_HEADER
 #define MCP_KV_SERVICE_HEADER
 
+#include "connection.hpp"
 #include "service_manager.hpp"
 #include "lock_free_hash_table.hpp"
 #include "request_stats.hpp"
@@ -10,6 +11,7 @@ namespace kv {
 
 using std::string;
 using base::AcceptCallback;
+using base::Connection;
 using base::Notification;
 using base::RequestStats;
 using base::ServiceManager;
@@ -29,16 +31,33 @@ public:
   void asyncConnect(const string& host, int post, KVConnectCallback* cb);
 
   void connect(const string& host, int port, KVClientConnection** conn); 
+
+  // If 'run_inline' is true, connections created from now on --
+  // server and client side -- handle their requests and responses
+  // right on the polling thread (see Connection::setRunInline()).
+  // KV lookups are short enough for that to pay off.
+  void setRunInline(bool run_inline) { run_inline_ = run_inline; }
+
+  // Sets the timeouts of the server connections accepted from now on
+  // (see Connection::Timeouts). None, by default.
+  void setTimeouts(const Connection::Timeouts& timeouts) {
+    timeouts_ = timeouts;
+  }
+
   // accessors
 
   ServiceManager* service_manager() { return service_manager_; }
   LockFreeHashTable* lf_hashtable() { return &lf_hashtable_; }
   RequestStats* stats() { return &stats_; }
+  bool runInline() const { return run_inline_; }
+  const Connection::Timeouts& timeouts() const { return timeouts_; }
 
 private:
   ServiceManager* service_manager_;  // not owned here
   RequestStats stats_;
   LockFreeHashTable lf_hashtable_;
+  bool run_inline_;
+  Connection::Timeouts timeouts_;
 
   void acceptConnection(int clinet_fd);
 
@@ -0,0 +1,52 @@
+#include "memory_budget.hpp"
+
+namespace base {
+
+MemoryBudget::MemoryBudget(size_t max_bytes, size_t max_bytes_per_owner)
+  : max_bytes_(max_bytes),
+    max_bytes_per_owner_(max_bytes_per_owner),
+    bytes_(0),
+    peak_bytes_(0),
+    pauses_(0),
+    resumes_(0),
+    overflows_(0) {
+}
+
+void MemoryBudget::setLimits(size_t max_bytes, size_t max_bytes_per_owner) {
+  max_bytes_ = max_bytes;
+  max_bytes_per_owner_ = max_bytes_per_owner;
+}
+
+void MemoryBudget::charge(size_t* charged, size_t bytes) {
+  if (bytes == *charged) {
+    return;
+  }
+
+  size_t total;
+  if (bytes > *charged) {
+    total = __sync_add_and_fetch(&bytes_, bytes - *charged);
+  } else {
+    total = __sync_sub_and_fetch(&bytes_, *charged - bytes);
+  }
+  *charged = bytes;
+
+  // Raise the peak, unless someone else raised it further already.
+  size_t peak = peak_bytes_;
+  while (total > peak) {
+    const size_t seen = __sync_val_compare_and_swap(&peak_bytes_, peak, total);
+    if (seen == peak) {
+      break;
+    }
+    peak = seen;
+  }
+}
+
+void MemoryBudget::getStats(Stats* stats) const {
+  stats->bytes = bytes_;
+  stats->peak_bytes = peak_bytes_;
+  stats->pauses = pauses_;
+  stats->resumes = resumes_;
+  stats->overflows = overflows_;
+}
+
+}  // namespace base
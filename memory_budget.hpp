@@ -0,0 +1,104 @@
+#ifndef MCP_BASE_MEMORY_BUDGET_HEADER
+#define MCP_BASE_MEMORY_BUDGET_HEADER
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace base {
+
+// A MemoryBudget accounts for the bytes a group of owners (e.g.,
+// Connections) hold in their buffers. There are two limits: one for
+// each owner and one for all of them together. The budget does not
+// enforce anything by itself; owners charge what they hold and ask
+// whether they are over a limit, and it is up to them to stop
+// growing (e.g., by pausing reads) until they fall back under it.
+//
+// Each owner keeps its current charge in a size_t of its own, which
+// it passes to charge(). Only the process-wide total lives here.
+//
+// Thread safety:
+//
+//   All methods can be called concurrently. An owner's charge is
+//   not protected here, so calls to charge() for the same owner must
+//   be serialized by the owner. The counters getStats() reports are
+//   updated with atomic instructions and may be slightly stale.
+//
+// Usage:
+//
+//   MemoryBudget budget(1<<30 /* total */, 4<<20 /* per owner */);
+//   size_t charged = 0;
+//   budget.charge(&charged, buf.byteCount());
+//   if (budget.overLimit(charged)) {
+//     budget.notePause();
+//     stop reading until the buffer drains;
+//   }
+//   ...
+//   budget.charge(&charged, 0);  // before the owner goes away
+//
+
+class MemoryBudget {
+public:
+  struct Stats {
+    uint64_t bytes;         // currently charged, all owners
+    uint64_t peak_bytes;    // highest 'bytes' seen
+    uint64_t pauses;        // times an owner stopped reading
+    uint64_t resumes;       // times an owner started reading again
+    uint64_t overflows;     // owners dropped for going over their limit
+  };
+
+  MemoryBudget(size_t max_bytes, size_t max_bytes_per_owner);
+  ~MemoryBudget() {}
+
+  // Changes the limits. Owners will notice at their next check.
+  void setLimits(size_t max_bytes, size_t max_bytes_per_owner);
+
+  // Moves the owner whose charge is '*charged' to 'bytes', adjusting
+  // the total accordingly.
+  void charge(size_t* charged, size_t bytes);
+
+  // Returns true if an owner holding 'charged' bytes is over its
+  // limit or if the total is.
+  bool overLimit(size_t charged) const {
+    return (charged > max_bytes_per_owner_) || (bytes_ > max_bytes_);
+  }
+
+  // Returns true if an owner that is over its limit holds little
+  // enough, 'charged' bytes, to start growing again. There is some
+  // slack between this and overLimit() so that an owner does not
+  // flip between the two on every byte it sends.
+  bool underLowWater(size_t charged) const {
+    return (charged <= max_bytes_per_owner_ / 2) &&
+           (bytes_ <= max_bytes_ - max_bytes_ / 4);
+  }
+
+  void notePause()     { __sync_fetch_and_add(&pauses_, 1); }
+  void noteResume()    { __sync_fetch_and_add(&resumes_, 1); }
+  void noteOverflow()  { __sync_fetch_and_add(&overflows_, 1); }
+
+  // Fills 'stats' with the counters accumulated so far.
+  void getStats(Stats* stats) const;
+
+  // accessors
+
+  size_t maxBytes() const           { return max_bytes_; }
+  size_t maxBytesPerOwner() const   { return max_bytes_per_owner_; }
+
+private:
+  volatile size_t    max_bytes_;
+  volatile size_t    max_bytes_per_owner_;
+
+  // Changed only with atomic instructions.
+  volatile size_t    bytes_;
+  volatile size_t    peak_bytes_;
+  uint64_t           pauses_;
+  uint64_t           resumes_;
+  uint64_t           overflows_;
+
+  // Non-copyable, non-assignable
+  MemoryBudget(const MemoryBudget&);
+  MemoryBudget& operator=(const MemoryBudget&);
+};
+
+}  // namespace base
+
+#endif  // MCP_BASE_MEMORY_BUDGET_HEADER
@@ -0,0 +1,88 @@
+#include "memory_budget.hpp"
+#include "test_unit.hpp"
+
+namespace {
+
+using base::MemoryBudget;
+
+TEST(Charge, TotalAndPeak) {
+  MemoryBudget budget(1000, 100);
+  MemoryBudget::Stats stats;
+
+  size_t a = 0;
+  size_t b = 0;
+  budget.charge(&a, 60);
+  budget.charge(&b, 30);
+  budget.charge(&a, 10);
+  EXPECT_EQ(a, 10);
+
+  budget.getStats(&stats);
+  EXPECT_EQ(stats.bytes, 40);
+  EXPECT_EQ(stats.peak_bytes, 90);
+
+  budget.charge(&a, 0);
+  budget.charge(&b, 0);
+  budget.getStats(&stats);
+  EXPECT_EQ(stats.bytes, 0);
+  EXPECT_EQ(stats.peak_bytes, 90);
+}
+
+TEST(Limits, PerOwner) {
+  MemoryBudget budget(1000, 100);
+
+  size_t a = 0;
+  budget.charge(&a, 100);
+  EXPECT_FALSE(budget.overLimit(a));
+  budget.charge(&a, 101);
+  EXPECT_TRUE(budget.overLimit(a));
+
+  // Falling just under the limit is not enough to grow again.
+  budget.charge(&a, 99);
+  EXPECT_FALSE(budget.underLowWater(a));
+  budget.charge(&a, 50);
+  EXPECT_TRUE(budget.underLowWater(a));
+
+  budget.charge(&a, 0);
+}
+
+TEST(Limits, AllOwners) {
+  MemoryBudget budget(1000, 600);
+
+  size_t a = 0;
+  size_t b = 0;
+  budget.charge(&a, 500);
+  budget.charge(&b, 501);
+  EXPECT_TRUE(budget.overLimit(0));
+  EXPECT_FALSE(budget.underLowWater(0));
+
+  budget.charge(&b, 250);
+  EXPECT_FALSE(budget.overLimit(0));
+  EXPECT_TRUE(budget.underLowWater(0));
+
+  budget.setLimits(500, 600);
+  EXPECT_TRUE(budget.overLimit(0));
+
+  budget.charge(&a, 0);
+  budget.charge(&b, 0);
+}
+
+TEST(Counters, Events) {
+  MemoryBudget budget(1000, 100);
+  MemoryBudget::Stats stats;
+
+  budget.notePause();
+  budget.notePause();
+  budget.noteResume();
+  budget.noteOverflow();
+
+  budget.getStats(&stats);
+  EXPECT_EQ(stats.pauses, 2);
+  EXPECT_EQ(stats.resumes, 1);
+  EXPECT_EQ(stats.overflows, 1);
+}
+
+} // unnamed namespace
+
+int main(int argc, char *argv[]) {
+  return RUN_TESTS(argc, argv);
+}
@@ -0,0 +1,150 @@
+#ifndef MCP_BASE_MPMC_QUEUE_HEADER
+#define MCP_BASE_MPMC_QUEUE_HEADER
+
+#include <inttypes.h>
+
+#include "cpu_arch.hpp"
+
+namespace base {
+
+// A bounded, lock-free, multi-producer multi-consumer FIFO queue,
+// after Dmitry Vyukov's "Bounded MPMC queue" (1024cores.net).
+//
+// The queue is a ring of cells, each with a sequence number telling
+// which lap of the ring the cell is ready for. A producer claims the
+// next position by moving 'enqueue_pos_' with a CAS, once the cell
+// there says it is free for that position; it then writes the value
+// and publishes it by advancing the cell's sequence. Consumers do the
+// converse on 'dequeue_pos_'. Producers and consumers thus contend
+// only among themselves, each side on a cache line of its own, and
+// no one waits for a slow peer except for the cell it is after.
+//
+// T must be copyable. Values left in the queue at destruction are
+// not disposed of.
+//
+// Thread Safety:
+//
+//   All calls but the destructor are thread-safe.
+//
+template<typename T>
+class MPMCQueue {
+public:
+  // Builds a queue with room for 'capacity' values, which must be a
+  // power of two.
+  explicit MPMCQueue(int capacity);
+  ~MPMCQueue();
+
+  // Adds 'value' at the tail. Returns false, and doesn't add it, if
+  // the queue is full.
+  bool push(const T& value);
+
+  // Removes the value at the head into 'value'. Returns false if the
+  // queue is empty, or if the value at the head is still being
+  // written.
+  bool pop(T* value);
+
+  // Returns how many values are in the queue. The count is a
+  // snapshot and may be off by the pushes and pops under way.
+  int size() const;
+
+  int capacity() const { return mask_ + 1; }
+
+private:
+  struct Cell {
+    volatile uint64_t seq;
+    T                 value;
+  };
+
+  Cell* const       cells_;         // owned here
+  const uint64_t    mask_;
+  char              pad0_[CacheArch::LINE_SIZE];
+  volatile uint64_t enqueue_pos_;
+  char              pad1_[CacheArch::LINE_SIZE];
+  volatile uint64_t dequeue_pos_;
+  char              pad2_[CacheArch::LINE_SIZE];
+
+  // Non-copyable, non-assignable.
+  MPMCQueue(const MPMCQueue&);
+  MPMCQueue& operator=(const MPMCQueue&);
+};
+
+template<typename T>
+MPMCQueue<T>::MPMCQueue(int capacity)
+  : cells_(new Cell[capacity]),
+    mask_(capacity - 1),
+    enqueue_pos_(0),
+    dequeue_pos_(0) {
+  for (int i = 0; i < capacity; i++) {
+    cells_[i].seq = i;
+  }
+}
+
+template<typename T>
+MPMCQueue<T>::~MPMCQueue() {
+  delete [] cells_;
+}
+
+template<typename T>
+bool MPMCQueue<T>::push(const T& value) {
+  uint64_t pos = enqueue_pos_;
+  Cell* cell;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    const int64_t dif = int64_t(cell->seq) - int64_t(pos);
+    if (dif == 0) {
+      const uint64_t seen =
+        __sync_val_compare_and_swap(&enqueue_pos_, pos, pos + 1);
+      if (seen == pos) {
+        break;
+      }
+      pos = seen;
+    } else if (dif < 0) {
+      return false;   // the cell still holds the value a lap behind
+    } else {
+      pos = enqueue_pos_;
+    }
+  }
+
+  cell->value = value;
+  __sync_synchronize();
+  cell->seq = pos + 1;
+  return true;
+}
+
+template<typename T>
+bool MPMCQueue<T>::pop(T* value) {
+  uint64_t pos = dequeue_pos_;
+  Cell* cell;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    const int64_t dif = int64_t(cell->seq) - int64_t(pos + 1);
+    if (dif == 0) {
+      const uint64_t seen =
+        __sync_val_compare_and_swap(&dequeue_pos_, pos, pos + 1);
+      if (seen == pos) {
+        break;
+      }
+      pos = seen;
+    } else if (dif < 0) {
+      return false;   // nothing was written there for this lap yet
+    } else {
+      pos = dequeue_pos_;
+    }
+  }
+
+  *value = cell->value;
+  __sync_synchronize();
+  cell->seq = pos + mask_ + 1;
+  return true;
+}
+
+template<typename T>
+int MPMCQueue<T>::size() const {
+  const uint64_t head = dequeue_pos_;
+  const uint64_t tail = enqueue_pos_;
+  return tail > head ? int(tail - head) : 0;
+}
+
+} // namespace base
+
+#endif // MCP_BASE_MPMC_QUEUE_HEADER
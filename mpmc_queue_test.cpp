@@ -0,0 +1,151 @@
+#include <pthread.h>
+
+#include "callback.hpp"
+#include "mpmc_queue.hpp"
+#include "test_unit.hpp"
+#include "thread.hpp"
+
+namespace {
+
+using base::Callback;
+using base::makeCallableOnce;
+using base::makeThread;
+using base::MPMCQueue;
+
+TEST(Basics, FIFO) {
+  MPMCQueue<int> q(8);
+  int value = -1;
+  EXPECT_FALSE(q.pop(&value));
+  EXPECT_EQ(q.size(), 0);
+
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(q.push(i));
+  }
+  EXPECT_EQ(q.size(), 5);
+  for (int i = 0; i < 5; i++) {
+    EXPECT_TRUE(q.pop(&value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(q.pop(&value));
+}
+
+TEST(Basics, Full) {
+  MPMCQueue<int> q(4);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(q.push(i));
+  }
+  EXPECT_FALSE(q.push(4));
+  EXPECT_EQ(q.size(), 4);
+
+  int value = -1;
+  EXPECT_TRUE(q.pop(&value));
+  EXPECT_EQ(value, 0);
+  EXPECT_TRUE(q.push(4));
+  EXPECT_FALSE(q.push(5));
+}
+
+TEST(Basics, WrapAround) {
+  MPMCQueue<int> q(4);
+  int value = -1;
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(q.push(i));
+    EXPECT_TRUE(q.push(-i));
+    EXPECT_TRUE(q.pop(&value));
+    EXPECT_EQ(value, i);
+    EXPECT_TRUE(q.pop(&value));
+    EXPECT_EQ(value, -i);
+  }
+  EXPECT_EQ(q.size(), 0);
+}
+
+// Producers push disjoint ranges of numbers; consumers pop until they
+// have seen all of them. Each number must come out exactly once, and
+// each producer's numbers in order.
+class Tester {
+public:
+  Tester(MPMCQueue<int>* q, int num_producers, int per_producer)
+    : q_(q),
+      num_producers_(num_producers),
+      per_producer_(per_producer),
+      popped_(0),
+      sum_(0),
+      in_order_(true) {
+  }
+
+  void produce(int producer) {
+    const int first = producer * per_producer_;
+    for (int i = first; i < first + per_producer_; i++) {
+      while (! q_->push(i)) {
+        sched_yield();
+      }
+    }
+  }
+
+  void consume() {
+    int last[MaxProducers];
+    for (int i = 0; i < num_producers_; i++) {
+      last[i] = -1;
+    }
+
+    const int total = num_producers_ * per_producer_;
+    while (*(volatile int*)&popped_ < total) {
+      int value;
+      if (! q_->pop(&value)) {
+        sched_yield();
+        continue;
+      }
+      const int producer = value / per_producer_;
+      if (value <= last[producer]) {
+        in_order_ = false;
+      }
+      last[producer] = value;
+      __sync_fetch_and_add(&sum_, value);
+      __sync_fetch_and_add(&popped_, 1);
+    }
+  }
+
+  int64_t sum() const { return sum_; }
+  bool inOrder() const { return in_order_; }
+
+  static const int MaxProducers = 8;
+
+private:
+  MPMCQueue<int>* q_;
+  const int       num_producers_;
+  const int       per_producer_;
+  int             popped_;
+  int64_t         sum_;
+  bool            in_order_;
+};
+
+TEST(Concurrency, ProducersAndConsumers) {
+  const int NUM_PRODUCERS = 4;
+  const int NUM_CONSUMERS = 4;
+  const int PER_PRODUCER = 100000;
+
+  MPMCQueue<int> q(64);
+  Tester tester(&q, NUM_PRODUCERS, PER_PRODUCER);
+
+  pthread_t tids[NUM_PRODUCERS + NUM_CONSUMERS];
+  for (int i = 0; i < NUM_CONSUMERS; i++) {
+    tids[i] = makeThread(makeCallableOnce(&Tester::consume, &tester));
+  }
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    tids[NUM_CONSUMERS + i] =
+      makeThread(makeCallableOnce(&Tester::produce, &tester, i));
+  }
+  for (int i = 0; i < NUM_PRODUCERS + NUM_CONSUMERS; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  const int64_t n = NUM_PRODUCERS * PER_PRODUCER;
+  EXPECT_EQ(tester.sum(), n * (n - 1) / 2);
+  EXPECT_TRUE(tester.inOrder());
+  EXPECT_EQ(q.size(), 0);
+}
+
+}  // unnamed namespace
+
+int main(int argc, char* argv[]) {
+  return RUN_TESTS(argc, argv);
+}
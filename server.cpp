@@ -2,18 +2,27 @@
 #include <sstream>
 
 #include "acceptor.hpp"
+#include "descriptor_poller.hpp"
 #include "http_service.hpp"
+#include "io_manager.hpp"
 #include "kv_service.hpp"
 
 using base::AcceptCallback;
+using base::Connection;
+using base::DescriptorPoller;
+using base::IOManager;
 using base::ServiceManager;
+using base::ThreadAffinity;
 using base::makeCallableMany;
 using http::HTTPService;
 using kv::KVService;
 
 int main(int argc, char* argv[]) {
-  if (argc != 3) {
-    std::cout << "Usage: " << argv[0] << " <port> <num-threads>" << std::endl;
+  if ((argc < 3) || (argc > 7)) {
+    std::cout << "Usage: " << argv[0]
+              << " <port> <num-threads> [<num-reactors> [epoll|uring"
+              << " [fast|stealing [none|compact|scatter|node|<cpu-list>]]]]"
+              << std::endl;
     return 1;
   }
 
@@ -28,12 +37,61 @@ int main(int argc, char* argv[]) {
   std::istringstream thread_stream(argv[2]);
   thread_stream >> num_workers;
 
+  // Parse number of polling threads, if given.
+  int num_reactors = 1;
+  if (argc >= 4) {
+    std::istringstream reactor_stream(argv[3]);
+    reactor_stream >> num_reactors;
+  }
+
+  // Pick the polling mechanism, if given. The io_uring one falls back
+  // to epoll where the kernel doesn't support it.
+  if (argc >= 5) {
+    const std::string backend(argv[4]);
+    if (backend == "uring") {
+      DescriptorPoller::setDefaultBackend(DescriptorPoller::URING);
+    } else if (backend != "epoll") {
+      std::cout << "Unknown poller " << backend << std::endl;
+      return 1;
+    }
+  }
+
+  // Pick the workers' thread pool, if given.
+  if (argc >= 6) {
+    const std::string pool(argv[5]);
+    if (pool == "stealing") {
+      IOManager::setDefaultPool(IOManager::STEALING);
+    } else if (pool != "fast") {
+      std::cout << "Unknown thread pool " << pool << std::endl;
+      return 1;
+    }
+  }
+
   // Setup the protocols. The HTTP server accepts requests to stop the
   // IOService machinery and requests for its stats.
-  ServiceManager service(num_workers);
+  ServiceManager service(num_workers, num_reactors);
+
+  // Pin the threads to CPUs, if asked to.
+  if (argc == 7) {
+    ThreadAffinity affinity;
+    if (! ThreadAffinity::parse(argv[6], &affinity)) {
+      std::cout << "Unknown CPU affinity " << argv[6] << std::endl;
+      return 1;
+    }
+    service.setAffinity(affinity);
+  }
   HTTPService http_service(http_port, &service);
   KVService kv_service(kv_port, &service);
 
+  // Drop the clients that linger, so that they don't run us out of
+  // file descriptors and memory.
+  Connection::Timeouts timeouts;
+  timeouts.idle = 60;
+  timeouts.header_read = 10;
+  timeouts.write_stall = 30;
+  http_service.setTimeouts(timeouts);
+  kv_service.setTimeouts(timeouts);
+
   // Loop until IOService is stopped via /quit request against the
   // HTTP Service.
   service.run();
@@ -1,13 +1,17 @@
+#include "cpu_topology.hpp"
+#include "logging.hpp"
 #include "service_manager.hpp"
 
 namespace base {
 
-ServiceManager::ServiceManager(int num_workers)
+ServiceManager::ServiceManager(int num_workers, int num_reactors)
   : num_workers_(num_workers),
-    io_manager_(new IOManager(num_workers)),
+    io_manager_(new IOManager(num_workers, num_reactors)),
     stop_requested_(false),
     stopped_(false) {
- }
+  LOG(LogMessage::NORMAL) << "CPU topology: "
+                          << CpuTopology::machine().toString();
+}
 
 ServiceManager::~ServiceManager() {
   // It would be problematic if run() was still running after the
@@ -97,6 +101,10 @@ void ServiceManager::stop() {
   m_stop_.unlock();
 }
 
+void ServiceManager::setAffinity(const ThreadAffinity& affinity) {
+  io_manager_->setAffinity(affinity);
+}
+
 bool ServiceManager::stopped() const {
   ScopedLock l(&m_stop_);
   return stop_requested_;
@@ -17,9 +17,10 @@ using std::vector;
 // handling can start and stop in unison. Stats reporting can also be
 // done on the collective of protocols.
 //
-// Internally, the ServiceManager uses one dedicated thread for
-// pooling for ready sockets (including listening ones) and a thread
-// pool to serve the callbacks associated with these sockets.
+// Internally, the ServiceManager uses one or more dedicated threads
+// ('reactors') for pooling for ready sockets (including listening
+// ones) and a thread pool to serve the callbacks associated with
+// these sockets.
 //
 // Thread Safety:
 //
@@ -29,7 +30,11 @@ using std::vector;
 //
 class ServiceManager {
 public:
-  explicit ServiceManager(int num_workers = 1);
+  // Builds a ServiceManager whose io_manager polls with
+  // 'num_reactors' threads and serves callbacks with 'num_workers'
+  // threads. See IOManager for how these work together. Logs the
+  // machine's CPU topology, which setAffinity() places threads on.
+  explicit ServiceManager(int num_workers = 1, int num_reactors = 1);
 
   // Destroys an ServiceManager that was start()-ed or not.
   //
@@ -57,9 +62,15 @@ public:
   // Returns true if stop() was issued.
   bool stopped() const;
 
+  // Pins the service's threads to CPUs; see IOManager::setAffinity().
+  // Must be issued before run().
+  void setAffinity(const ThreadAffinity& affinity);
+
   // accessors
 
   int num_workers() { return num_workers_; }
+  int num_reactors() { return io_manager_->numReactors(); }
+  int num_threads() { return io_manager_->numThreads(); }
   IOManager* io_manager() { return io_manager_; }
 
 private:
@@ -0,0 +1,109 @@
+#include "task_generations.hpp"
+
+namespace base {
+
+TaskGenerations::TaskGenerations(int num_workers)
+  : gen_(0),
+    counts_(new Counts[num_workers]),
+    num_workers_(num_workers) {
+  for (int i = 0; i < NumGens; i++) {
+    ext_adds_[i] = 0;
+  }
+  for (int i = 0; i < num_workers; i++) {
+    for (int j = 0; j < NumGens; j++) {
+      counts_[i].adds[j] = 0;
+      counts_[i].finishes[j] = 0;
+    }
+  }
+}
+
+TaskGenerations::~TaskGenerations() {
+  delete [] counts_;
+}
+
+int TaskGenerations::added(int worker, int n) {
+  // The count must be visible before the generation moves past the
+  // one it is in, or a drained() check could miss it. If the
+  // generation moved on meanwhile, take the count back and retry.
+  while (true) {
+    const uint64_t gen = gen_;
+    const int bucket = gen % NumGens;
+    if (worker != NotAWorker) {
+      counts_[worker].adds[bucket] += n;
+      __sync_synchronize();
+    } else {
+      __sync_fetch_and_add(&ext_adds_[bucket], n);
+    }
+
+    if (gen_ == gen) {
+      return bucket;
+    }
+
+    if (worker != NotAWorker) {
+      counts_[worker].adds[bucket] -= n;
+    } else {
+      __sync_fetch_and_sub(&ext_adds_[bucket], n);
+    }
+  }
+}
+
+void TaskGenerations::finished(int worker, int bucket) {
+  __sync_synchronize();
+  counts_[worker].finishes[bucket]++;
+}
+
+uint64_t TaskGenerations::epoch() const {
+  // Tasks added so far are in the current generation or older.
+  tryAdvance();
+  return gen_ + 1;
+}
+
+bool TaskGenerations::passed(uint64_t epoch) const {
+  if (gen_ < epoch) {
+    tryAdvance();
+  }
+  const uint64_t gen = gen_;
+  if (gen < epoch) {
+    return false;
+  }
+
+  // Generations up to 'gen' - NumGens were drained before 'gen'
+  // started. The later ones below 'epoch' no longer get tasks but may
+  // still be running some.
+  for (uint64_t g = epoch - 1; g + NumGens > gen; g--) {
+    if (! drained(g % NumGens)) {
+      return false;
+    }
+    if (g == 0) {
+      break;
+    }
+  }
+  return true;
+}
+
+void TaskGenerations::tryAdvance() const {
+  // The next generation reuses the bucket of the one NumGens back, so
+  // every task there must be done first.
+  const uint64_t gen = gen_;
+  if (drained((gen + 1) % NumGens)) {
+    __sync_bool_compare_and_swap(&gen_, gen, gen + 1);
+  }
+}
+
+bool TaskGenerations::drained(int bucket) const {
+  // Finishes are read before adds: a task counted as finished was
+  // counted as added earlier, so if the sums match, every task added
+  // before the finishes were read is done.
+  uint64_t finishes = 0;
+  for (int i = 0; i < num_workers_; i++) {
+    finishes += counts_[i].finishes[bucket];
+  }
+  __sync_synchronize();
+  uint64_t adds = ext_adds_[bucket];
+  for (int i = 0; i < num_workers_; i++) {
+    adds += counts_[i].adds[bucket];
+  }
+  return finishes == adds;
+}
+
+} // namespace base
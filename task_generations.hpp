@@ -0,0 +1,78 @@
+#ifndef MCP_BASE_TASK_GENERATIONS_HEADER
+#define MCP_BASE_TASK_GENERATIONS_HEADER
+
+#include <inttypes.h>
+
+#include "cpu_arch.hpp"
+
+namespace base {
+
+// Tells when the tasks a thread pool was given up to a point are all
+// done, without numbering them in any order, so that the pool can
+// queue and hand off tasks without a lock. This is what backs
+// WorkerPool::epoch() and passed().
+//
+// Each task is tagged with the generation current when it is added,
+// and each worker counts, per generation, the tasks it added and the
+// tasks it ran. The generation moves on once the oldest one still
+// tracked has no task left: only NumGens generations are tracked, in
+// buckets reused round-robin. An epoch is the generation after the
+// current one.
+//
+// Thread Safety:
+//
+//   All calls are thread-safe. A worker's counts are written only by
+//   that worker; those of threads outside the pool are updated with
+//   atomic instructions.
+//
+class TaskGenerations {
+public:
+  // Tracks the tasks of a pool with 'num_workers' workers.
+  explicit TaskGenerations(int num_workers);
+  ~TaskGenerations();
+
+  // Counts 'n' tasks as added by the pool's worker 'worker', or by a
+  // thread outside the pool if 'worker' is NotAWorker. Returns the
+  // bucket the tasks should be tagged with.
+  static const int NotAWorker = -1;
+  int added(int worker, int n);
+
+  // Counts a task tagged with 'bucket' as run by 'worker'. The call
+  // must come after the task is done with whatever it used.
+  void finished(int worker, int bucket);
+
+  // Returns a mark covering every task added so far.
+  uint64_t epoch() const;
+
+  // Returns true if every task covered by 'epoch' has finished.
+  bool passed(uint64_t epoch) const;
+
+private:
+  static const int NumGens = 4;
+
+  // A worker's counts, in a cache line of their own.
+  struct Counts {
+    volatile uint64_t adds[NumGens];
+    volatile uint64_t finishes[NumGens];
+    char pad[CacheArch::LINE_SIZE - 2 * NumGens * sizeof(uint64_t)];
+  };
+
+  mutable volatile uint64_t gen_;
+  volatile uint64_t         ext_adds_[NumGens];
+  Counts*                   counts_;       // owned here; one per worker
+  const int                 num_workers_;
+
+  // Moves the generation on if the bucket it would reuse is drained.
+  void tryAdvance() const;
+
+  // Returns true if every task counted in 'bucket' has finished.
+  bool drained(int bucket) const;
+
+  // Non-copyable, non-assignable.
+  TaskGenerations(const TaskGenerations&);
+  TaskGenerations& operator=(const TaskGenerations&);
+};
+
+} // namespace base
+
+#endif // MCP_BASE_TASK_GENERATIONS_HEADER
@@ -0,0 +1,200 @@
+#include <sched.h>     // cpu_set_t
+#include <string.h>    // strerror
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <utility>
+
+#include "logging.hpp"
+#include "thread_affinity.hpp"
+
+namespace base {
+
+using std::make_pair;
+using std::map;
+using std::pair;
+
+namespace {
+
+// A CPU and the keys it is ordered by.
+struct Placed {
+  int id;
+  int keys[3];
+
+  bool operator<(const Placed& other) const {
+    for (int i = 0; i < 3; i++) {
+      if (keys[i] != other.keys[i]) {
+        return keys[i] < other.keys[i];
+      }
+    }
+    return id < other.id;
+  }
+};
+
+// Fills 'ids' with the CPUs of 'topology', packed by node, package
+// and core.
+void compactOrder(const CpuTopology& topology, vector<int>* ids) {
+  const vector<CpuTopology::Cpu>& cpus = topology.cpus();
+  vector<Placed> placed(cpus.size());
+  for (size_t i = 0; i < cpus.size(); i++) {
+    placed[i].id = cpus[i].id;
+    placed[i].keys[0] = cpus[i].node;
+    placed[i].keys[1] = cpus[i].package;
+    placed[i].keys[2] = cpus[i].core;
+  }
+  std::sort(placed.begin(), placed.end());
+  ids->clear();
+  for (size_t i = 0; i < placed.size(); i++) {
+    ids->push_back(placed[i].id);
+  }
+}
+
+// Fills 'ids' with the CPUs of 'topology', the first sibling of the
+// first core of every node, then of the second core, and so on; the
+// second siblings follow.
+void scatterOrder(const CpuTopology& topology, vector<int>* ids) {
+  // Going through the CPUs packed, number each core within its node
+  // and each CPU within its core.
+  vector<int> packed;
+  compactOrder(topology, &packed);
+  map<int, const CpuTopology::Cpu*> by_id;
+  for (size_t i = 0; i < topology.cpus().size(); i++) {
+    by_id[topology.cpus()[i].id] = &topology.cpus()[i];
+  }
+
+  map<int, int> cores_in_node;
+  map<pair<int, int>, int> core_rank;
+  map<pair<int, int>, int> siblings_in_core;
+  vector<Placed> placed;
+  for (size_t i = 0; i < packed.size(); i++) {
+    const CpuTopology::Cpu& cpu = *by_id[packed[i]];
+    const pair<int, int> core = make_pair(cpu.package, cpu.core);
+    if (core_rank.find(core) == core_rank.end()) {
+      core_rank[core] = cores_in_node[cpu.node]++;
+    }
+    Placed p;
+    p.id = cpu.id;
+    p.keys[0] = siblings_in_core[core]++;
+    p.keys[1] = core_rank[core];
+    p.keys[2] = cpu.node;
+    placed.push_back(p);
+  }
+  std::sort(placed.begin(), placed.end());
+  ids->clear();
+  for (size_t i = 0; i < placed.size(); i++) {
+    ids->push_back(placed[i].id);
+  }
+}
+
+}  // unnamed namespace
+
+ThreadAffinity::ThreadAffinity(Policy policy)
+  : policy_(policy == CPU_LIST ? NONE : policy) {
+}
+
+ThreadAffinity::ThreadAffinity(const vector<int>& cpus)
+  : policy_(cpus.empty() ? NONE : CPU_LIST),
+    cpus_(cpus) {
+}
+
+bool ThreadAffinity::parse(const string& spec, ThreadAffinity* affinity) {
+  if (spec == "none") {
+    *affinity = ThreadAffinity(NONE);
+  } else if (spec == "compact") {
+    *affinity = ThreadAffinity(COMPACT);
+  } else if (spec == "scatter") {
+    *affinity = ThreadAffinity(SCATTER);
+  } else if (spec == "node") {
+    *affinity = ThreadAffinity(PER_NODE);
+  } else {
+    vector<int> cpus;
+    if (! CpuTopology::parseList(spec, &cpus)) {
+      return false;
+    }
+    *affinity = ThreadAffinity(cpus);
+  }
+  return true;
+}
+
+void ThreadAffinity::cpusFor(const CpuTopology& topology,
+                             int slot,
+                             int num_slots,
+                             vector<int>* cpus) const {
+  cpus->clear();
+  if (topology.numCpus() == 0) {
+    return;
+  }
+
+  vector<int> order;
+  switch (policy_) {
+  case NONE:
+    return;
+
+  case COMPACT:
+    compactOrder(topology, &order);
+    break;
+
+  case SCATTER:
+    scatterOrder(topology, &order);
+    break;
+
+  case CPU_LIST:
+    order = cpus_;
+    break;
+
+  case PER_NODE: {
+    // Runs of slots as even as they can be; no more runs than slots.
+    const int n = std::max(num_slots, 1);
+    const int runs = std::min(topology.numNodes(), n);
+    const int run = long(slot % n) * runs / n;
+    topology.nodeCpus(topology.nodes()[run], cpus);
+    return;
+  }
+  }
+
+  cpus->push_back(order[slot % order.size()]);
+}
+
+bool ThreadAffinity::pin(pthread_t tid, int slot, int num_slots) const {
+  vector<int> cpus;
+  cpusFor(CpuTopology::machine(), slot, num_slots, &cpus);
+  if (cpus.empty()) {
+    return policy_ == NONE;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (cpus[i] < CPU_SETSIZE) {
+      CPU_SET(cpus[i], &set);
+    }
+  }
+  const int error = pthread_setaffinity_np(tid, sizeof(set), &set);
+  if (error != 0) {
+    LOG(LogMessage::WARNING) << "Can't pin thread to CPUs "
+                             << CpuTopology::listToString(cpus) << ": "
+                             << strerror(error);
+    return false;
+  }
+  return true;
+}
+
+string ThreadAffinity::toString() const {
+  switch (policy_) {
+  case COMPACT:  return "compact";
+  case SCATTER:  return "scatter";
+  case PER_NODE: return "node";
+  case CPU_LIST: break;
+  default:       return "none";
+  }
+
+  // The list's order matters; don't fold it into ranges.
+  std::ostringstream out;
+  for (size_t i = 0; i < cpus_.size(); i++) {
+    out << (i > 0 ? "," : "") << cpus_[i];
+  }
+  return out.str();
+}
+
+}  // namespace base
@@ -0,0 +1,86 @@
+#ifndef MCP_BASE_THREAD_AFFINITY_HEADER
+#define MCP_BASE_THREAD_AFFINITY_HEADER
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "cpu_topology.hpp"
+
+namespace base {
+
+using std::string;
+using std::vector;
+
+// Tells which CPUs each thread of a group should run on, so that the
+// threads stop migrating between cores or, worse, between sockets,
+// taking the data they work on across the interconnect with them.
+//
+// The threads of a group are numbered in 'slots' from 0 to
+// num_slots - 1, and each policy maps a slot to CPUs of the machine
+// (see CpuTopology):
+//
+//   NONE      leaves threads unpinned.
+//   COMPACT   one CPU per slot, filling a core, then its node, before
+//             moving on to the next. Threads share caches.
+//   SCATTER   one CPU per slot, spreading over the nodes first, then
+//             over their cores, and only then over hyperthread
+//             siblings. Threads get most of the machine to themselves.
+//   CPU_LIST  one CPU per slot, in the order of an explicit list.
+//   PER_NODE  all the CPUs of one node per slot. The slots are split
+//             in as many runs of consecutive slots as there are
+//             nodes, so that threads working together, numbered
+//             together, share a node.
+//
+// With more slots than CPUs, the CPUs are reused round-robin.
+//
+// Thread Safety:
+//
+//   An affinity is a value; its calls are thread-safe.
+//
+class ThreadAffinity {
+public:
+  enum Policy {
+    NONE,
+    COMPACT,
+    SCATTER,
+    CPU_LIST,
+    PER_NODE
+  };
+
+  // Builds a 'policy' affinity. CPU_LIST needs the constructor below.
+  explicit ThreadAffinity(Policy policy = NONE);
+
+  // Builds a CPU_LIST affinity over 'cpus'.
+  explicit ThreadAffinity(const vector<int>& cpus);
+
+  // Parses 'spec', one of "none", "compact", "scatter", "node" or a
+  // CPU list such as "0-3,8", into 'affinity'. Returns false if
+  // 'spec' is none of these.
+  static bool parse(const string& spec, ThreadAffinity* affinity);
+
+  // Fills 'cpus' with the CPUs of 'topology' the thread in 'slot' of
+  // 'num_slots' should run on. Leaves it empty for NONE.
+  void cpusFor(const CpuTopology& topology,
+               int slot,
+               int num_slots,
+               vector<int>* cpus) const;
+
+  // Pins the thread 'tid' to the CPUs of this machine for 'slot' of
+  // 'num_slots'. Returns false, and logs why, if the thread couldn't
+  // be pinned.
+  bool pin(pthread_t tid, int slot, int num_slots) const;
+
+  Policy policy() const { return policy_; }
+
+  // Returns the spec parse() would take for this affinity.
+  string toString() const;
+
+private:
+  Policy      policy_;
+  vector<int> cpus_;     // for CPU_LIST
+};
+
+}  // namespace base
+
+#endif // MCP_BASE_THREAD_AFFINITY_HEADER
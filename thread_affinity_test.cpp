@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "cpu_topology.hpp"
+#include "test_unit.hpp"
+#include "thread_affinity.hpp"
+
+namespace {
+
+using base::CpuTopology;
+using base::ThreadAffinity;
+using std::vector;
+
+// Two nodes, each a package of two cores with two hyperthreads. As
+// Linux usually numbers them, a CPU's sibling is four CPUs up:
+//
+//   node 0: core 0 = {0, 4}, core 1 = {1, 5}
+//   node 1: core 0 = {2, 6}, core 1 = {3, 7}
+//
+CpuTopology twoNodes() {
+  vector<CpuTopology::Cpu> cpus;
+  for (int i = 0; i < 8; i++) {
+    CpuTopology::Cpu cpu;
+    cpu.id = i;
+    cpu.node = (i % 4) / 2;
+    cpu.package = cpu.node;
+    cpu.core = i % 2;
+    cpus.push_back(cpu);
+  }
+  return CpuTopology(cpus);
+}
+
+// Returns the CPUs 'affinity' assigns to each of 'num_slots' slots,
+// one CPU per slot.
+vector<int> singleCpus(const ThreadAffinity& affinity,
+                       const CpuTopology& topology,
+                       int num_slots) {
+  vector<int> result;
+  for (int i = 0; i < num_slots; i++) {
+    vector<int> cpus;
+    affinity.cpusFor(topology, i, num_slots, &cpus);
+    result.push_back(cpus.size() == 1 ? cpus[0] : -1);
+  }
+  return result;
+}
+
+TEST(Topology, Counts) {
+  const CpuTopology topology = twoNodes();
+  EXPECT_EQ(topology.numCpus(), 8);
+  EXPECT_EQ(topology.numNodes(), 2);
+  EXPECT_EQ(topology.numPackages(), 2);
+  EXPECT_EQ(topology.numCores(), 4);
+  EXPECT_EQ(topology.toString(),
+            "2 nodes, 2 packages, 4 cores, 8 CPUs "
+            "(node 0: 0-1,4-5; node 1: 2-3,6-7)");
+
+  const CpuTopology& machine = CpuTopology::machine();
+  EXPECT_GT(machine.numCpus(), 0);
+  EXPECT_GT(machine.numNodes(), 0);
+}
+
+TEST(Topology, Lists) {
+  vector<int> ids;
+  EXPECT_TRUE(CpuTopology::parseList("0-3,8,10-11\n", &ids));
+  EXPECT_EQ(ids.size(), 7);
+  EXPECT_EQ(CpuTopology::listToString(ids), "0-3,8,10-11");
+
+  EXPECT_FALSE(CpuTopology::parseList("", &ids));
+  EXPECT_FALSE(CpuTopology::parseList("x", &ids));
+  EXPECT_FALSE(CpuTopology::parseList("3-1", &ids));
+  EXPECT_FALSE(CpuTopology::parseList("1,,2", &ids));
+  EXPECT_FALSE(CpuTopology::parseList("1-", &ids));
+}
+
+TEST(Policies, CompactAndScatter) {
+  const CpuTopology topology = twoNodes();
+
+  // Siblings first, then the other core of the node.
+  const int compact[] = { 0, 4, 1, 5, 2, 6, 3, 7, 0 };
+  vector<int> cpus = singleCpus(ThreadAffinity(ThreadAffinity::COMPACT),
+                                topology, 9);
+  EXPECT_TRUE(cpus == vector<int>(compact, compact + 9));
+
+  // Nodes first, then cores, then siblings.
+  const int scatter[] = { 0, 2, 1, 3, 4, 6, 5, 7, 0 };
+  cpus = singleCpus(ThreadAffinity(ThreadAffinity::SCATTER), topology, 9);
+  EXPECT_TRUE(cpus == vector<int>(scatter, scatter + 9));
+
+  vector<int> none;
+  ThreadAffinity().cpusFor(topology, 0, 1, &none);
+  EXPECT_TRUE(none.empty());
+}
+
+TEST(Policies, ListAndNodes) {
+  const CpuTopology topology = twoNodes();
+
+  ThreadAffinity affinity;
+  EXPECT_TRUE(ThreadAffinity::parse("3,1-2", &affinity));
+  EXPECT_EQ(affinity.policy(), ThreadAffinity::CPU_LIST);
+  EXPECT_EQ(affinity.toString(), "3,1,2");
+  const int list[] = { 3, 1, 2, 3, 1 };
+  vector<int> cpus = singleCpus(affinity, topology, 5);
+  EXPECT_TRUE(cpus == vector<int>(list, list + 5));
+
+  // Five slots: three on the first node, two on the second.
+  EXPECT_TRUE(ThreadAffinity::parse("node", &affinity));
+  EXPECT_EQ(affinity.policy(), ThreadAffinity::PER_NODE);
+  vector<int> node0;
+  vector<int> node1;
+  topology.nodeCpus(0, &node0);
+  topology.nodeCpus(1, &node1);
+  for (int i = 0; i < 5; i++) {
+    affinity.cpusFor(topology, i, 5, &cpus);
+    EXPECT_TRUE(cpus == (i < 3 ? node0 : node1));
+  }
+
+  // A single slot stays on the first node.
+  affinity.cpusFor(topology, 0, 1, &cpus);
+  EXPECT_TRUE(cpus == node0);
+
+  EXPECT_FALSE(ThreadAffinity::parse("everywhere", &affinity));
+}
+
+TEST(Pinning, CurrentThread) {
+  // The first CPU of the machine, compact or not.
+  const CpuTopology& machine = CpuTopology::machine();
+  ThreadAffinity affinity(ThreadAffinity::COMPACT);
+  vector<int> cpus;
+  affinity.cpusFor(machine, 0, 1, &cpus);
+  EXPECT_EQ(cpus.size(), 1);
+
+  cpu_set_t saved;
+  pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+  EXPECT_TRUE(affinity.pin(pthread_self(), 0, 1));
+
+  cpu_set_t set;
+  pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+  EXPECT_EQ(CPU_COUNT(&set), 1);
+  EXPECT_TRUE(CPU_ISSET(cpus[0], &set));
+  pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+}
+
+}  // unnamed namespace
+
+int main(int argc, char* argv[]) {
+  return RUN_TESTS(argc, argv);
+}
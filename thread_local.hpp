@@ -76,7 +76,7 @@ template<typename T>
 T* ThreadLocal<T>::getLocalState() const {
   T* local_state = reinterpret_cast<T*>(pthread_getspecific(local_key_));
   if (local_state == NULL) {
-    local_state = new T;
+    local_state = new T();
     pthread_setspecific(local_key_, local_state);
   }
   return local_state;
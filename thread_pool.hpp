@@ -1,8 +1,11 @@
 #ifndef MCP_BASE_THREAD_POOL_HEADER
 #define MCP_BASE_THREAD_POOL_HEADER
 
+#include <inttypes.h>
+
 #include "callback.hpp"
 #include "thread.hpp"
+#include "thread_affinity.hpp"
 #include "lock.hpp"
 
 namespace base {
@@ -20,6 +23,11 @@ public:
   // Requests the execution of 'task' on an undetermined worker thread.
   virtual void addTask(Callback<void>* task) = 0;
 
+  // Requests the execution of the 'n' 'tasks', as many addTask()
+  // calls would, but more cheaply: the pool synchronizes once for the
+  // whole batch, and wakes up no more workers than there are tasks.
+  virtual void addTasks(Callback<void>** tasks, int n) = 0;
+
   // Waits for all the workers to finish processing the ongoing tasks
   // and stop then stop the pool. This call may be issued from within
   // a worker thread itself.
@@ -31,6 +39,29 @@ public:
   virtual int count() const = 0;
 };
 
+// A thread pool the IOManager can run its upcalls on. Besides running
+// tasks, it must be able to tell when the tasks added up to a point
+// are all done, so that objects they refer to can be reclaimed
+// without locking (see IOManager::reclaimDescriptors()).
+class WorkerPool : public ThreadPool {
+public:
+  virtual ~WorkerPool() {}
+
+  // Returns a mark covering every task added so far.
+  virtual uint64_t epoch() const = 0;
+
+  // Returns true if every task covered by 'epoch' has finished
+  // running. Takes no locks.
+  virtual bool passed(uint64_t epoch) const = 0;
+
+  // Pins each worker to the CPUs 'affinity' assigns to it, the i-th
+  // worker taking slot 'first_slot' + i out of 'num_slots'. With
+  // 'num_slots' zero, the slots are just this pool's workers.
+  virtual void pin(const ThreadAffinity& affinity,
+                   int first_slot = 0,
+                   int num_slots = 0) = 0;
+};
+
 } // namespace base
 
 #endif // MCP_BASE_THREAD_POOL_HEADER
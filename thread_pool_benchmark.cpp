@@ -1,17 +1,25 @@
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <unistd.h>  // usleep
+#include <vector>
 
 #include "callback.hpp"
 #include "thread_pool_normal.hpp"
 #include "thread_pool_fast.hpp"
+#include "thread_pool_stealing.hpp"
+#include "ticks_clock.hpp"
 #include "timer.hpp"
 
 namespace {
 
 using base::Callback;
 using base::makeCallableMany;
+using base::makeCallableOnce;
 using base::ThreadPoolNormal;
 using base::ThreadPoolFast;
+using base::ThreadPoolStealing;
+using base::TicksClock;
 using base::Timer;
 
 
@@ -68,13 +76,43 @@ void FastConsumer() {
   std::cout << "Fast Consumer:\t";
   std::cout << timer.elapsed();
   std::cout << std::endl;
+  delete pool;  // may still hold tasks; see ~ThreadPool()
   for (int i=0; i<NumServers; i++) {
     delete tasks[i];
     delete servers[i];
   }
-  delete pool;
 }
 
+// Like FastConsumer, with the tasks added in batches.
+template<typename PoolType>
+void BatchConsumer() {
+  const int NumServers = 10;
+  Server* servers[NumServers];
+  for (int i=0; i<NumServers; i++) {
+    servers[i] = new Server(i);
+  }
+  Callback<void>* tasks[NumServers];
+
+  for (int i=0; i<NumServers; i++) {
+    tasks[i] = makeCallableMany(&Server::FastAccumulate, servers[i], 10000);
+  }
+  PoolType* pool = new PoolType(10);
+  timer.reset();
+  timer.start();
+  for (int i=0; i<1000; i+=NumServers) {
+    pool->addTasks(tasks, NumServers);
+  }
+  pool->stop();
+  timer.end();
+  std::cout << "Batch Consumer:\t";
+  std::cout << timer.elapsed();
+  std::cout << std::endl;
+  delete pool;  // may still hold tasks; see ~ThreadPool()
+  for (int i=0; i<NumServers; i++) {
+    delete tasks[i];
+    delete servers[i];
+  }
+}
 
 template<typename PoolType>
 void SlowConsumer() {  
@@ -99,19 +137,140 @@ void SlowConsumer() {
   std::cout << "Slow Consumer:\t";
   std::cout << timer.elapsed();
   std::cout << std::endl;
+  delete pool;  // may still hold tasks; see ~ThreadPool()
   for (int i=0; i<NumServers; i++) {
     delete tasks[i];
     delete servers[i];
   }
+}
+
+// Tasks that add tasks, from the workers: each task adds two more,
+// down to 'depth' levels.
+template<typename PoolType>
+class Spawner {
+public:
+  explicit Spawner(PoolType* pool) : pool_(pool), leaves_(0) {}
+
+  void spawn(int depth) {
+    if (depth == 0) {
+      __sync_fetch_and_add(&leaves_, 1);
+      return;
+    }
+    pool_->addTask(makeCallableOnce(&Spawner::spawn, this, depth - 1));
+    pool_->addTask(makeCallableOnce(&Spawner::spawn, this, depth - 1));
+  }
+
+  int leaves() const { return *(volatile int*)&leaves_; }
+
+private:
+  PoolType* pool_;
+  int       leaves_;
+};
+
+template<typename PoolType>
+void SpawningConsumer() {
+  const int Depth = 16;
+  PoolType* pool = new PoolType(10);
+  Spawner<PoolType> spawner(pool);
+  timer.reset();
+  timer.start();
+  pool->addTask(makeCallableOnce(&Spawner<PoolType>::spawn, &spawner, Depth));
+  while (spawner.leaves() < (1 << Depth)) {
+    usleep(100);
+  }
+  timer.end();
+  pool->stop();
+  std::cout << "Spawning Consumer:\t";
+  std::cout << timer.elapsed();
+  std::cout << std::endl;
   delete pool;
 }
 
+// Tasks added one at a time, each after the workers went idle. Each
+// task records how long it took from being added to starting to run.
+class HandOffProbe {
+public:
+  explicit HandOffProbe(int num_tasks)
+    : added_(num_tasks), latencies_(num_tasks), ran_(0) {}
+
+  template<typename PoolType>
+  void run(PoolType* pool, int pause_usecs) {
+    for (size_t i = 0; i < added_.size(); i++) {
+      usleep(pause_usecs);
+      added_[i] = TicksClock::getTicks();
+      pool->addTask(makeCallableOnce(&HandOffProbe::ran, this, i));
+    }
+    while (*(volatile int*)&ran_ < int(added_.size())) {
+      usleep(100);
+    }
+  }
+
+  void ran(size_t i) {
+    latencies_[i] = TicksClock::getTicks() - added_[i];
+    __sync_fetch_and_add(&ran_, 1);
+  }
+
+  // Returns the 'p'-th percentile latency, in microseconds.
+  double percentile(int p) {
+    std::vector<TicksClock::Ticks> sorted(latencies_);
+    std::sort(sorted.begin(), sorted.end());
+    const size_t i = std::min(sorted.size() - 1, sorted.size() * p / 100);
+    return sorted[i] * 1e6 / TicksClock::ticksPerSecond();
+  }
+
+private:
+  std::vector<TicksClock::Ticks> added_;
+  std::vector<TicksClock::Ticks> latencies_;
+  int                            ran_;
+};
+
+const int HandOffTasks = 2000;
+const int HandOffPause = 200;  // usecs
+
+void printHandOff(const char* name, HandOffProbe* probe) {
+  std::cout << name << "\tp50 " << probe->percentile(50)
+            << "us\tp99 " << probe->percentile(99) << "us" << std::endl;
+}
+
+template<typename PoolType>
+void HandOffLatency() {
+  PoolType* pool = new PoolType(4);
+  HandOffProbe probe(HandOffTasks);
+  probe.run(pool, HandOffPause);
+  pool->stop();
+  printHandOff("Hand-off Latency:", &probe);
+  delete pool;
+}
+
+// Fast pool workers parking right away, then spinning for longer than
+// the pause between tasks.
+void FastHandOffLatency() {
+  const double spins[] = { 0, 5 * HandOffPause / 1e6 };
+  for (int i = 0; i < 2; i++) {
+    ThreadPoolFast* pool = new ThreadPoolFast(4);
+    pool->setIdleSpin(spins[i]);
+    HandOffProbe probe(HandOffTasks);
+    probe.run(pool, HandOffPause);
+    pool->stop();
+
+    ThreadPoolFast::IdleStats stats;
+    pool->getIdleStats(&stats);
+    printHandOff(i == 0 ? "Hand-off Latency (park):"
+                        : "Hand-off Latency (spin):", &probe);
+    std::cout << "  spin hits " << stats.spin_hits
+              << "  yield hits " << stats.yield_hits
+              << "  parks " << stats.parks << std::endl;
+    delete pool;
+  }
+}
+
 }  // unnamed namespace
 
 void usage(int argc, char* argv[]) {
-  std::cout << "Usage: " << argv[0] << " [1 | 2]" << std::endl;
+  std::cout << "Usage: " << argv[0] << " [1 | 2 | 3]" << std::endl;
   std::cout << "  1 is normal thread pool" << std::endl;
   std::cout << "  2 is fast thread pool" << std::endl;
+  std::cout << "  3 is work-stealing thread pool" << std::endl;
   std::cout << "  defaul is to run both " << std::endl;
 }
 
@@ -142,6 +301,9 @@ int main(int argc, char* argv[]) {
   if (all || num[1]) {
     SlowConsumer<ThreadPoolFast>();
   }
+  if (all || num[2]) {
+    SlowConsumer<ThreadPoolStealing>();
+  }
 
   // force queue building
   if (all || num[0]) {
@@ -150,6 +312,42 @@ int main(int argc, char* argv[]) {
   if (all || num[1]) {
     FastConsumer<ThreadPoolFast>();
   }
+  if (all || num[2]) {
+    FastConsumer<ThreadPoolStealing>();
+  }
+
+  // ditto, a batch of tasks at a time
+  if (all || num[0]) {
+    BatchConsumer<ThreadPoolNormal>();
+  }
+  if (all || num[1]) {
+    BatchConsumer<ThreadPoolFast>();
+  }
+  if (all || num[2]) {
+    BatchConsumer<ThreadPoolStealing>();
+  }
+
+  // tasks adding tasks
+  if (all || num[0]) {
+    SpawningConsumer<ThreadPoolNormal>();
+  }
+  if (all || num[1]) {
+    SpawningConsumer<ThreadPoolFast>();
+  }
+  if (all || num[2]) {
+    SpawningConsumer<ThreadPoolStealing>();
+  }
+
+  // tasks trickling in to idle workers
+  if (all || num[0]) {
+    HandOffLatency<ThreadPoolNormal>();
+  }
+  if (all || num[1]) {
+    FastHandOffLatency();
+  }
+  if (all || num[2]) {
+    HandOffLatency<ThreadPoolStealing>();
+  }
 
   return 0;
 }
@@ -1,7 +1,14 @@
 #include <cstdlib>
-#include <sys/time.h>  // gettimeofday
+#include <linux/futex.h>
+#include <sched.h>        // sched_yield
+#include <sys/syscall.h>
+#include <sys/time.h>     // gettimeofday
+#include <unistd.h>       // sysconf
+
+#include <algorithm>
 
 #include "callback.hpp"
+#include "cpu_arch.hpp"
 #include "logging.hpp"
 #include "thread.hpp"
 
@@ -13,120 +20,324 @@ using base::Callback;
 using base::makeCallableOnce;
 
 static __thread bool last_worker_ = false;
+static __thread void* current_worker_ = NULL;
 
 ThreadLocal<int> ThreadPoolFast::worker_num_;
 
+const double ThreadPoolFast::DefaultIdleSpin = 0.00005;  // 50us
+
+// Times an idle worker yields the CPU before parking.
+static const int YieldRounds = 2;
+
+// Sleeps while '*word' is 'value', or until woken up.
+static void futexWait(volatile int* word, int value) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futexWake(volatile int* word) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
 //
 // Internal Worker Class
 //
 
 class ThreadPoolFast::Worker {
 public:
-  Worker(ThreadPoolFast*);
+  Worker(ThreadPoolFast* pool, int index);
   ~Worker();
 
   void workerLoop(int instance);
-  void assignTask(Callback<void>* task);
+
+  // Hands 'task', tagged with 'bucket', to this worker. The worker
+  // must have been taken off the idle stack by the caller. A
+  // CheckQueue task just has the worker look at the dispatch queue.
+  void assignTask(Callback<void>* task, int bucket);
+
+  // Wakes the worker up if it is parked, so that it notices the pool
+  // is stopping.
+  void wakeUp();
+
+  ThreadPoolFast* pool() const { return my_pool_; }
+  int index() const { return index_; }
+
+  // Adds this worker's idle counts to 'stats'.
+  void addIdleStats(IdleStats* stats) const;
+
+  // The index + 1 of the next worker in the idle stack, or 0.
+  volatile int    next_idle_;
+
+  static Callback<void>* const CheckQueue;
 
 private:
   ThreadPoolFast* my_pool_;        // not owned here
+  const int       index_;          // in my_pool_'s workers
+
+  // Whether this worker is in the idle stack or was just taken off
+  // it and is about to get a task. A listed worker runs only the
+  // tasks handed to it. Touched only by this worker.
+  bool            listed_;
+
+  // The task handed to this worker, or NULL. The bucket is written
+  // before the task.
+  Callback<void>* volatile mail_;
+  volatile int    mail_bucket_;
+
+  // 1 while this worker is parked, or about to; a futex word. Whoever
+  // hands it a task moves it back to 0 before waking the worker.
+  volatile int    parked_;
+
+  // How long this worker spins when idle, tuned by park(), and how
+  // its waits ended. Touched only by this worker.
+  TicksClock::Ticks spin_;
+  volatile uint64_t spin_hits_;
+  volatile uint64_t yield_hits_;
+  volatile uint64_t parks_;
+
+  // Takes the task handed to this worker, if any.
+  bool takeTask(Entry* entry);
+
+  // Returns true if there is a task for this worker or the pool is
+  // stopping.
+  bool ready() const {
+    return mail_ != NULL || my_pool_->stopping_;
+  }
 
-  Mutex           m_;
-  ConditionVar    cv_has_task_;
-  bool            has_task_;
-  Callback<void>* task_;
+  // Waits for a task to be handed to this worker, or for the pool to
+  // stop: spinning, then yielding, then parking.
+  void park();
 
+  // Sets the next spin after a wait that ended while spinning or
+  // yielding ('hit'), or in a park.
+  void tuneSpin(bool hit);
 };
 
-ThreadPoolFast::Worker::Worker(ThreadPoolFast* pool)
-  : my_pool_(pool),
-    has_task_(false),
-    task_(NULL) {
+// Not a task; see assignTask().
+Callback<void>* const ThreadPoolFast::Worker::CheckQueue =
+  reinterpret_cast<Callback<void>*>(1);
+
+ThreadPoolFast::Worker::Worker(ThreadPoolFast* pool, int index)
+  : next_idle_(0),
+    my_pool_(pool),
+    index_(index),
+    listed_(false),
+    mail_(NULL),
+    mail_bucket_(0),
+    parked_(0),
+    spin_(pool->idle_spin_),
+    spin_hits_(0),
+    yield_hits_(0),
+    parks_(0) {
 }
 
 ThreadPoolFast::Worker::~Worker() {
+  Callback<void>* task = mail_;
+  if (task != NULL && task != CheckQueue && task->once()) {
+    delete task;
+  }
 }
 
 void ThreadPoolFast::Worker::workerLoop(int instance) {
   worker_num_.setVal(instance);
+  current_worker_ = this;
+
+  Entry entry;
   while (true) {
+    if (takeTask(&entry) || (! listed_ && my_pool_->dequeue(&entry))) {
+      if (entry.task == CheckQueue) {
+        continue;
+      }
+
+      // If this worker is executing the ThreadPool tear down,
+      // i.e. stop(), the latter will notify this thread is the last
+      // worker, after waiting for all other worker threads to join.
 
-    // Wait until I know my task. Because a task is assigned to this
-    // worker, we assume it left the free worker's pool.
-    {
-      ScopedLock l(&m_);
+      (*entry.task)();  // would self-delete if once-run task
 
-      while (!has_task_) {
-        cv_has_task_.wait(&m_);
+      // The pool may be gone by now; don't touch it.
+      if (last_worker_) {
+        break;
       }
-      has_task_ = false;
+
+      my_pool_->gens_.finished(index_, entry.bucket);
+      continue;
     }
 
-    // A NULL task is considered a request to stop this worker.
-    if (task_ == NULL) {
-      delete this;
-      break;
+    // Tasks added before stop() are either queued or handed to us by
+    // now. Listed workers don't park anymore, but they still can't
+    // take queued tasks; have them get to unlisted ones.
+    if (my_pool_->stopping_) {
+      __sync_synchronize();
+      if (mail_ != NULL) {
+        continue;
+      }
+      if (! my_pool_->hasWork()) {
+        break;
+      }
+      if (listed_) {
+        Worker* worker = my_pool_->popIdle();
+        if (worker != NULL) {
+          worker->assignTask(CheckQueue, 0);
+        }
+      }
+      continue;
     }
 
-    // If this worker is executing the ThreadPool tear down,
-    // i.e. stop(), the latter will notify this thread is the last
-    // worker, after waiting for all other worker threads to join.
+    // Nothing to do. Once listed, a task may have been queued by a
+    // thread that looked for idle workers just before; if so, have
+    // some idle worker (possibly this one) go get it.
+    if (! listed_) {
+      listed_ = true;
+      my_pool_->pushIdle(this);
+      if (my_pool_->hasWork()) {
+        Worker* worker = my_pool_->popIdle();
+        if (worker != NULL) {
+          worker->assignTask(CheckQueue, 0);
+        }
+      }
+      continue;
+    }
 
-    (*task_)();  // would self-delete if once-run task
+    park();
+  }
+}
 
-    if (last_worker_) {
-      delete this;
-      break;
-    }
+void ThreadPoolFast::Worker::assignTask(Callback<void>* task, int bucket) {
+  mail_bucket_ = bucket;
+  __sync_synchronize();
+  mail_ = task;
+
+  // Either the worker sees its task before parking or we see it
+  // parked; see park().
+  __sync_synchronize();
+  wakeUp();
+}
 
-    // Return the worker to the free worker's pool
-    my_pool_->queueWorker(this);
+void ThreadPoolFast::Worker::wakeUp() {
+  if (__sync_bool_compare_and_swap(&parked_, 1, 0)) {
+    futexWake(&parked_);
   }
 }
 
-void ThreadPoolFast::Worker::assignTask(Callback<void>* task) {
-  ScopedLock l(&m_);
+void ThreadPoolFast::Worker::addIdleStats(IdleStats* stats) const {
+  stats->spin_hits += spin_hits_;
+  stats->yield_hits += yield_hits_;
+  stats->parks += parks_;
+}
 
-  task_ = task;
-  has_task_ = true;
-  cv_has_task_.signal();
+bool ThreadPoolFast::Worker::takeTask(Entry* entry) {
+  Callback<void>* task = mail_;
+  if (task == NULL) {
+    return false;
+  }
+
+  entry->task = task;
+  entry->bucket = mail_bucket_;
+  mail_ = NULL;
+  listed_ = false;
+  return true;
+}
+
+void ThreadPoolFast::Worker::park() {
+  // The limit may have been lowered since the spin was last tuned.
+  const TicksClock::Ticks limit = my_pool_->idle_spin_;
+  if (spin_ > limit) {
+    spin_ = limit;
+  }
+  if (spin_ > 0) {
+    const TicksClock::Ticks until = TicksClock::getTicks() + spin_;
+    do {
+      for (int i = 0; i < 64; i++) {
+        if (ready()) {
+          spin_hits_++;
+          tuneSpin(true);
+          return;
+        }
+        cpuRelax();
+      }
+    } while (TicksClock::getTicks() < until);
+  }
+
+  for (int i = 0; i < YieldRounds; i++) {
+    sched_yield();
+    if (ready()) {
+      yield_hits_++;
+      tuneSpin(true);
+      return;
+    }
+  }
+
+  // A futex wait returns right away if 'parked_' was cleared since we
+  // set it, so a wakeup can't be missed.
+  parks_++;
+  tuneSpin(false);
+  parked_ = 1;
+  __sync_synchronize();
+  while (! ready()) {
+    futexWait(&parked_, 1);
+  }
+  parked_ = 0;
+}
+
+void ThreadPoolFast::Worker::tuneSpin(bool hit) {
+  // Never spinning less than a fraction of the limit lets the spin
+  // grow back once tasks come in faster.
+  const TicksClock::Ticks limit = my_pool_->idle_spin_;
+  const TicksClock::Ticks spin = hit ? spin_ * 2 : spin_ / 2;
+  spin_ = std::min(limit, std::max(spin, limit / 16));
 }
 
 //
 //  ThreadPoolFast Definitions
 //
-	
-static Mutex   m;
-static ConditionVar cv1, cv2;
 
-ThreadPoolFast::ThreadPoolFast(int num_workers) {
+ThreadPoolFast::ThreadPoolFast(int num_workers, int first_worker)
+  : num_workers_(num_workers),
+    dispatch_queue_(QueueCapacity),
+    overflowed_(0),
+    idle_top_(0),
+    stopping_(false),
+    idle_spin_(0),
+    gens_(num_workers) {
+  // Spinning only slows down the thread that would add the task if
+  // there's no other CPU for it to run on.
+  if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+    setIdleSpin(DefaultIdleSpin);
+  }
+
   for (int i = 0; i < num_workers; i++) {
-    Worker* worker = new Worker(this);
-    Callback<void>* body = makeCallableOnce(&Worker::workerLoop, worker, i);
+    workers_.push_back(new Worker(this, i));
+  }
+
+  for (int i = 0; i < num_workers; i++) {
+    Callback<void>* body = makeCallableOnce(&Worker::workerLoop,
+                                            workers_[i],
+                                            first_worker + i);
     workers_tids_.push_back(makeThread(body));
-    queueWorker(worker);
   }
 }
 
 ThreadPoolFast::~ThreadPoolFast() {
-  m_dispatch_.lock();
-  while (! dispatch_queue_.empty()) {
-    Callback<void>* task = dispatch_queue_.front();
-    dispatch_queue_.pop();
-    if (task && task->once()) {
-      delete task;
+  Entry entry;
+  while (dequeue(&entry)) {
+    if (entry.task->once()) {
+      delete entry.task;
     }
   }
-  m_dispatch_.unlock();
+
+  for (int i = 0; i < num_workers_; i++) {
+    delete workers_[i];
+  }
 }
 
 void ThreadPoolFast::stop() {
-  // Issue a stop request callback for each worker thread. If the
-  // stop() is being issued from one of the workers itself, one of the
-  // stop callbacks won't be consummed. The destructor would dispose
-  // of it.
-  for (size_t i = 0; i < workers_tids_.size(); i++) {
-    addTask(NULL);
+  // Workers leave once they find no more work. If the stop() is being
+  // issued from one of the workers itself, that one leaves after the
+  // current task.
+  stopping_ = true;
+  __sync_synchronize();
+  for (int i = 0; i < num_workers_; i++) {
+    workers_[i]->wakeUp();
   }
 
   bool exit_last_worker = false;
@@ -141,38 +352,160 @@ void ThreadPoolFast::stop() {
 
   if (exit_last_worker) {
     last_worker_ = true;
+    current_worker_ = NULL;
   }
 }
 
-void ThreadPoolFast::queueWorker(Worker* worker) {
-  ScopedLock l(&m_dispatch_);
+void ThreadPoolFast::addTask(Callback<void>* task) {
+  addTasks(&task, 1);
+}
+
+void ThreadPoolFast::addTasks(Callback<void>** tasks, int n) {
+  Worker* self = currentWorker();
+  const int bucket =
+    gens_.added(self ? self->index() : TaskGenerations::NotAWorker, n);
+
+  // Hand off as many tasks as there are idle workers. Once stopping,
+  // tasks are only queued, where the destructor finds the ones left.
+  int i = 0;
+  if (! stopping_) {
+    for (; i < n; i++) {
+      Worker* worker = popIdle();
+      if (worker == NULL) {
+        break;
+      }
+      worker->assignTask(tasks[i], bucket);
+    }
+  }
+  if (i == n) {
+    return;
+  }
 
-  // If there are tasks waiting, pick the worker right away; don't
-  // bother putting it back in the pool.
-  if (! dispatch_queue_.empty()) {
-    worker->assignTask(dispatch_queue_.front());
-    dispatch_queue_.pop();
-  } else {
-    workers_.push_front(worker);
+  for (int j = i; j < n; j++) {
+    Entry entry;
+    entry.task = tasks[j];
+    entry.bucket = bucket;
+    enqueue(entry);
+  }
+
+  // Workers that went idle since we looked would have missed these
+  // tasks; see Worker::workerLoop().
+  __sync_synchronize();
+  for (; i < n && hasWork(); i++) {
+    Worker* worker = popIdle();
+    if (worker == NULL) {
+      break;
+    }
+    worker->assignTask(Worker::CheckQueue, 0);
   }
 }
 
-void ThreadPoolFast::addTask(Callback<void>* task) {
-  ScopedLock l(&m_dispatch_);
+uint64_t ThreadPoolFast::epoch() const {
+  return gens_.epoch();
+}
 
-  if (! workers_.empty()) {
-    Worker* worker = workers_.front();
-    workers_.pop_front();
-    worker->assignTask(task);
-    return;
+bool ThreadPoolFast::passed(uint64_t epoch) const {
+  return gens_.passed(epoch);
+}
+
+void ThreadPoolFast::pin(const ThreadAffinity& affinity,
+                           int first_slot,
+                           int num_slots) {
+  if (num_slots == 0) {
+    num_slots = num_workers_;
+  }
+  for (size_t i = 0; i < workers_tids_.size(); i++) {
+    affinity.pin(workers_tids_[i], first_slot + i, num_slots);
   }
+}
 
-  dispatch_queue_.push(task);
+void ThreadPoolFast::setIdleSpin(double seconds) {
+  idle_spin_ = seconds * TicksClock::ticksPerSecond();
+}
+
+void ThreadPoolFast::getIdleStats(IdleStats* stats) const {
+  stats->spin_hits = 0;
+  stats->yield_hits = 0;
+  stats->parks = 0;
+  for (int i = 0; i < num_workers_; i++) {
+    workers_[i]->addIdleStats(stats);
+  }
 }
 
 int ThreadPoolFast::count() const {
-  ScopedLock l(&m_dispatch_);
-  return dispatch_queue_.size();
+  ScopedLock l(&m_overflow_);
+  return dispatch_queue_.size() + overflow_queue_.size();
+}
+
+ThreadPoolFast::Worker* ThreadPoolFast::currentWorker() const {
+  Worker* worker = static_cast<Worker*>(current_worker_);
+  if (worker != NULL && worker->pool() == this) {
+    return worker;
+  }
+  return NULL;
+}
+
+void ThreadPoolFast::pushIdle(Worker* worker) {
+  while (true) {
+    const uint64_t top = idle_top_;
+    worker->next_idle_ = top & IdleMask;
+    const uint64_t new_top = (((top >> IdleBits) + 1) << IdleBits) |
+                             (worker->index() + 1);
+    if (__sync_bool_compare_and_swap(&idle_top_, top, new_top)) {
+      return;
+    }
+  }
+}
+
+ThreadPoolFast::Worker* ThreadPoolFast::popIdle() {
+  while (true) {
+    const uint64_t top = idle_top_;
+    if ((top & IdleMask) == 0) {
+      return NULL;
+    }
+
+    // Workers are never freed while the pool runs, so 'next_idle_'
+    // can be read even if 'worker' was taken off by now; the CAS
+    // would fail then.
+    Worker* worker = workers_[(top & IdleMask) - 1];
+    const uint64_t new_top = (((top >> IdleBits) + 1) << IdleBits) |
+                             worker->next_idle_;
+    if (__sync_bool_compare_and_swap(&idle_top_, top, new_top)) {
+      return worker;
+    }
+  }
+}
+
+void ThreadPoolFast::enqueue(const Entry& entry) {
+  if (overflowed_ == 0 && dispatch_queue_.push(entry)) {
+    return;
+  }
+
+  ScopedLock l(&m_overflow_);
+  overflow_queue_.push(entry);
+  overflowed_ = overflow_queue_.size();
+}
+
+bool ThreadPoolFast::dequeue(Entry* entry) {
+  if (dispatch_queue_.pop(entry)) {
+    return true;
+  }
+  if (overflowed_ == 0) {
+    return false;
+  }
+
+  ScopedLock l(&m_overflow_);
+  if (overflow_queue_.empty()) {
+    return false;
+  }
+  *entry = overflow_queue_.front();
+  overflow_queue_.pop();
+  overflowed_ = overflow_queue_.size();
+  return true;
+}
+
+bool ThreadPoolFast::hasWork() const {
+  return dispatch_queue_.size() > 0 || overflowed_ > 0;
 }
 
 /*static*/
@@ -180,7 +513,11 @@ int ThreadPoolFast::ME() {
   return worker_num_.getVal();
 }
 
-    
+/*static*/
+void ThreadPoolFast::setME(int i) {
+  worker_num_.setVal(i);
+}
+
 void ThreadPoolFast::setMEForTest(int i) {
   worker_num_.setVal(i);
 }
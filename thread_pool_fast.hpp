@@ -1,55 +1,168 @@
 #ifndef MCP_BASE_THREAD_POOL_FAST_HEADER
 #define MCP_BASE_THREAD_POOL_FAST_HEADER
 
-#include <queue>
-#include <list>
+#include <inttypes.h>
 #include <queue>
 #include <vector>
 
 #include "callback.hpp"
 #include "lock.hpp"
+#include "mpmc_queue.hpp"
+#include "task_generations.hpp"
 #include "thread_pool.hpp"
 #include "thread_local.hpp"
+#include "ticks_clock.hpp"
 
 namespace base {
 
 using namespace std;
-using std::list;
 using std::queue;
 using std::vector;
 
-class ThreadPoolFast : public ThreadPool {
+// A thread pool whose workers take tasks from a bounded lock-free
+// dispatch queue (see MPMCQueue), or directly from the thread adding
+// them: a worker with nothing to do lists itself on a lock-free stack
+// of idle workers, and addTask() hands its task to the worker on top
+// of it, if any, rather than queueing it. Neither path takes a lock.
+// Should the dispatch queue fill up, tasks overflow to a locked queue
+// until it drains.
+//
+// A worker that goes idle first spins for a while, then yields the
+// CPU a couple of times, and only then parks on a futex. A task
+// handed to a spinning worker is picked up within nanoseconds rather
+// than after a wakeup and a trip through the scheduler; the adding
+// thread issues a futex wake only for a worker that did park. Each
+// worker tunes its own spin: it spins twice as long after a task
+// arrived while it waited, and half as long after it had to park,
+// between a sixteenth of the pool's limit and the limit itself (see
+// setIdleSpin()).
+//
+// Thread Safety:
+//
+//   All calls are thread-safe. stop() may be issued from a worker.
+//
+class ThreadPoolFast : public WorkerPool {
 public:
 
-  // ThreadPool interface
-  explicit ThreadPoolFast(int num_workers);
+  // ThreadPool interface. The workers' IDs (see ME()) start at
+  // 'first_worker', so that several pools can share per-worker state.
+  // Tasks added before stop() are run before it returns.
+  explicit ThreadPoolFast(int num_workers, int first_worker = 0);
   virtual ~ThreadPoolFast();
 
   virtual void addTask(Callback<void>* task);
   virtual void stop();
   virtual int count() const;
 
+  // Requests the execution of the 'n' 'tasks', as many addTask()
+  // calls would. Each idle worker gets one of the tasks; the rest are
+  // queued.
+  virtual void addTasks(Callback<void>** tasks, int n);
+
+  // Task boundaries, for deferring the reclamation of objects that
+  // queued or running tasks may still use. Tasks are handed off in no
+  // particular order, so the pool counts them by generation (see
+  // TaskGenerations).
+  virtual uint64_t epoch() const;
+
+  // Returns true if every task added before 'epoch' was taken has
+  // finished running. Takes no locks.
+  virtual bool passed(uint64_t epoch) const;
+
+  // Pins the workers, which may be busy already; see WorkerPool.
+  virtual void pin(const ThreadAffinity& affinity,
+                   int first_slot = 0,
+                   int num_slots = 0);
+
+  // How idle workers got their next task: while spinning, after
+  // yielding, or after parking.
+  struct IdleStats {
+    uint64_t spin_hits;
+    uint64_t yield_hits;
+    uint64_t parks;
+  };
+
+  // Sets the longest, in seconds (possibly fractional), an idle
+  // worker spins before yielding and parking. Zero has workers park
+  // right away. The default is DefaultIdleSpin where there are CPUs
+  // to spare, zero on a single CPU.
+  static const double DefaultIdleSpin;
+  void setIdleSpin(double seconds);
+
+  // Fills 'stats' with the counts accumulated so far, over all
+  // workers.
+  void getIdleStats(IdleStats* stats) const;
+
   // Returns the worker ID the call is being issued from. The call
-  // must be issued from a worker thread.
+  // must be issued from a worker thread, or from a thread that
+  // numbered itself with setME().
   static int ME();
+  static void setME(int i);
   static void setMEForTest(int i);
 
 private:
   class Worker;
 
-  typedef queue<Callback<void>*> DispatchQueue;
-  typedef list<Worker*>          WorkerList;
-  typedef vector<pthread_t>      TIDs;
+  // A task and the generation bucket it counts in.
+  struct Entry {
+    Callback<void>* task;
+    int             bucket;
+  };
 
-  mutable Mutex                  m_dispatch_;
-  ConditionVar                   cv_not_empty_;
-  DispatchQueue                  dispatch_queue_;
-  WorkerList                     workers_;
+  typedef MPMCQueue<Entry>  DispatchQueue;
+  typedef queue<Entry>      OverflowQueue;
+  typedef vector<Worker*>   Workers;
+  typedef vector<pthread_t> TIDs;
+
+  static const int QueueCapacity = 4096;
+
+  Workers                        workers_;      // owned here
   TIDs                           workers_tids_;
+  const int                      num_workers_;
+
+  DispatchQueue                  dispatch_queue_;
+
+  // Tasks that didn't fit in the dispatch queue. While there are any,
+  // new tasks go here too, so that they are run in order. 'overflowed_'
+  // mirrors the queue's size, so that it can be checked without the
+  // lock.
+  mutable Mutex                  m_overflow_;
+  OverflowQueue                  overflow_queue_;
+  volatile int                   overflowed_;
+
+  // The stack of idle workers: the index + 1 of the top worker (0 if
+  // none) in the low IdleBits bits, and a count of the changes to the
+  // stack above them, so that a CAS can't mistake an old top for a
+  // current one.
+  enum { IdleBits = 32 };
+  static const uint64_t IdleMask = (uint64_t(1) << IdleBits) - 1;
+  volatile uint64_t              idle_top_;
+
+  volatile bool                  stopping_;
+
+  // The longest an idle worker may spin; see setIdleSpin().
+  volatile TicksClock::Ticks     idle_spin_;
+
+  // Task boundaries; see TaskGenerations.
+  TaskGenerations                gens_;
 
   static ThreadLocal<int>        worker_num_;
 
-  void queueWorker(Worker* worker);
+  // Returns the worker of this pool the call is issued from, or NULL.
+  Worker* currentWorker() const;
+
+  // Lists 'worker' as idle, or takes the last worker listed off the
+  // stack, returning NULL if there's none.
+  void pushIdle(Worker* worker);
+  Worker* popIdle();
+
+  // Adds 'entry' at the tail of the dispatch queue, or of the overflow
+  // queue, and takes one from the head.
+  void enqueue(const Entry& entry);
+  bool dequeue(Entry* entry);
+
+  // Returns true if any task is queued.
+  bool hasWork() const;
 
   // Non-copyable, non-assignable.
   ThreadPoolFast(const ThreadPoolFast&);
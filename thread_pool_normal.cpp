@@ -4,7 +4,7 @@ namespace base {
 
 
 ThreadPoolNormal::ThreadPoolNormal(int num_workers)
-    : NumofWorkers(num_workers),  beStop(false) {
+    : NumofWorkers(num_workers), NumofSleepers(0), beStop(false) {
   TaskQueue = new queue<Callback<void>*>();
   threads = new pthread_t[num_workers];
   for (int i=0; i<num_workers; i++) {
@@ -47,6 +47,19 @@ void ThreadPoolNormal::addTask(Callback<void>* task) {
   cv.signal();
 }
 
+void ThreadPoolNormal::addTasks(Callback<void>** tasks, int n) {
+  ScopedLock lock(&m);
+  for (int i=0; i<n; i++) {
+    TaskQueue->push(tasks[i]);
+  }
+  //each woken worker keeps taking tasks until the queue is empty, so
+  //waking more than the sleepers or the tasks would be wasted
+  const int to_wake = n < NumofSleepers ? n : NumofSleepers;
+  for (int i=0; i<to_wake; i++) {
+    cv.signal();
+  }
+}
+
 int ThreadPoolNormal::count() const {
   ScopedLock lock(&m);
   return TaskQueue->size();
@@ -55,8 +68,11 @@ int ThreadPoolNormal::count() const {
 void ThreadPoolNormal::workerFunction() {  
   while(true) {
     m.lock();
-    while(TaskQueue->empty() && !beStop)
+    while(TaskQueue->empty() && !beStop) {
+      NumofSleepers++;
       cv.wait(&m);
+      NumofSleepers--;
+    }
     if (beStop) {
       m.unlock();
       break;
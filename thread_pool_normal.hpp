@@ -19,10 +19,15 @@ public:
   virtual void stop();
   virtual int count() const;
 
+  // Queues the 'n' tasks under a single lock and wakes up as many
+  // sleeping workers as there are tasks, or as there are sleepers.
+  virtual void addTasks(Callback<void>** tasks, int n);
+
 private:
   queue<Callback<void>*>* TaskQueue;
   pthread_t* threads;
   int NumofWorkers;
+  int NumofSleepers;  // workers waiting on cv; protected by m
   bool beStop;
   ConditionVar cv;
   mutable Mutex m;
@@ -0,0 +1,371 @@
+#include "cpu_arch.hpp"
+#include "thread.hpp"
+#include "thread_pool_fast.hpp"   // ME()
+#include "thread_pool_stealing.hpp"
+
+namespace base {
+
+using base::Callback;
+using base::makeCallableOnce;
+
+// The worker the current thread runs, if any, and whether that
+// worker issued stop() on its pool (see ThreadPoolFast).
+static __thread void* current_worker_ = NULL;
+static __thread bool last_worker_ = false;
+
+//
+// Internal Worker Class
+//
+
+class ThreadPoolStealing::Worker {
+public:
+  Worker(ThreadPoolStealing* pool, int index);
+  ~Worker();
+
+  void workerLoop(int instance);
+
+  // Deque interface. Only the owner worker pushes and pops; any
+  // worker may steal. push() fails if the deque is full; pop() and
+  // steal() fail if it is empty or, for steal(), on a lost race.
+  bool push(const Entry& entry);
+  bool pop(Entry* entry);
+  bool steal(Entry* entry);
+  int size() const;
+
+  // Picks a worker to steal from, in [0, n).
+  int victim(int n);
+
+  ThreadPoolStealing* pool() const { return my_pool_; }
+  int index() const { return index_; }
+
+private:
+  static const int Capacity = 1024;    // a power of two
+  static const int Mask = Capacity - 1;
+
+  ThreadPoolStealing* my_pool_;        // not owned here
+  const int           index_;          // in my_pool_'s workers
+  unsigned            seed_;
+
+  // Thieves move 'top_' up; the owner moves 'bottom_' both ways.
+  // The deque holds [top_, bottom_).
+  volatile int64_t    top_;
+  char                pad_top_[CacheArch::LINE_SIZE];
+  volatile int64_t    bottom_;
+  char                pad_bottom_[CacheArch::LINE_SIZE];
+  Entry               entries_[Capacity];
+};
+
+ThreadPoolStealing::Worker::Worker(ThreadPoolStealing* pool, int index)
+  : my_pool_(pool),
+    index_(index),
+    seed_(2 * index + 1),
+    top_(0),
+    bottom_(0) {
+}
+
+ThreadPoolStealing::Worker::~Worker() {
+  for (int64_t i = top_; i < bottom_; i++) {
+    Callback<void>* task = entries_[i & Mask].task;
+    if (task->once()) {
+      delete task;
+    }
+  }
+}
+
+void ThreadPoolStealing::Worker::workerLoop(int instance) {
+  ThreadPoolFast::setME(instance);
+  current_worker_ = this;
+
+  Entry entry;
+  while (true) {
+    if (! my_pool_->findTask(this, &entry)) {
+      if (! my_pool_->waitForWork()) {
+        break;
+      }
+      continue;
+    }
+
+    (*entry.task)();  // would self-delete if once-run task
+
+    // The pool may be gone by now; don't touch it.
+    if (last_worker_) {
+      break;
+    }
+
+    my_pool_->gens_.finished(index_, entry.bucket);
+  }
+}
+
+bool ThreadPoolStealing::Worker::push(const Entry& entry) {
+  const int64_t b = bottom_;
+  if (b - top_ >= Capacity) {
+    return false;
+  }
+
+  // The entry must be in place before thieves can see it.
+  entries_[b & Mask] = entry;
+  __sync_synchronize();
+  bottom_ = b + 1;
+  return true;
+}
+
+bool ThreadPoolStealing::Worker::pop(Entry* entry) {
+  // Claim the bottom entry before looking at 'top_', so that a thief
+  // either sees the claim or is seen here.
+  const int64_t b = bottom_ - 1;
+  bottom_ = b;
+  __sync_synchronize();
+  const int64_t t = top_;
+
+  if (t > b) {
+    bottom_ = b + 1;
+    return false;
+  }
+
+  *entry = entries_[b & Mask];
+  if (t < b) {
+    return true;
+  }
+
+  // The last entry: race the thieves for it.
+  const bool won = __sync_bool_compare_and_swap(&top_, t, t + 1);
+  bottom_ = b + 1;
+  return won;
+}
+
+bool ThreadPoolStealing::Worker::steal(Entry* entry) {
+  const int64_t t = top_;
+  __sync_synchronize();
+  const int64_t b = bottom_;
+  if (t >= b) {
+    return false;
+  }
+
+  // The owner doesn't overwrite the entry while 'top_' is still 't',
+  // so if we win it, we read it whole.
+  const Entry candidate = entries_[t & Mask];
+  if (! __sync_bool_compare_and_swap(&top_, t, t + 1)) {
+    return false;
+  }
+  *entry = candidate;
+  return true;
+}
+
+int ThreadPoolStealing::Worker::size() const {
+  const int64_t t = top_;
+  const int64_t b = bottom_;
+  return b > t ? b - t : 0;
+}
+
+int ThreadPoolStealing::Worker::victim(int n) {
+  // xorshift
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return seed_ % n;
+}
+
+//
+//  ThreadPoolStealing Definitions
+//
+
+ThreadPoolStealing::ThreadPoolStealing(int num_workers, int first_worker)
+  : num_workers_(num_workers),
+    injected_(0),
+    sleepers_(0),
+    stopping_(false),
+    gens_(num_workers) {
+  for (int i = 0; i < num_workers; i++) {
+    workers_.push_back(new Worker(this, i));
+  }
+
+  // All the workers exist before any of them starts stealing.
+  for (int i = 0; i < num_workers; i++) {
+    Callback<void>* body = makeCallableOnce(&Worker::workerLoop,
+                                            workers_[i],
+                                            first_worker + i);
+    workers_tids_.push_back(makeThread(body));
+  }
+}
+
+ThreadPoolStealing::~ThreadPoolStealing() {
+  m_inject_.lock();
+  while (! inject_queue_.empty()) {
+    Callback<void>* task = inject_queue_.front().task;
+    inject_queue_.pop();
+    if (task->once()) {
+      delete task;
+    }
+  }
+  m_inject_.unlock();
+
+  for (int i = 0; i < num_workers_; i++) {
+    delete workers_[i];
+  }
+}
+
+void ThreadPoolStealing::stop() {
+  {
+    ScopedLock l(&m_idle_);
+    stopping_ = true;
+    cv_idle_.signalAll();
+  }
+
+  // Workers leave once they find no more work. If stop() is being
+  // issued from one of them, that one leaves after the current task.
+  bool exit_last_worker = false;
+  for (size_t i = 0; i < workers_tids_.size(); ++i) {
+    if (pthread_self() == workers_tids_[i]) {
+      exit_last_worker = true;
+    } else {
+      pthread_join(workers_tids_[i], NULL);
+    }
+  }
+
+  if (exit_last_worker) {
+    last_worker_ = true;
+    current_worker_ = NULL;
+  }
+}
+
+void ThreadPoolStealing::addTask(Callback<void>* task) {
+  addTasks(&task, 1);
+}
+
+void ThreadPoolStealing::addTasks(Callback<void>** tasks, int n) {
+  Worker* worker = currentWorker();
+  Entry entry;
+  int i = 0;
+  if (worker != NULL) {
+    entry.bucket = gens_.added(worker->index(), n);
+    for (; i < n; i++) {
+      entry.task = tasks[i];
+      if (! worker->push(entry)) {
+        break;
+      }
+    }
+  } else {
+    entry.bucket = gens_.added(TaskGenerations::NotAWorker, n);
+  }
+
+  // Tasks from outside the pool, or that don't fit in the worker's
+  // deque.
+  if (i < n) {
+    ScopedLock l(&m_inject_);
+    for (; i < n; i++) {
+      entry.task = tasks[i];
+      inject_queue_.push(entry);
+    }
+    injected_ = inject_queue_.size();
+  }
+
+  wakeUp(n);
+}
+
+int ThreadPoolStealing::count() const {
+  int pending = 0;
+  for (int i = 0; i < num_workers_; i++) {
+    pending += workers_[i]->size();
+  }
+
+  ScopedLock l(&m_inject_);
+  return pending + inject_queue_.size();
+}
+
+uint64_t ThreadPoolStealing::epoch() const {
+  return gens_.epoch();
+}
+
+bool ThreadPoolStealing::passed(uint64_t epoch) const {
+  return gens_.passed(epoch);
+}
+
+void ThreadPoolStealing::pin(const ThreadAffinity& affinity,
+                               int first_slot,
+                               int num_slots) {
+  if (num_slots == 0) {
+    num_slots = num_workers_;
+  }
+  for (size_t i = 0; i < workers_tids_.size(); i++) {
+    affinity.pin(workers_tids_[i], first_slot + i, num_slots);
+  }
+}
+
+ThreadPoolStealing::Worker* ThreadPoolStealing::currentWorker() const {
+  Worker* worker = static_cast<Worker*>(current_worker_);
+  if (worker != NULL && worker->pool() == this) {
+    return worker;
+  }
+  return NULL;
+}
+
+bool ThreadPoolStealing::findTask(Worker* worker, Entry* entry) {
+  if (worker->pop(entry)) {
+    return true;
+  }
+
+  if (injected_ > 0) {
+    ScopedLock l(&m_inject_);
+    if (! inject_queue_.empty()) {
+      *entry = inject_queue_.front();
+      inject_queue_.pop();
+      injected_ = inject_queue_.size();
+      return true;
+    }
+  }
+
+  const int first = worker->victim(num_workers_);
+  for (int i = 0; i < num_workers_; i++) {
+    Worker* victim = workers_[(first + i) % num_workers_];
+    if (victim != worker && victim->steal(entry)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPoolStealing::hasWork() const {
+  if (injected_ > 0) {
+    return true;
+  }
+  for (int i = 0; i < num_workers_; i++) {
+    if (workers_[i]->size() > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPoolStealing::waitForWork() {
+  ScopedLock l(&m_idle_);
+
+  // Either a producer sees us sleeping and signals under m_idle_, or
+  // we see its task here.
+  sleepers_++;
+  __sync_synchronize();
+  while (! hasWork() && ! stopping_) {
+    cv_idle_.wait(&m_idle_);
+  }
+  sleepers_--;
+
+  return ! stopping_ || hasWork();
+}
+
+void ThreadPoolStealing::wakeUp(int n) {
+  // See waitForWork().
+  __sync_synchronize();
+  if (sleepers_ == 0) {
+    return;
+  }
+
+  ScopedLock l(&m_idle_);
+  if (n >= sleepers_) {
+    cv_idle_.signalAll();
+  } else {
+    for (int i = 0; i < n; i++) {
+      cv_idle_.signal();
+    }
+  }
+}
+
+} // namespace base
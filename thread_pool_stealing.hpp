@@ -0,0 +1,120 @@
+#ifndef MCP_BASE_THREAD_POOL_STEALING_HEADER
+#define MCP_BASE_THREAD_POOL_STEALING_HEADER
+
+#include <inttypes.h>
+#include <queue>
+#include <vector>
+
+#include "callback.hpp"
+#include "lock.hpp"
+#include "task_generations.hpp"
+#include "thread_pool.hpp"
+
+namespace base {
+
+using std::queue;
+using std::vector;
+
+// A work-stealing thread pool. Each worker has a deque of its own
+// (Chase-Lev): it pushes and pops tasks at the bottom without taking
+// any lock, while idle workers steal from the top of a random victim.
+// Tasks added from one of the pool's workers go to that worker's
+// deque; tasks added from other threads go to a shared injection
+// queue, from where any worker picks them up. Workers with nothing to
+// run or steal sleep until a task is added.
+//
+// Tasks that spawn tasks thus keep them on the same thread, and
+// workers contend only when one runs out of work.
+//
+// Worker IDs (see ThreadPoolFast::ME()) start at 'first_worker'.
+//
+// Thread Safety:
+//
+//   All calls are thread-safe. stop() may be issued from a worker.
+//
+class ThreadPoolStealing : public WorkerPool {
+public:
+  explicit ThreadPoolStealing(int num_workers, int first_worker = 0);
+  virtual ~ThreadPoolStealing();
+
+  // ThreadPool interface. Tasks added before stop() are run before it
+  // returns; tasks added after it are kept, and disposed of by the
+  // destructor.
+  virtual void addTask(Callback<void>* task);
+  virtual void stop();
+  virtual int count() const;
+
+  // The 'n' tasks get into the injection queue under a single lock,
+  // and wake up at most 'n' sleeping workers.
+  virtual void addTasks(Callback<void>** tasks, int n);
+
+  // Tasks are not numbered here; the pool counts them by generation
+  // instead (see TaskGenerations).
+  virtual uint64_t epoch() const;
+  virtual bool passed(uint64_t epoch) const;
+
+  // Pins the workers, which may be busy already; see WorkerPool.
+  virtual void pin(const ThreadAffinity& affinity,
+                   int first_slot = 0,
+                   int num_slots = 0);
+
+private:
+  class Worker;
+
+  // A task and the generation bucket it counts in.
+  struct Entry {
+    Callback<void>* task;
+    int             bucket;
+  };
+
+  typedef vector<Worker*>   Workers;
+  typedef vector<pthread_t> TIDs;
+  typedef queue<Entry>      InjectionQueue;
+
+  Workers                   workers_;      // owned here
+  TIDs                      workers_tids_;
+  const int                 num_workers_;
+
+  // Tasks added from outside the pool. 'injected_' mirrors its size,
+  // so that workers can look for work without the lock.
+  mutable Mutex             m_inject_;
+  InjectionQueue            inject_queue_;
+  volatile int              injected_;
+
+  // Sleeping workers wait on 'cv_idle_'. 'sleepers_' is changed under
+  // 'm_idle_' but read without it.
+  Mutex                     m_idle_;
+  ConditionVar              cv_idle_;
+  volatile int              sleepers_;
+  volatile bool             stopping_;
+
+  // Task boundaries; see TaskGenerations.
+  TaskGenerations           gens_;
+
+  // Returns the worker of this pool the call is issued from, or NULL.
+  Worker* currentWorker() const;
+
+  // Finds a task for 'worker': in its own deque, in the injection
+  // queue, or in another worker's deque. Returns false if there is
+  // none.
+  bool findTask(Worker* worker, Entry* entry);
+
+  // Returns true if any task is waiting to be run.
+  bool hasWork() const;
+
+  // Puts the calling worker to sleep until there's work. Returns
+  // false if the pool is stopping and there's no work left.
+  bool waitForWork();
+
+  // Wakes up to 'n' sleeping workers. The caller must have made its
+  // new tasks visible already.
+  void wakeUp(int n);
+
+  // Non-copyable, non-assignable.
+  ThreadPoolStealing(const ThreadPoolStealing&);
+  ThreadPoolStealing& operator=(const ThreadPoolStealing&);
+};
+
+} // namespace base
+
+#endif // MCP_BASE_THREAD_POOL_STEALING_HEADER
@@ -1,11 +1,17 @@
+#include <unistd.h>  // usleep
+
+#include "thread_pool_fast.hpp"
 #include "thread_pool_normal.hpp"
+#include "thread_pool_stealing.hpp"
 #include "test_unit.hpp"
 #include "lock.hpp"
 
 namespace {
 
 using base::ThreadPool;
+using base::ThreadPoolFast;
 using base::ThreadPoolNormal;
+using base::ThreadPoolStealing;
 using base::Callback;
 using base::makeCallableOnce;
 using base::makeCallableMany;
@@ -160,6 +166,34 @@ TEST(Running, MultiThreaded) {
   
 }
 
+TEST(Running, addTasks) {
+  ThreadPool* pools[] = { new ThreadPoolNormal(4),
+                          new ThreadPoolFast(4),
+                          new ThreadPoolStealing(4) };
+  for (int p=0; p<3; p++) {
+    Server my_Server(0);
+    Callback<void>* task = makeCallableMany(&Server::accumulate, &my_Server, 10);
+    Callback<void>* batch[10];
+    for (int i=0; i<10; i++) {
+      batch[i] = task;
+    }
+    for (int i=0; i<20; i++) {
+      pools[p]->addTasks(batch, 1 + i % 10);
+    }
+    pools[p]->addTasks(batch, 0);
+
+    // ThreadPoolNormal drops the tasks still queued when it stops.
+    for (int i=0; i<1000 && my_Server.getValue() < 4950; i++) {
+      usleep(1000);
+    }
+    pools[p]->stop();
+    EXPECT_EQ(my_Server.getValue(), 4950);
+    EXPECT_EQ(pools[p]->count(), 0);
+    delete pools[p];
+    delete task;
+  }
+}
+
 //The following tests take the thread pool itself as server object.
 TEST(Running, stopAsTask) {
   ThreadPoolNormal* pool = new ThreadPoolNormal(5);
@@ -209,6 +243,236 @@ TEST(Running, addTaskAsTask) {
   delete body1;
   delete body2;
 }
+
+// Each task adds two tasks from its worker thread, down to 'depth'
+// levels. In a work-stealing pool, the work starts in one worker's
+// deque and gets stolen by the others.
+class Spawner {
+public:
+  explicit Spawner(ThreadPool* pool) : pool_(pool), leaves_(0) {}
+
+  void spawn(int depth) {
+    if (depth == 0) {
+      __sync_fetch_and_add(&leaves_, 1);
+      return;
+    }
+    pool_->addTask(makeCallableOnce(&Spawner::spawn, this, depth - 1));
+    pool_->addTask(makeCallableOnce(&Spawner::spawn, this, depth - 1));
+  }
+
+  int leaves() const { return leaves_; }
+
+private:
+  ThreadPool* pool_;
+  int         leaves_;
+};
+
+// Holds a worker until released.
+class Gate {
+public:
+  void hold() { open_.wait(); }
+  void release() { open_.notify(); }
+
+private:
+  Notification open_;
+};
+
+TEST(Stealing, Running) {
+  Server my_Server(91);
+  Callback<void>* task1 = makeCallableMany(&Server::accumulate, &my_Server, 10);
+  Callback<void>* task2 = makeCallableMany(&Server::accumulate, &my_Server, 10);
+  Callback<void>* task3 = makeCallableMany(&Server::accumulate, &my_Server, 10);
+  ThreadPoolStealing* pool = new ThreadPoolStealing(4);
+  for (int i=0; i<100; i++) {
+    pool->addTask(task1);
+    pool->addTask(task2);
+  }
+  pool->addTask(task3);
+  pool->stop();  // tasks added before stop() get run
+  EXPECT_EQ(my_Server.getValue(), 9136);
+  EXPECT_EQ(pool->count(), 0);
+  for (int i=0; i<5; i++) {
+    pool->addTask(task1);
+    pool->addTask(task2);
+  }
+  EXPECT_EQ(pool->count(), 10);
+  EXPECT_EQ(my_Server.getValue(), 9136);
+  delete pool;
+  delete task1;
+  delete task2;
+  delete task3;
+}
+
+TEST(Stealing, TasksFromWorkers) {
+  ThreadPoolStealing* pool = new ThreadPoolStealing(4);
+  Spawner spawner(pool);
+  pool->addTask(makeCallableOnce(&Spawner::spawn, &spawner, 12));
+  pool->stop();  // waits for the tasks the workers add, too
+  EXPECT_EQ(spawner.leaves(), 1 << 12);
+  EXPECT_EQ(pool->count(), 0);
+  delete pool;
+}
+
+TEST(Stealing, stopAsTask) {
+  ThreadPoolStealing* pool = new ThreadPoolStealing(5);
+  Server my_Server(10);
+  Callback<void>* task1 = makeCallableMany(&Server::accumulate, &my_Server, 20);
+  Callback<void>* task2 = makeCallableMany(&ThreadPoolStealing::stop, pool);
+  Callback<void>* task3 = makeCallableMany(&Server::accumulateWithN, &my_Server, 20);
+  pool->addTask(task1);
+  pool->addTask(task3);
+  n.wait();
+  n.reset();
+  pool->addTask(task2);//task2 issues a stop to the task queue.
+  sleep(1);
+  EXPECT_EQ(my_Server.getValue(), 390);
+  EXPECT_EQ(pool->count(), 0);
+  delete pool;
+  delete task1;
+  delete task2;
+  delete task3;
+}
+
+TEST(Stealing, Epochs) {
+  ThreadPoolStealing* pool = new ThreadPoolStealing(2);
+  EXPECT_TRUE(pool->passed(pool->epoch()));
+
+  // An epoch isn't passed while a task added before it still runs,
+  // even as other tasks come and go.
+  Gate gate;
+  pool->addTask(makeCallableOnce(&Gate::hold, &gate));
+  const uint64_t epoch = pool->epoch();
+  Server my_Server(0);
+  Callback<void>* task = makeCallableMany(&Server::accumulate, &my_Server, 10);
+  for (int i=0; i<100; i++) {
+    pool->addTask(task);
+    EXPECT_FALSE(pool->passed(epoch));
+  }
+
+  gate.release();
+  bool passed = false;
+  for (int i=0; i<1000 && !passed; i++) {
+    usleep(1000);
+    passed = pool->passed(epoch);
+  }
+  EXPECT_TRUE(passed);
+
+  pool->stop();
+  EXPECT_EQ(my_Server.getValue(), 4500);
+  delete pool;
+  delete task;
+}
+
+TEST(Fast, Running) {
+  // More tasks than the dispatch queue holds.
+  Server my_Server(0);
+  Callback<void>* task = makeCallableMany(&Server::accumulate, &my_Server, 10);
+  ThreadPoolFast* pool = new ThreadPoolFast(4);
+  for (int i=0; i<10000; i++) {
+    pool->addTask(task);
+  }
+  pool->stop();  // tasks added before stop() get run
+  EXPECT_EQ(my_Server.getValue(), 450000);
+  EXPECT_EQ(pool->count(), 0);
+  for (int i=0; i<5; i++) {
+    pool->addTask(task);
+  }
+  EXPECT_EQ(pool->count(), 5);
+  delete pool;
+  delete task;
+}
+
+TEST(Fast, TasksFromWorkers) {
+  ThreadPoolFast* pool = new ThreadPoolFast(4);
+  Spawner spawner(pool);
+  pool->addTask(makeCallableOnce(&Spawner::spawn, &spawner, 12));
+  pool->stop();  // waits for the tasks the workers add, too
+  EXPECT_EQ(spawner.leaves(), 1 << 12);
+  EXPECT_EQ(pool->count(), 0);
+  delete pool;
+}
+
+TEST(Fast, stopAsTask) {
+  ThreadPoolFast* pool = new ThreadPoolFast(5);
+  Server my_Server(10);
+  Callback<void>* task1 = makeCallableMany(&Server::accumulate, &my_Server, 20);
+  Callback<void>* task2 = makeCallableMany(&ThreadPoolFast::stop, pool);
+  Callback<void>* task3 = makeCallableMany(&Server::accumulateWithN, &my_Server, 20);
+  pool->addTask(task1);
+  pool->addTask(task3);
+  n.wait();
+  n.reset();
+  pool->addTask(task2);//task2 issues a stop to the task queue.
+  sleep(1);
+  EXPECT_EQ(my_Server.getValue(), 390);
+  EXPECT_EQ(pool->count(), 0);
+  delete pool;
+  delete task1;
+  delete task2;
+  delete task3;
+}
+
+TEST(Fast, Epochs) {
+  ThreadPoolFast* pool = new ThreadPoolFast(2);
+  EXPECT_TRUE(pool->passed(pool->epoch()));
+
+  Gate gate;
+  pool->addTask(makeCallableOnce(&Gate::hold, &gate));
+  const uint64_t epoch = pool->epoch();
+  Server my_Server(0);
+  Callback<void>* task = makeCallableMany(&Server::accumulate, &my_Server, 10);
+  for (int i=0; i<100; i++) {
+    pool->addTask(task);
+    EXPECT_FALSE(pool->passed(epoch));
+  }
+
+  gate.release();
+  bool passed = false;
+  for (int i=0; i<1000 && !passed; i++) {
+    usleep(1000);
+    passed = pool->passed(epoch);
+  }
+  EXPECT_TRUE(passed);
+
+  pool->stop();
+  EXPECT_EQ(my_Server.getValue(), 4500);
+  delete pool;
+  delete task;
+}
+
+TEST(Fast, IdleSpin) {
+  ThreadPoolFast* pool = new ThreadPoolFast(2);
+  Server my_Server(0);
+  Callback<void>* task = makeCallableMany(&Server::accumulate, &my_Server, 10);
+
+  // Each task finds the workers idle, whether spinning or parked.
+  pool->setIdleSpin(0.0005);
+  for (int i=0; i<20; i++) {
+    pool->addTask(task);
+    usleep(1000);
+  }
+  ThreadPoolFast::IdleStats stats;
+  pool->getIdleStats(&stats);
+  EXPECT_GT(stats.spin_hits + stats.yield_hits + stats.parks, 19);
+
+  // Without a spin, no wait ends while spinning.
+  pool->setIdleSpin(0);
+  usleep(10000);
+  pool->getIdleStats(&stats);
+  const uint64_t spin_hits = stats.spin_hits;
+  for (int i=0; i<20; i++) {
+    pool->addTask(task);
+    usleep(1000);
+  }
+  pool->getIdleStats(&stats);
+  EXPECT_EQ(stats.spin_hits, spin_hits);
+
+  pool->stop();
+  EXPECT_EQ(my_Server.getValue(), 1800);
+  delete pool;
+  delete task;
+}
+
 } // unnammed namespace
 
 int main(int argc, char* argv[]) {
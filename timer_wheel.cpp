@@ -0,0 +1,309 @@
+#include <algorithm>
+
+#include "timer_wheel.hpp"
+
+namespace base {
+
+static bool earlierDeadline(const TimerWheel::Expired& a,
+                            const TimerWheel::Expired& b) {
+  return a.deadline < b.deadline;
+}
+
+TimerWheel::TimerWheel(TicksClock::Ticks now, TicksClock::Ticks resolution)
+  : resolution_(resolution > 0 ? resolution : 1),
+    current_(now / resolution_),
+    free_(-1),
+    num_pending_(0) {
+  for (int i = 0; i <= ExpiredSlot; i++) {
+    slots_[i] = -1;
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  for (size_t i = 0; i < entries_.size(); i++) {
+    Entry& entry = entries_[i];
+    if (entry.state != FREE) {
+      disposeTask(entry.task, entry.period != 0);
+    }
+  }
+}
+
+TimerWheel::Handle TimerWheel::add(TicksClock::Ticks deadline,
+                                   Callback<void>* task,
+                                   TicksClock::Ticks period) {
+  const int idx = newEntry();
+  Entry& entry = entries_[idx];
+  entry.deadline = deadline;
+  entry.period = period;
+  entry.expires = (deadline + resolution_ - 1) / resolution_;
+  entry.task = task;
+  entry.state = PENDING;
+  insert(idx);
+  num_pending_++;
+  return handleOf(idx);
+}
+
+bool TimerWheel::cancel(Handle handle) {
+  Entry* entry = lookup(handle);
+  if (entry == NULL || entry->state != PENDING) {
+    return false;
+  }
+
+  const int idx = entry - &entries_[0];
+  unlink(idx);
+  num_pending_--;
+  if (entry->running) {
+    // The task is running somewhere. done() will finish the job.
+    entry->state = CANCELLED;
+  } else {
+    disposeTask(entry->task, entry->period != 0);
+    freeEntry(idx);
+  }
+  return true;
+}
+
+void TimerWheel::advance(TicksClock::Ticks now, vector<Expired>* expired) {
+  expire(ExpiredSlot, expired);
+
+  const uint64_t target = now / resolution_;
+  if (num_pending_ == 0) {
+    current_ = std::max(current_, target);
+    return;
+  }
+
+  while (current_ < target && num_pending_ > 0) {
+    current_++;
+
+    // Each time a level wraps around, the level above it moves one
+    // slot and spreads that slot's timers down.
+    int index = current_ & SlotMask;
+    for (int level = 1; index == 0 && level < NumLevels; level++) {
+      index = cascade(level);
+    }
+
+    // Timers cascading onto the current tick land in ExpiredSlot.
+    expire(current_ & SlotMask, expired);
+    expire(ExpiredSlot, expired);
+  }
+  current_ = std::max(current_, target);
+}
+
+bool TimerWheel::done(Handle handle) {
+  Entry* entry = lookup(handle);
+  if (entry == NULL) {
+    return false;
+  }
+
+  if (entry->state == CANCELLED) {
+    disposeTask(entry->task, true);
+    freeEntry(entry - &entries_[0]);
+    return false;
+  }
+  entry->running = false;
+  return true;
+}
+
+bool TimerWheel::nextExpiration(TicksClock::Ticks* when) const {
+  if (num_pending_ == 0) {
+    return false;
+  }
+  if (slots_[ExpiredSlot] != -1) {
+    *when = current_ * resolution_;
+    return true;
+  }
+
+  // The first non-empty slot in level 0 holds timers that expire in
+  // exactly that tick. The first non-empty slot of a higher level
+  // says when its timers will be spread down, which is as late as we
+  // can wake up without missing any of them.
+  uint64_t first = ~0ULL;
+  for (int level = 0; level < NumLevels; level++) {
+    const int shift = level * LevelBits;
+    const uint64_t position = current_ >> shift;
+    for (int i = 1; i <= SlotsPerLevel; i++) {
+      const uint64_t tick = (position + i) << shift;
+      if (tick >= first) {
+        break;
+      }
+      const int slot = level * SlotsPerLevel + ((position + i) & SlotMask);
+      if (slots_[slot] != -1) {
+        first = tick;
+        break;
+      }
+    }
+  }
+
+  *when = first * resolution_;
+  return true;
+}
+
+int TimerWheel::newEntry() {
+  int idx = free_;
+  if (idx == -1) {
+    Entry entry;
+    entry.generation = 0;
+    entries_.push_back(entry);
+    idx = entries_.size() - 1;
+  } else {
+    free_ = entries_[idx].next;
+  }
+
+  Entry& entry = entries_[idx];
+  entry.generation = (entry.generation + 1) & 0xFFFFFF;
+  if (entry.generation == 0) {
+    entry.generation = 1;
+  }
+  entry.running = false;
+  entry.slot = -1;
+  entry.prev = -1;
+  entry.next = -1;
+  return idx;
+}
+
+void TimerWheel::freeEntry(int idx) {
+  Entry& entry = entries_[idx];
+  entry.state = FREE;
+  entry.task = NULL;
+  entry.next = free_;
+  free_ = idx;
+}
+
+TimerWheel::Entry* TimerWheel::lookup(Handle handle) {
+  const uint64_t idx = handle & 0xFFFFFFFF;
+  if (idx >= entries_.size()) {
+    return NULL;
+  }
+  Entry* entry = &entries_[idx];
+  if (entry->state == FREE || entry->generation != (handle >> 32)) {
+    return NULL;
+  }
+  return entry;
+}
+
+TimerWheel::Handle TimerWheel::handleOf(int idx) const {
+  return (static_cast<Handle>(entries_[idx].generation) << 32) | idx;
+}
+
+void TimerWheel::insert(int idx) {
+  const uint64_t expires = entries_[idx].expires;
+  if (expires <= current_) {
+    link(idx, ExpiredSlot);
+    return;
+  }
+
+  // Pick the lowest level that reaches the expiration. A deadline
+  // beyond the top level waits at its farthest slot.
+  uint64_t delta = expires - current_;
+  int level = 0;
+  while (delta >= SlotsPerLevel && level < NumLevels - 1) {
+    delta >>= LevelBits;
+    level++;
+  }
+  const int shift = level * LevelBits;
+  uint64_t position = expires >> shift;
+  if (delta >= SlotsPerLevel) {
+    position = (current_ >> shift) + SlotMask;
+  }
+  link(idx, level * SlotsPerLevel + (position & SlotMask));
+}
+
+void TimerWheel::link(int idx, int slot) {
+  Entry& entry = entries_[idx];
+  entry.slot = slot;
+  entry.prev = -1;
+  entry.next = slots_[slot];
+  if (entry.next != -1) {
+    entries_[entry.next].prev = idx;
+  }
+  slots_[slot] = idx;
+}
+
+void TimerWheel::unlink(int idx) {
+  Entry& entry = entries_[idx];
+  if (entry.prev != -1) {
+    entries_[entry.prev].next = entry.next;
+  } else {
+    slots_[entry.slot] = entry.next;
+  }
+  if (entry.next != -1) {
+    entries_[entry.next].prev = entry.prev;
+  }
+  entry.slot = -1;
+  entry.prev = -1;
+  entry.next = -1;
+}
+
+int TimerWheel::cascade(int level) {
+  const int index = (current_ >> (level * LevelBits)) & SlotMask;
+  const int slot = level * SlotsPerLevel + index;
+
+  int idx = slots_[slot];
+  slots_[slot] = -1;
+  while (idx != -1) {
+    const int next = entries_[idx].next;
+    insert(idx);
+    idx = next;
+  }
+  return index;
+}
+
+void TimerWheel::expire(int slot, vector<Expired>* expired) {
+  int idx = slots_[slot];
+  if (idx == -1) {
+    return;
+  }
+  slots_[slot] = -1;
+
+  // Timers in a slot are not in deadline order; sort the few that
+  // expire together.
+  const size_t first = expired->size();
+  while (idx != -1) {
+    Entry& entry = entries_[idx];
+    const int next = entry.next;
+    entry.slot = -1;
+
+    if (entry.period == 0) {
+      Expired e;
+      e.handle = handleOf(idx);
+      e.task = entry.task;
+      e.deadline = entry.deadline;
+      e.periodic = false;
+      expired->push_back(e);
+
+      num_pending_--;
+      freeEntry(idx);
+    } else {
+      if (!entry.running) {
+        Expired e;
+        e.handle = handleOf(idx);
+        e.task = entry.task;
+        e.deadline = entry.deadline;
+        e.periodic = true;
+        expired->push_back(e);
+        entry.running = true;
+      }
+
+      // Keep to the original cadence, skipping the periods that are
+      // already gone.
+      const TicksClock::Ticks now = current_ * resolution_;
+      entry.deadline += entry.period;
+      if (entry.deadline <= now) {
+        const TicksClock::Ticks missed = (now - entry.deadline) / entry.period;
+        entry.deadline += (missed + 1) * entry.period;
+      }
+      entry.expires = (entry.deadline + resolution_ - 1) / resolution_;
+      insert(idx);
+    }
+
+    idx = next;
+  }
+  std::sort(expired->begin() + first, expired->end(), earlierDeadline);
+}
+
+void TimerWheel::disposeTask(Callback<void>* task, bool periodic) {
+  if (periodic || task->once()) {
+    delete task;
+  }
+}
+
+}  // namespace base
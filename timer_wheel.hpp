@@ -0,0 +1,171 @@
+#ifndef MCP_BASE_TIMER_WHEEL_HEADER
+#define MCP_BASE_TIMER_WHEEL_HEADER
+
+#include <inttypes.h>
+#include <vector>
+
+#include "callback.hpp"
+#include "ticks_clock.hpp"
+
+namespace base {
+
+using std::vector;
+
+// A TimerWheel keeps tasks to be run at given deadlines. Adding and
+// cancelling a timer take constant time, regardless of how many
+// timers there are or how far their deadlines lie.
+//
+// Time is cut in 'ticks' of a given resolution. The wheel has several
+// levels of 64 slots each: a slot in level 0 holds the timers due in
+// one tick, a slot in level 1 those due in 64 ticks, in level 2 in
+// 64*64 ticks, and so on. As the wheel turns, the timers in a slot of
+// a higher level are spread over the level below, until they reach
+// level 0 and expire. Deadlines too far out for the top level wait
+// in its last slot and are re-spread when it comes around.
+//
+// A timer never expires before its deadline, and expires at most one
+// tick after it (plus however late advance() is called).
+//
+// Timers are either one-shot or periodic. A one-shot timer's task is
+// handed out when it expires and the timer is gone. A periodic
+// timer's task is handed out each period and the timer is scheduled
+// for the next one right away. The task is then 'running' until the
+// caller issues done(). Periods that expire while the task is
+// running are skipped, and a periodic timer cancelled while its task
+// is running has the task disposed of at done().
+//
+// Thread safety:
+//
+//   None. The caller must serialize all calls.
+//
+// Usage:
+//
+//   TimerWheel wheel(TicksClock::getTicks(), ticks_per_msec);
+//   TimerWheel::Handle h = wheel.add(deadline, task);
+//   ...
+//   vector<TimerWheel::Expired> expired;
+//   wheel.advance(TicksClock::getTicks(), &expired);
+//   for each 'e' in 'expired', run e.task (and done(e.handle) if
+//   e.periodic)
+//
+
+class TimerWheel {
+public:
+  // Identifies a timer. Handles are never reused (in practice), so a
+  // stale handle is harmless.
+  typedef uint64_t Handle;
+  static const Handle InvalidHandle = 0;
+
+  // Handles fit in these many bits.
+  enum { HandleBits = 56 };
+
+  struct Expired {
+    Handle            handle;
+    Callback<void>*   task;
+    TicksClock::Ticks deadline;
+    bool              periodic;
+  };
+
+  // Builds a wheel whose time starts at 'now' and that advances in
+  // steps of 'resolution'. Times are in TicksClock ticks.
+  TimerWheel(TicksClock::Ticks now, TicksClock::Ticks resolution);
+
+  // Disposes of the pending tasks that the wheel owns (see cancel()),
+  // including periodic ones whose done() never came.
+  ~TimerWheel();
+
+  // Schedules 'task' to expire at 'deadline' and, if 'period' is
+  // not zero, every 'period' after that. Takes ownership of 'task' if
+  // it is a once-callback or if the timer is periodic.
+  Handle add(TicksClock::Ticks deadline,
+             Callback<void>* task,
+             TicksClock::Ticks period = 0);
+
+  // Cancels the timer 'handle', if it didn't expire yet (or, if
+  // periodic, wasn't cancelled yet), and returns true. Disposes of
+  // the task if the wheel owns it, unless it is running.
+  bool cancel(Handle handle);
+
+  // Turns the wheel up to 'now' and appends the timers that expired
+  // to 'expired', in deadline order.
+  void advance(TicksClock::Ticks now, vector<Expired>* expired);
+
+  // Tells that the task of the periodic timer 'handle' is done
+  // running and returns true. If the timer was cancelled in the
+  // meantime, disposes of it and returns false.
+  bool done(Handle handle);
+
+  // Returns false if there are no pending timers. Otherwise, returns
+  // in 'when' a time by which advance() should be issued next. It is
+  // never later than the first pending timer expires, but may be
+  // earlier.
+  bool nextExpiration(TicksClock::Ticks* when) const;
+
+  // accessors
+
+  size_t size() const { return num_pending_; }
+
+private:
+  enum {
+    LevelBits = 6,
+    SlotsPerLevel = 1 << LevelBits,
+    SlotMask = SlotsPerLevel - 1,
+    NumLevels = 4
+  };
+
+  enum State { FREE, PENDING, CANCELLED };
+
+  // Timers live in a vector and link to each other by index, so they
+  // need no allocation of their own once the vector grew enough.
+  struct Entry {
+    TicksClock::Ticks deadline;
+    TicksClock::Ticks period;
+    uint64_t          expires;     // in wheel ticks
+    Callback<void>*   task;
+    uint32_t          generation;  // distinguishes reuses of the entry
+    State             state;
+    bool              running;     // periodic task handed out
+    int               slot;        // -1 if not in a slot
+    int               prev;
+    int               next;        // also links the free list
+  };
+
+  const TicksClock::Ticks resolution_;
+  uint64_t                current_;      // last tick processed
+  vector<Entry>           entries_;
+  int                     free_;         // head of unused entries
+  size_t                  num_pending_;
+
+  // Heads of the lists of timers in each slot, level by level. The
+  // last list holds timers that expired at add() time.
+  enum { ExpiredSlot = NumLevels * SlotsPerLevel };
+  int                     slots_[ExpiredSlot + 1];
+
+  int newEntry();
+  void freeEntry(int idx);
+  Entry* lookup(Handle handle);
+  Handle handleOf(int idx) const;
+
+  // Places a pending entry in the slot its expiration calls for.
+  void insert(int idx);
+  void link(int idx, int slot);
+  void unlink(int idx);
+
+  // Re-inserts all the timers in 'level's current slot. Returns that
+  // slot's index.
+  int cascade(int level);
+
+  // Moves the timers in 'slot' to 'expired'.
+  void expire(int slot, vector<Expired>* expired);
+
+  // Disposes of 'task' if it is the wheel's.
+  void disposeTask(Callback<void>* task, bool periodic);
+
+  // Non-copyable, non-assignable
+  TimerWheel(const TimerWheel&);
+  TimerWheel& operator=(const TimerWheel&);
+};
+
+}  // namespace base
+
+#endif  // MCP_BASE_TIMER_WHEEL_HEADER
@@ -0,0 +1,218 @@
+#include <vector>
+
+#include "callback.hpp"
+#include "timer_wheel.hpp"
+#include "test_unit.hpp"
+
+namespace {
+
+using std::vector;
+
+using base::Callback;
+using base::makeCallableMany;
+using base::makeCallableOnce;
+using base::TimerWheel;
+
+// Time here is counted in 'ticks' of the wheel's resolution, 10.
+const uint64_t Res = 10;
+
+struct Counter {
+  int fired;
+  Counter() : fired(0) {}
+  void bump() { fired++; }
+};
+
+Callback<void>* bumpOnce(Counter* counter) {
+  return makeCallableOnce(&Counter::bump, counter);
+}
+
+Callback<void>* bumpMany(Counter* counter) {
+  return makeCallableMany(&Counter::bump, counter);
+}
+
+// Runs the expired tasks, as if to completion.
+int runExpired(TimerWheel* wheel, uint64_t now) {
+  vector<TimerWheel::Expired> expired;
+  wheel->advance(now, &expired);
+  for (size_t i = 0; i < expired.size(); i++) {
+    (*expired[i].task)();
+    if (expired[i].periodic) {
+      wheel->done(expired[i].handle);
+    }
+  }
+  return expired.size();
+}
+
+TEST(OneShot, NeverEarlyAtMostOneTickLate) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  wheel.add(25, bumpOnce(&counter));
+  EXPECT_EQ(wheel.size(), 1);
+
+  EXPECT_EQ(runExpired(&wheel, 20), 0);
+  EXPECT_EQ(runExpired(&wheel, 29), 0);
+  EXPECT_EQ(runExpired(&wheel, 30), 1);
+  EXPECT_EQ(counter.fired, 1);
+  EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(OneShot, DeadlineOrder) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  wheel.add(500, bumpOnce(&counter));
+  wheel.add(70, bumpOnce(&counter));
+  wheel.add(3000, bumpOnce(&counter));
+
+  vector<TimerWheel::Expired> expired;
+  wheel.advance(5000, &expired);
+  EXPECT_EQ(expired.size(), 3);
+  EXPECT_EQ(expired[0].deadline, 70);
+  EXPECT_EQ(expired[1].deadline, 500);
+  EXPECT_EQ(expired[2].deadline, 3000);
+  for (size_t i = 0; i < expired.size(); i++) {
+    (*expired[i].task)();
+  }
+}
+
+TEST(OneShot, AlreadyDue) {
+  TimerWheel wheel(1000, Res);
+  Counter counter;
+  wheel.add(500, bumpOnce(&counter));
+
+  uint64_t when;
+  EXPECT_TRUE(wheel.nextExpiration(&when));
+  EXPECT_EQ(when, 1000);
+  EXPECT_EQ(runExpired(&wheel, 1000), 1);
+  EXPECT_EQ(counter.fired, 1);
+}
+
+TEST(OneShot, FarLevels) {
+  // Deadlines spread over every level of the wheel and beyond it.
+  TimerWheel wheel(0, 1);
+  Counter counter;
+  const uint64_t deadlines[] = { 63, 64, 4095, 4096, 262143, 262144,
+                                 16777215, 16777216, 50000000 };
+  const int num = sizeof(deadlines) / sizeof(deadlines[0]);
+  for (int i = 0; i < num; i++) {
+    wheel.add(deadlines[i], bumpOnce(&counter));
+  }
+
+  for (int i = 0; i < num; i++) {
+    EXPECT_EQ(runExpired(&wheel, deadlines[i] - 1), 0);
+    EXPECT_EQ(runExpired(&wheel, deadlines[i]), 1);
+  }
+  EXPECT_EQ(counter.fired, num);
+}
+
+TEST(NextExpiration, NeverLate) {
+  TimerWheel wheel(0, Res);
+  uint64_t when;
+  EXPECT_FALSE(wheel.nextExpiration(&when));
+
+  Counter counter;
+  wheel.add(1234567, bumpOnce(&counter));
+
+  // Follow the wheel's advice until the timer fires. It must never
+  // tell us to sleep past the deadline.
+  uint64_t now = 0;
+  while (counter.fired == 0) {
+    EXPECT_TRUE(wheel.nextExpiration(&when));
+    EXPECT_TRUE(when <= 1234570);
+    EXPECT_GT(when, now);
+    now = when;
+    runExpired(&wheel, now);
+  }
+  EXPECT_EQ(now, 1234570);
+}
+
+TEST(Cancel, Pending) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  TimerWheel::Handle h1 = wheel.add(100, bumpOnce(&counter));
+  TimerWheel::Handle h2 = wheel.add(100000, bumpOnce(&counter));
+  wheel.add(200, bumpOnce(&counter));
+
+  EXPECT_TRUE(wheel.cancel(h1));
+  EXPECT_TRUE(wheel.cancel(h2));
+  EXPECT_FALSE(wheel.cancel(h1));
+  EXPECT_EQ(wheel.size(), 1);
+
+  EXPECT_EQ(runExpired(&wheel, 200000), 1);
+  EXPECT_EQ(counter.fired, 1);
+}
+
+TEST(Cancel, StaleHandle) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  TimerWheel::Handle h1 = wheel.add(100, bumpOnce(&counter));
+  EXPECT_EQ(runExpired(&wheel, 100), 1);
+
+  // The entry gets reused but the old handle does not reach it.
+  TimerWheel::Handle h2 = wheel.add(200, bumpOnce(&counter));
+  EXPECT_NEQ(h1, h2);
+  EXPECT_FALSE(wheel.cancel(h1));
+  EXPECT_EQ(runExpired(&wheel, 200), 1);
+  EXPECT_EQ(counter.fired, 2);
+}
+
+TEST(Periodic, Cadence) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  wheel.add(100, bumpMany(&counter), 100);
+
+  for (uint64_t now = 100; now <= 1000; now += 100) {
+    EXPECT_EQ(runExpired(&wheel, now - 1), 0);
+    EXPECT_EQ(runExpired(&wheel, now), 1);
+  }
+  EXPECT_EQ(counter.fired, 10);
+
+  // Missed periods are skipped, not run in a burst.
+  EXPECT_EQ(runExpired(&wheel, 1550), 1);
+  EXPECT_EQ(runExpired(&wheel, 1599), 0);
+  EXPECT_EQ(runExpired(&wheel, 1600), 1);
+  EXPECT_EQ(wheel.size(), 1);
+}
+
+TEST(Periodic, NoOverlap) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  TimerWheel::Handle h = wheel.add(100, bumpMany(&counter), 100);
+
+  vector<TimerWheel::Expired> expired;
+  wheel.advance(100, &expired);
+  EXPECT_EQ(expired.size(), 1);
+
+  // While the task 'runs', its periods go by without it.
+  wheel.advance(350, &expired);
+  EXPECT_EQ(expired.size(), 1);
+  EXPECT_TRUE(wheel.done(h));
+  EXPECT_EQ(runExpired(&wheel, 399), 0);
+  EXPECT_EQ(runExpired(&wheel, 400), 1);
+}
+
+TEST(Periodic, CancelWhileRunning) {
+  TimerWheel wheel(0, Res);
+  Counter counter;
+  TimerWheel::Handle h = wheel.add(100, bumpMany(&counter), 100);
+
+  vector<TimerWheel::Expired> expired;
+  wheel.advance(100, &expired);
+  EXPECT_EQ(expired.size(), 1);
+  EXPECT_TRUE(expired[0].periodic);
+
+  // The task is 'running' while the timer gets cancelled. It goes
+  // away when it finishes.
+  EXPECT_TRUE(wheel.cancel(h));
+  EXPECT_FALSE(wheel.cancel(h));
+  (*expired[0].task)();
+  EXPECT_FALSE(wheel.done(h));
+  EXPECT_EQ(wheel.size(), 0);
+  EXPECT_EQ(runExpired(&wheel, 1000), 0);
+  EXPECT_EQ(counter.fired, 1);
+}
+
+} // unnamed namespace
+
+int main(int argc, char *argv[]) {
+  return RUN_TESTS(argc, argv);
+}
@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <limits.h>     // IOV_MAX
+#include <pthread.h>
+#include <stdio.h>      // perror
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>    // writev
+#include <unistd.h>     // read, write, close
+
+#include "buffer.hpp"
+#include "callback.hpp"
+#include "thread.hpp"
+#include "timer.hpp"
+
+// Measures how many write system calls it takes to send a response
+// made of a few header lines plus a cached file, which is what
+// HTTPServerConnection produces. The response is flushed down a
+// socket pair, either one contiguous chunk per write() or all chunks
+// at once per writev(), the way Connection::doWrite() does it.
+
+namespace {
+
+using base::Buffer;
+using base::Callback;
+using base::Timer;
+using base::makeCallableOnce;
+using base::makeThread;
+using std::string;
+
+const int NumResponses = 2000;
+
+// Reads and discards everything that arrives on a socket, until the
+// other side closes it.
+class Drainer {
+public:
+  explicit Drainer(int fd) : fd_(fd) {}
+
+  void run() {
+    char buf[64 << 10];
+    while (true) {
+      int res = read(fd_, buf, sizeof(buf));
+      if ((res < 0) && (errno == EINTR)) continue;
+      if (res <= 0) break;
+    }
+  }
+
+private:
+  int fd_;
+};
+
+// Flushes 'out' with one write() per contiguous area. Returns the
+// number of system calls issued.
+int flushWrite(int fd, Buffer* out) {
+  int syscalls = 0;
+  while (out->byteCount() > 0) {
+    int res = write(fd, out->readPtr(), out->readSize());
+    syscalls++;
+    if (res > 0) {
+      out->consume(res);
+    } else if (errno != EINTR) {
+      break;
+    }
+  }
+  return syscalls;
+}
+
+// Flushes 'out' with one writev() per IOV_MAX chunks. Returns the
+// number of system calls issued.
+int flushWritev(int fd, Buffer* out) {
+  struct iovec iov[IOV_MAX];
+  int syscalls = 0;
+  while (out->byteCount() > 0) {
+    int iovcnt = out->readVector(iov, IOV_MAX);
+    int res = writev(fd, iov, iovcnt);
+    syscalls++;
+    if (res > 0) {
+      out->consume(res);
+    } else if (errno != EINTR) {
+      break;
+    }
+  }
+  return syscalls;
+}
+
+void runBenchmark(const char* name,
+                  int (*flush)(int, Buffer*),
+                  size_t file_size) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("socketpair");
+    return;
+  }
+  Drainer drainer(fds[1]);
+  Callback<void>* body = makeCallableOnce(&Drainer::run, &drainer);
+  pthread_t tid = makeThread(body);
+
+  Buffer file;
+  file.write(string(file_size, 'x'));
+
+  Timer timer;
+  timer.start();
+
+  long syscalls = 0;
+  for (int i = 0; i < NumResponses; i++) {
+    Buffer out;
+    out.write("HTTP/1.1 200 OK\r\n");
+    out.write("Content-Type: text/html\r\n");
+    out.write("\r\n");
+    out.shareFrom(&file);
+    syscalls += flush(fds[0], &out);
+  }
+
+  timer.end();
+  close(fds[0]);
+  pthread_join(tid, NULL);
+  close(fds[1]);
+
+  std::cout << std::setiosflags(std::ios::left)
+            << std::setw(10) << name
+            << std::setw(12) << file_size
+            << std::setw(20) << double(syscalls) / NumResponses
+            << timer.elapsed() << std::endl;
+}
+
+}  // unnamed namespace
+
+int main(int argc, char* argv[]) {
+  std::cout << std::setiosflags(std::ios::left)
+            << std::setw(10) << "# mode"
+            << std::setw(12) << "file size"
+            << std::setw(20) << "syscalls/response"
+            << "seconds" << std::endl;
+
+  const size_t sizes[] = { 1 << 10, 4 << 10, 16 << 10, 64 << 10, 256 << 10 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    runBenchmark("write", flushWrite, sizes[i]);
+    runBenchmark("writev", flushWritev, sizes[i]);
+  }
+
+  return 0;
+}